@@ -0,0 +1,59 @@
+#include "AlignedBuffer.hpp"
+#include "Metrics.hpp"
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+
+struct ThreadBufferPool {
+    std::vector<std::pair<char*, size_t>> free;
+    size_t bytes = 0;
+
+    ~ThreadBufferPool() {
+        for (auto& buffer : free) std::free(buffer.first);
+    }
+};
+
+static thread_local ThreadBufferPool threadPool;
+
+AlignedBuffer::AlignedBuffer(size_t size) : data(nullptr), capacity(0) {
+    // Best fit among the released buffers
+    ThreadBufferPool& pool = threadPool;
+    size_t best = pool.free.size();
+    for (size_t i = 0; i < pool.free.size(); i++) {
+        if (pool.free[i].second >= size && (best == pool.free.size() || pool.free[i].second < pool.free[best].second)) {
+            best = i;
+        }
+    }
+    if (best != pool.free.size()) {
+        data = pool.free[best].first;
+        capacity = pool.free[best].second;
+        pool.bytes -= capacity;
+        pool.free[best] = pool.free.back();
+        pool.free.pop_back();
+        return;
+    }
+
+    capacity = (size + ALIGNED_BUFFER_GRANULE - 1) / ALIGNED_BUFFER_GRANULE * ALIGNED_BUFFER_GRANULE;
+    if (capacity == 0) capacity = ALIGNED_BUFFER_GRANULE;
+    void* memory = nullptr;
+    if (posix_memalign(&memory, ALIGNED_BUFFER_ALIGNMENT, capacity) != 0) throw std::bad_alloc();
+    data = static_cast<char*>(memory);
+    Metrics::add(Counter::ALIGNED_BUFFERS_ALLOCATED);
+}
+
+AlignedBuffer::~AlignedBuffer() {
+    if (!data) return;
+    ThreadBufferPool& pool = threadPool;
+    if (pool.bytes + capacity <= ALIGNED_POOL_THREAD_BYTES) {
+        pool.free.emplace_back(data, capacity);
+        pool.bytes += capacity;
+    } else {
+        std::free(data);
+    }
+}
+
+AlignedBuffer::AlignedBuffer(AlignedBuffer&& other) noexcept : data(other.data), capacity(other.capacity) {
+    other.data = nullptr;
+    other.capacity = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef ALIGNEDBUFFER_HPP
+#define ALIGNEDBUFFER_HPP
+
+#include <cstddef>
+
+const size_t ALIGNED_BUFFER_ALIGNMENT = 4096;              // enough for any O_DIRECT device
+const size_t ALIGNED_BUFFER_GRANULE = 64 * 1024;           // sizes are rounded up to this
+const size_t ALIGNED_POOL_THREAD_BYTES = 4 * 1024 * 1024;  // kept per thread between uses
+
+// Memory aligned for O_DIRECT, taken from a pool private to the calling
+// thread and given back to it on destruction, so block I/O does not
+// allocate or zero a buffer per operation. Contents start out undefined.
+// A thread keeps at most ALIGNED_POOL_THREAD_BYTES of released buffers;
+// anything past that is freed.
+class AlignedBuffer {
+private:
+    char* data;
+    size_t capacity;
+
+public:
+    explicit AlignedBuffer(size_t size);
+    ~AlignedBuffer();
+    AlignedBuffer(AlignedBuffer&& other) noexcept;
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(AlignedBuffer&&) = delete;
+
+    char* get() const { return data; }
+    size_t size() const { return capacity; }
+};
+
+#endif // ALIGNEDBUFFER_HPP
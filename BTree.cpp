@@ -1,5 +1,10 @@
 
 #include "BTree.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+
+bool BTreeNode::deferFlush = false;
 
 BTreeNode::BTreeNode(int _t, bool _isLeaf) {
     t = _t;
@@ -27,7 +32,8 @@ void BTreeNode::writeNode(std::fstream &file) {
     file.write(reinterpret_cast<char*>(&n), sizeof(n));
     file.write(reinterpret_cast<char*>(keys), sizeof(FileIndexEntry)*(2*t -1));
     file.write(reinterpret_cast<char*>(childrenOffsets), sizeof(long)*(2*t));
-    file.flush();
+    if (!deferFlush) file.flush();
+    Metrics::add(Counter::BTREE_NODES_WRITTEN);
 }
 
 void BTreeNode::readNode(std::fstream &file, long pos) {
@@ -38,32 +44,34 @@ void BTreeNode::readNode(std::fstream &file, long pos) {
     file.read(reinterpret_cast<char*>(&n), sizeof(n));
     file.read(reinterpret_cast<char*>(keys), sizeof(FileIndexEntry)*(2*t -1));
     file.read(reinterpret_cast<char*>(childrenOffsets), sizeof(long)*(2*t));
+    Metrics::add(Counter::BTREE_NODES_READ);
 }
 
-FileIndexEntry* BTreeNode::search(int fileId, std::fstream &file) {
+bool BTreeNode::search(int fileId, std::fstream &file, FileIndexEntry &result) {
     int i = 0;
     while(i < n && fileId > keys[i].fileId) i++;
 
     if(i < n && keys[i].fileId == fileId && keys[i].inUse) {
-        std::cout << "[BTree] Found file " << fileId << " at block " << keys[i].firstBlock << "\n";
-        return &keys[i];
+        LOG_DEBUG("BTree", "Found file", kv("file", fileId), kv("block", keys[i].firstBlock));
+        result = keys[i];
+        return true;
     }
     
     if(isLeaf) {
-        std::cout << "[BTree] File " << fileId << " not found in leaf node\n";
-        return nullptr;
+        LOG_DEBUG("BTree", "File not found in leaf node", kv("file", fileId));
+        return false;
     }
 
     if(childrenOffsets[i] == -1) {
-        std::cout << "[BTree] File " << fileId << " not found (null child pointer)\n";
-        return nullptr;
+        LOG_DEBUG("BTree", "File not found (null child pointer)", kv("file", fileId));
+        return false;
     }
 
     BTreeNode* child = new BTreeNode(t, true);
     child->readNode(file, childrenOffsets[i]);
-    FileIndexEntry* res = child->search(fileId, file);
+    bool found = child->search(fileId, file, result);
     delete child;
-    return res;
+    return found;
 }
 
 void BTreeNode::traverse(std::fstream &file) {
@@ -121,8 +129,8 @@ void BTreeNode::insertNonFull(const FileIndexEntry &entry, std::fstream &file) {
        
         for(int k = 0; k < n; k++) {
             if(keys[k].fileId == entry.fileId) {
-                std::cout << "[BTree] ✓ UPDATING existing entry: File " << entry.fileId 
-                          << " (block " << keys[k].firstBlock << " → " << entry.firstBlock << ")\n";
+                LOG_DEBUG("BTree", "Updating existing entry", kv("file", entry.fileId),
+                          kv("from", keys[k].firstBlock), kv("to", entry.firstBlock));
                 keys[k].firstBlock = entry.firstBlock;
                 keys[k].inUse = true;
                 writeNode(file);
@@ -137,7 +145,7 @@ void BTreeNode::insertNonFull(const FileIndexEntry &entry, std::fstream &file) {
         keys[i+1] = entry; 
         n++;
         writeNode(file);
-        std::cout << "[BTree] ✓ INSERTED new entry: File " << entry.fileId << " at block " << entry.firstBlock << "\n";
+        LOG_DEBUG("BTree", "Inserted new entry", kv("file", entry.fileId), kv("block", entry.firstBlock));
     } else {
         while(i >= 0 && keys[i].fileId > entry.fileId) i--;
         i++;
@@ -168,7 +176,7 @@ bool BTreeNode::removeKey(int fileId, std::fstream &file) {
         keys[i].inUse = false;
         keys[i].firstBlock = -1;
         writeNode(file);
-        std::cout << "[BTree] Marked file " << fileId << " as deleted\n";
+        LOG_DEBUG("BTree", "Marked file as deleted", kv("file", fileId));
         return true;
     }
     
@@ -182,21 +190,21 @@ bool BTreeNode::removeKey(int fileId, std::fstream &file) {
     return res;
 }
 
-void BTreeNode::collectFileIds(std::fstream &file, std::vector<int>& ids) {
+void BTreeNode::collectEntries(std::fstream &file, std::vector<FileIndexEntry>& entries) {
     int i;
     for(i = 0; i < n; i++) {
         if(!isLeaf && childrenOffsets[i] != -1) {
             BTreeNode* child = new BTreeNode(t,true);
             child->readNode(file, childrenOffsets[i]);
-            child->collectFileIds(file, ids);
+            child->collectEntries(file, entries);
             delete child;
         }
-        if(keys[i].inUse) ids.push_back(keys[i].fileId);
+        if(keys[i].inUse) entries.push_back(keys[i]);
     }
     if(!isLeaf && childrenOffsets[i] != -1) {
         BTreeNode* child = new BTreeNode(t,true);
         child->readNode(file, childrenOffsets[i]);
-        child->collectFileIds(file, ids);
+        child->collectEntries(file, entries);
         delete child;
     }
 }
@@ -210,7 +218,7 @@ BTree::BTree(int _t, const std::string &_filename) {
 
     file.open(filename, std::ios::in | std::ios::out | std::ios::binary);
     if(!file.is_open()) {
-        std::cout << "[BTree] Creating new B-tree file: " << filename << "\n";
+        LOG_INFO("BTree", "Creating new B-tree file", kv("path", filename));
         file.open(filename, std::ios::out|std::ios::binary);
         file.close();
         file.open(filename, std::ios::in|std::ios::out|std::ios::binary);
@@ -219,20 +227,20 @@ BTree::BTree(int _t, const std::string &_filename) {
     file.seekg(0, std::ios::end);
     long fileSize = file.tellg();
     
-    std::cout << "[BTree] B-tree file size: " << fileSize << " bytes\n";
+    LOG_INFO("BTree", "B-tree file opened", kv("bytes", fileSize));
     
     if(fileSize >= sizeof(long)) {
        
         file.seekg(0);
         file.read(reinterpret_cast<char*>(&rootOffset), sizeof(long));
         
-        std::cout << "[BTree] Root offset read from disk: " << rootOffset << "\n";
+        LOG_DEBUG("BTree", "Root offset read from disk", kv("offset", rootOffset));
         if (rootOffset >= sizeof(long) && rootOffset < fileSize) {
             root = new BTreeNode(t,true);
             root->readNode(file, rootOffset);
-            std::cout << "[BTree] ✓ Loaded existing B-tree root with " << root->n << " keys\n";
+            LOG_INFO("BTree", "Loaded existing root", kv("keys", root->n));
         } else {
-            std::cout << "[BTree] Invalid root offset, creating new root\n";
+            LOG_WARN("BTree", "Invalid root offset, creating new root", kv("offset", rootOffset));
             root = new BTreeNode(t,true);
             file.seekp(sizeof(long), std::ios::beg);
             root->offset = file.tellp();
@@ -241,7 +249,7 @@ BTree::BTree(int _t, const std::string &_filename) {
             writeRoot();
         }
     } else {
-        std::cout << "[BTree] Initializing new B-tree\n";
+        LOG_INFO("BTree", "Initializing new B-tree");
         root = new BTreeNode(t,true);
         file.seekp(sizeof(long), std::ios::beg);
         root->offset = file.tellp();
@@ -249,12 +257,12 @@ BTree::BTree(int _t, const std::string &_filename) {
         rootOffset = root->offset;
         writeRoot();
         
-        std::cout << "[BTree] ✓ New root created at offset: " << rootOffset << "\n";
+        LOG_INFO("BTree", "New root created", kv("offset", rootOffset));
     }
 }
 
 BTree::~BTree() {
-    std::cout << "[BTree] Closing B-tree, root offset: " << rootOffset << "\n";
+    LOG_INFO("BTree", "Closing B-tree", kv("root", rootOffset));
     if(file.is_open()) file.close();
     delete root;
 }
@@ -264,15 +272,16 @@ void BTree::writeRoot() {
     file.seekp(0);
     file.write(reinterpret_cast<char*>(&rootOffset), sizeof(long));
     file.flush();
-    std::cout << "[BTree] Root offset saved to disk: " << rootOffset << "\n";
+    LOG_DEBUG("BTree", "Root offset saved to disk", kv("offset", rootOffset));
 }
 
 void BTree::insert(int fileId, int firstBlock) {
-    std::cout << "\n[BTree] ===== Inserting/Updating file " << fileId << " -> block " << firstBlock << " =====\n";
+    TRACE_SPAN("BTree::insert");
+    LOG_DEBUG("BTree", "Insert", kv("file", fileId), kv("block", firstBlock));
     
     FileIndexEntry entry(fileId, firstBlock);
     if(root->n == 2*t-1) {
-        std::cout << "[BTree] Root is full (" << root->n << " keys), splitting...\n";
+        LOG_DEBUG("BTree", "Root is full, splitting", kv("keys", root->n));
         BTreeNode* newRoot = new BTreeNode(t, false);
         long oldRootOffset = root->offset;
         newRoot->childrenOffsets[0] = oldRootOffset;
@@ -285,7 +294,7 @@ void BTree::insert(int fileId, int firstBlock) {
         root = newRoot;
         
         writeRoot();
-        std::cout << "[BTree] ✓ New root created at offset: " << rootOffset << "\n";
+        LOG_DEBUG("BTree", "New root created", kv("offset", rootOffset));
     }
 
     
@@ -293,27 +302,28 @@ void BTree::insert(int fileId, int firstBlock) {
     
 
     root->writeNode(file);
-    
-    std::cout << "[BTree] ===== Insert/Update complete =====\n\n";
 }
 
 FileIndexEntry* BTree::search(int fileId) {
+    TRACE_SPAN("BTree::search");
     if(!root) {
-        std::cout << "[BTree] Search failed: No root node\n";
+        LOG_ERROR("BTree", "Search failed: no root node");
         return nullptr;
     }
     
-    std::cout << "[BTree] Searching for file " << fileId << " (root has " << root->n << " keys)...\n";
+    LOG_DEBUG("BTree", "Searching", kv("file", fileId), kv("rootKeys", root->n));
    
     root->readNode(file, rootOffset);
     
-    return root->search(fileId, file);
+    if (!root->search(fileId, file, found)) return nullptr;
+    return &found;
 }
 
 bool BTree::remove(int fileId) {
+    TRACE_SPAN("BTree::remove");
     if(!root) return false;
     
-    std::cout << "[BTree] Removing file " << fileId << "\n";
+    LOG_DEBUG("BTree", "Removing file", kv("file", fileId));
   
     root->readNode(file, rootOffset);
     
@@ -322,13 +332,19 @@ bool BTree::remove(int fileId) {
 
 std::vector<int> BTree::getAllFileIds() {
     std::vector<int> ids;
+    for (const FileIndexEntry& entry : getAllEntries()) ids.push_back(entry.fileId);
+    LOG_DEBUG("BTree", "Collected file IDs", kv("count", ids.size()));
+    return ids;
+}
+
+std::vector<FileIndexEntry> BTree::getAllEntries() {
+    std::vector<FileIndexEntry> entries;
     if(root) {
  
         root->readNode(file, rootOffset);
-        root->collectFileIds(file, ids);
+        root->collectEntries(file, entries);
     }
-    std::cout << "[BTree] Collected " << ids.size() << " file IDs\n";
-    return ids;
+    return entries;
 }
 
 void BTree::traverse() {
@@ -339,3 +355,13 @@ void BTree::traverse() {
         std::cout << "==================================\n\n";
     }
 }
+
+void BTree::beginBatch() {
+    BTreeNode::deferFlush = true;
+}
+
+void BTree::commitBatch() {
+    BTreeNode::deferFlush = false;
+    file.flush();
+    LOG_DEBUG("BTree", "Batch committed");
+}
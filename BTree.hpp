@@ -21,18 +21,21 @@ public:
     long* childrenOffsets;
     long offset; 
 
+    // While set, node writes are not flushed individually (see BTree::beginBatch)
+    static bool deferFlush;
+
     BTreeNode(int _t, bool _isLeaf);
     ~BTreeNode();
 
     void writeNode(std::fstream &file);
     void readNode(std::fstream &file, long pos);
 
-    FileIndexEntry* search(int fileId, std::fstream &file);
+    bool search(int fileId, std::fstream &file, FileIndexEntry &result);
     void traverse(std::fstream &file);
     void splitChild(int i, BTreeNode* y, std::fstream &file);
     void insertNonFull(const FileIndexEntry &entry, std::fstream &file);
     bool removeKey(int fileId, std::fstream &file);
-    void collectFileIds(std::fstream &file, std::vector<int>& ids);
+    void collectEntries(std::fstream &file, std::vector<FileIndexEntry>& entries);
 };
 
 class BTree {
@@ -46,12 +49,20 @@ public:
     ~BTree();
 
     void insert(int fileId, int firstBlock);
+    // The returned entry is a copy owned by the tree, valid until the next search
     FileIndexEntry* search(int fileId);
     bool remove(int fileId);
     std::vector<int> getAllFileIds();
+    // Every live entry, in fileId order
+    std::vector<FileIndexEntry> getAllEntries();
     void traverse();
+
+    // Node writes between these calls are flushed once, at commitBatch()
+    void beginBatch();
+    void commitBatch();
 private:
     long rootOffset; 
+    FileIndexEntry found;   // result of the last search
     void readRoot();
     void writeRoot();
 };
@@ -0,0 +1,432 @@
+#include "BlockIO.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+// Moves the first done bytes of iov out of the way, in place
+static void advance(struct iovec*& iov, int& count, size_t done) {
+    while (count > 0 && done >= iov->iov_len) {
+        done -= iov->iov_len;
+        iov++;
+        count--;
+    }
+    if (count > 0) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + done;
+        iov->iov_len -= done;
+    }
+}
+
+// Finishes a transfer of which the first done bytes already happened
+static bool transferRest(int fd, const IoRequest& request, size_t done) {
+    if (request.op == IoOp::SYNC) return fdatasync(fd) == 0;
+
+    std::vector<struct iovec> rest(request.iov, request.iov + request.iovCount);
+    struct iovec* iov = rest.data();
+    int count = rest.size();
+    off_t offset = request.offset + done;
+    advance(iov, count, done);
+    while (count > 0) {
+        int batch = std::min(count, IOV_MAX);
+        ssize_t n = request.op == IoOp::READ ? preadv(fd, iov, batch, offset) : pwritev(fd, iov, batch, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        offset += n;
+        advance(iov, count, n);
+    }
+    return true;
+}
+
+static void countBatch(const std::vector<IoRequest>& batch) {
+    Metrics::add(Counter::IO_BATCHES);
+    Metrics::add(Counter::IO_REQUESTS, batch.size());
+}
+
+static bool runHere(int fd, const std::vector<IoRequest>& batch) {
+    bool ok = true;
+    for (const IoRequest& request : batch) {
+        if (!transferRest(fd, request, 0)) ok = false;
+    }
+    return ok;
+}
+
+class SyncIO : public BlockIO {
+private:
+    int fd;
+    RequestExecutor& completions;
+
+public:
+    SyncIO(int fd, RequestExecutor& completions) : fd(fd), completions(completions) {}
+
+    bool run(const std::vector<IoRequest>& batch) override {
+        countBatch(batch);
+        return runHere(fd, batch);
+    }
+
+    // Run on the executor itself, so the caller still does not wait
+    void submit(const std::vector<IoRequest>& batch, Completion done) override {
+        completions.submit([this, batch, done] { done(run(batch)); });
+    }
+
+    const char* name() const override { return "sync"; }
+};
+
+// io_uring through the raw system calls, so there is no library to link.
+// Submitters share the submission queue under a mutex; one reaper thread
+// drains the completion queue. At most IO_RING_ENTRIES requests are in
+// flight, which the completion queue (twice that size) always has room for.
+// Should io_uring_enter ever fail, requests the kernel did not take are run
+// with preadv/pwritev instead, and so is everything after. A SYNC is an
+// fdatasync flagged IOSQE_IO_DRAIN, linking it behind every request queued
+// before it; a link chain proper would also run the writes ahead of it one
+// after another.
+class UringIO : public BlockIO {
+private:
+    struct Batch;
+
+    struct Slot {
+        Batch* batch;
+        const IoRequest* request;
+    };
+
+    struct Batch {
+        std::vector<IoRequest> parts;  // the requests, split to at most IOV_MAX iovecs each
+        std::vector<Slot> slots;
+        std::atomic<size_t> remaining;
+        std::atomic<bool> ok;
+        Completion done;          // submit(): the batch is freed once it runs
+        std::mutex mutex;         // run(): the waiting thread
+        std::condition_variable finished;
+        bool complete = false;
+    };
+
+    int fd;
+    RequestExecutor& completions;
+    int ringFd;
+    struct io_uring_params params;
+    void* sqRing;
+    void* cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    struct io_uring_sqe* sqes;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+
+    std::mutex submitMutex;
+    std::condition_variable space;
+    unsigned inFlight;
+    unsigned unsubmitted;
+    std::atomic<bool> broken;      // io_uring_enter failed; the ring takes no more work
+    std::atomic<bool> stopping;    // for a reaper that polls a broken ring
+    std::thread reaper;
+
+    static int enter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+
+    // Waits for a completion, for at most 100 ms where the kernel takes a
+    // timeout, so a reaper whose wakeup can no longer be submitted still
+    // sees the ring break or stop
+    int waitCompletion() {
+        if (!(params.features & IORING_FEAT_EXT_ARG)) return enter(ringFd, 0, 1, IORING_ENTER_GETEVENTS);
+        struct __kernel_timespec timeout = {0, 100 * 1000 * 1000};
+        struct io_uring_getevents_arg arg;
+        std::memset(&arg, 0, sizeof(arg));
+        arg.ts = reinterpret_cast<uint64_t>(&timeout);
+        int n = syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                        sizeof(arg));
+        if (n < 0 && errno == ETIME) errno = EINTR;
+        return n;
+    }
+
+    // Hands the queued entries to the kernel; caller holds submitMutex
+    void flushLocked() {
+        while (unsubmitted > 0) {
+            int n = enter(ringFd, unsubmitted, 0, 0);
+            if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (n <= 0) {
+                LOG_ERROR("BlockIO", "io_uring_enter failed, using preadv/pwritev", kv("errno", errno));
+                broken = true;
+                takeBackLocked();
+                return;
+            }
+            unsubmitted -= n;
+        }
+    }
+
+    // Takes the entries the kernel has not consumed off the queue and runs
+    // them here. Without SQPOLL the kernel only consumes them inside
+    // io_uring_enter, so under submitMutex they are still ours.
+    void takeBackLocked() {
+        unsigned tail = *sqTail;
+        unsigned first = tail - unsubmitted;
+        std::vector<Slot*> slots;
+        for (unsigned t = first; t != tail; t++) {
+            slots.push_back(reinterpret_cast<Slot*>(sqes[t & *sqMask].user_data));
+        }
+        __atomic_store_n(sqTail, first, __ATOMIC_RELEASE);
+        inFlight -= unsubmitted;
+        unsubmitted = 0;
+        space.notify_all();
+        for (Slot* slot : slots) {
+            if (slot) settle(slot, transferRest(fd, *slot->request, 0));
+            else stopping = true;
+        }
+    }
+
+    // Caller holds submitMutex, which it may give up while waiting for room
+    void queueLocked(std::unique_lock<std::mutex>& lock, Slot* slot) {
+        if (inFlight >= IO_RING_ENTRIES) {
+            flushLocked();
+            space.wait(lock, [this] { return inFlight < IO_RING_ENTRIES; });
+        }
+
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = fd;
+        sqe->user_data = reinterpret_cast<uint64_t>(slot);
+        if (!slot) {
+            sqe->opcode = IORING_OP_NOP;
+        } else if (slot->request->op == IoOp::SYNC) {
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            sqe->flags = IOSQE_IO_DRAIN;
+        } else {
+            const IoRequest& request = *slot->request;
+            sqe->opcode = request.op == IoOp::READ ? IORING_OP_READV : IORING_OP_WRITEV;
+            sqe->addr = reinterpret_cast<uint64_t>(request.iov);
+            sqe->len = request.iovCount;
+            sqe->off = request.offset;
+        }
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        inFlight++;
+        unsubmitted++;
+    }
+
+    // The kernel rejects a vectored request of more than IOV_MAX iovecs
+    static void split(const IoRequest& request, std::vector<IoRequest>& parts) {
+        if (request.op == IoOp::SYNC || request.iovCount <= IOV_MAX) {
+            parts.push_back(request);
+            return;
+        }
+        off_t offset = request.offset;
+        for (int first = 0; first < request.iovCount; first += IOV_MAX) {
+            IoRequest part{request.op, request.iov + first, std::min(IOV_MAX, request.iovCount - first), offset, 0};
+            for (int k = 0; k < part.iovCount; k++) part.length += part.iov[k].iov_len;
+            offset += part.length;
+            parts.push_back(part);
+        }
+    }
+
+    void start(Batch* batch, const std::vector<IoRequest>& requests) {
+        countBatch(requests);
+        for (const IoRequest& request : requests) split(request, batch->parts);
+        size_t count = batch->parts.size();
+        batch->slots.resize(count);
+        batch->remaining = count;
+        batch->ok = true;
+
+        // A submitted batch is gone once its last part settles
+        std::unique_lock<std::mutex> lock(submitMutex);
+        for (size_t i = 0; i < count; i++) {
+            batch->slots[i] = Slot{batch, &batch->parts[i]};
+            if (broken) settle(&batch->slots[i], transferRest(fd, batch->parts[i], 0));
+            else queueLocked(lock, &batch->slots[i]);
+        }
+        flushLocked();
+    }
+
+    void settle(Slot* slot, bool ok) {
+        Batch* batch = slot->batch;
+        if (!ok) batch->ok = false;
+        if (--batch->remaining > 0) return;
+        if (batch->done) {
+            Completion done = std::move(batch->done);
+            bool batchOk = batch->ok;
+            delete batch;
+            completions.submit([done, batchOk] { done(batchOk); });
+            return;
+        }
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        batch->complete = true;
+        batch->finished.notify_one();
+    }
+
+    void complete(Slot* slot, int result) {
+        const IoRequest& request = *slot->request;
+        bool ok;
+        if (result < 0) {
+            LOG_ERROR("BlockIO", "Request failed", kv("offset", (long)request.offset), kv("errno", -result));
+            ok = false;
+        } else if (request.op != IoOp::SYNC && (size_t)result < request.length) {
+            // Rare: a short transfer, finished here without the ring
+            ok = result > 0 && transferRest(fd, request, result);
+        } else {
+            ok = true;
+        }
+        settle(slot, ok);
+    }
+
+    void reap() {
+        std::vector<struct io_uring_cqe> reaped;
+        while (true) {
+            if (!broken && waitCompletion() < 0 && errno != EINTR) {
+                LOG_ERROR("BlockIO", "io_uring_enter failed while waiting, polling instead", kv("errno", errno));
+                broken = true;
+            }
+            if (broken) {
+                // The kernel still posts completions of what it took; they
+                // are picked up without waiting in io_uring_enter
+                {
+                    std::lock_guard<std::mutex> lock(submitMutex);
+                    if (stopping && inFlight == 0) return;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            reaped.clear();
+            while (head != tail) reaped.push_back(cqes[head++ & *cqMask]);
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            if (reaped.empty()) continue;
+            {
+                // Also orders everything the submitters wrote under the
+                // mutex before the completions are looked at
+                std::lock_guard<std::mutex> lock(submitMutex);
+                inFlight -= reaped.size();
+                space.notify_all();
+            }
+
+            bool stop = false;
+            for (const struct io_uring_cqe& cqe : reaped) {
+                if (cqe.user_data == 0) stop = true;
+                else complete(reinterpret_cast<Slot*>(cqe.user_data), cqe.res);
+            }
+            if (stop) return;
+        }
+    }
+
+public:
+    UringIO(int fd, RequestExecutor& completions)
+        : fd(fd), completions(completions), ringFd(-1), sqRing(MAP_FAILED), cqRing(MAP_FAILED),
+          sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)), inFlight(0), unsubmitted(0),
+          broken(false), stopping(false) {}
+
+    ~UringIO() override {
+        if (reaper.joinable()) {
+            std::unique_lock<std::mutex> lock(submitMutex);
+            // A NOP tells a waiting reaper to stop; a polling one sees the flag
+            if (broken) stopping = true;
+            else queueLocked(lock, nullptr);
+            flushLocked();
+            lock.unlock();
+            reaper.join();
+        }
+        if (sqes != MAP_FAILED) munmap(sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        if (ringFd != -1) close(ringFd);
+    }
+
+    bool setup() {
+        std::memset(&params, 0, sizeof(params));
+        ringFd = syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &params);
+        if (ringFd == -1) return false;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                      IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) return false;
+        cqRing = single ? sqRing
+                        : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                               IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) return false;
+        sqes = static_cast<struct io_uring_sqe*>(mmap(nullptr, params.sq_entries * sizeof(struct io_uring_sqe),
+                                                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                                      ringFd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) return false;
+
+        char* sq = static_cast<char*>(sqRing);
+        char* cq = static_cast<char*>(cqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        reaper = std::thread(&UringIO::reap, this);
+        return true;
+    }
+
+    bool run(const std::vector<IoRequest>& requests) override {
+        if (requests.empty()) return true;
+        if (broken) {
+            countBatch(requests);
+            return runHere(fd, requests);
+        }
+        Batch batch;
+        start(&batch, requests);
+        std::unique_lock<std::mutex> lock(batch.mutex);
+        batch.finished.wait(lock, [&] { return batch.complete; });
+        return batch.ok;
+    }
+
+    void submit(const std::vector<IoRequest>& requests, Completion done) override {
+        if (requests.empty() || broken) {
+            completions.submit([this, requests, done] { done(run(requests)); });
+            return;
+        }
+        Batch* batch = new Batch;
+        batch->done = std::move(done);
+        start(batch, requests);
+    }
+
+    const char* name() const override { return "io_uring"; }
+};
+
+BlockIO* BlockIO::create(int fd, IoBackend backend, RequestExecutor& completions) {
+    if (backend != IoBackend::SYNC) {
+        UringIO* uring = new UringIO(fd, completions);
+        if (uring->setup()) return uring;
+        LOG_WARN("BlockIO", "io_uring unavailable, using preadv/pwritev", kv("errno", errno));
+        delete uring;
+    }
+    return new SyncIO(fd, completions);
+}
+
+bool BlockIO::parseBackend(std::string_view name, IoBackend& backend) {
+    if (name == "auto") backend = IoBackend::AUTO;
+    else if (name == "uring") backend = IoBackend::URING;
+    else if (name == "sync") backend = IoBackend::SYNC;
+    else return false;
+    return true;
+}
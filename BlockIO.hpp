@@ -0,0 +1,60 @@
+#ifndef BLOCKIO_HPP
+#define BLOCKIO_HPP
+
+#include <cstddef>
+#include <functional>
+#include <string_view>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+#include "RequestExecutor.hpp"
+
+enum class IoBackend {
+    AUTO,    // io_uring when the kernel allows it, otherwise SYNC
+    URING,
+    SYNC     // preadv/pwritev on the calling thread
+};
+
+enum class IoOp {
+    READ,
+    WRITE,
+    SYNC     // fdatasync, started once every request before it in the batch is done
+};
+
+// One vectored transfer at offset, or a data sync. length is the sum of the
+// iov lengths; anything shorter counts as a failure.
+struct IoRequest {
+    IoOp op;
+    const struct iovec* iov;
+    int iovCount;
+    off_t offset;
+    size_t length;
+};
+
+const unsigned IO_RING_ENTRIES = 256;   // also the most requests in flight at once
+
+// Batched block I/O on one file descriptor. The io_uring backend hands a
+// whole batch to the kernel with one system call, so the device sees every
+// request of the batch at once instead of one at a time, and completions
+// are reaped on a thread of its own. Safe to call from any thread.
+class BlockIO {
+public:
+    typedef std::function<void(bool)> Completion;
+
+    virtual ~BlockIO() {}
+
+    // Runs the batch and waits for it; false if any request failed
+    virtual bool run(const std::vector<IoRequest>& batch) = 0;
+    // Starts the batch and returns. done(ok) runs on the completions
+    // executor once all of it has finished. The iovecs and their buffers
+    // must stay valid until then, and the BlockIO alive.
+    virtual void submit(const std::vector<IoRequest>& batch, Completion done) = 0;
+    virtual const char* name() const = 0;
+
+    // Falls back to SYNC, with a warning, if io_uring cannot be set up.
+    // Never returns nullptr. completions must outlive the BlockIO.
+    static BlockIO* create(int fd, IoBackend backend, RequestExecutor& completions);
+    static bool parseBackend(std::string_view name, IoBackend& backend);
+};
+
+#endif // BLOCKIO_HPP
@@ -0,0 +1,104 @@
+#include "Capture.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+const auto CAPTURE_FLUSH_INTERVAL = std::chrono::milliseconds(50);
+const size_t CAPTURE_FLUSH_SIZE = 4 * 1024 * 1024;   // wake the writer early past this
+
+static std::mutex captureMutex;
+static std::condition_variable captureWake;
+static std::string pending;
+static std::thread writer;
+static FILE* captureFile = nullptr;
+static bool stopping = false;
+static uint64_t startedAt = 0;
+static uint64_t recorded = 0;
+static uint64_t dropped = 0;
+
+std::atomic<bool>& Capture::running() {
+    static std::atomic<bool> flag{false};
+    return flag;
+}
+
+static void writerLoop() {
+    std::string batch;
+    std::unique_lock<std::mutex> lock(captureMutex);
+    while (true) {
+        captureWake.wait_for(lock, CAPTURE_FLUSH_INTERVAL,
+                             [] { return stopping || pending.size() >= CAPTURE_FLUSH_SIZE; });
+        batch.swap(pending);
+        bool done = stopping;
+        lock.unlock();
+
+        // Flushed every round: the server is usually stopped by a signal,
+        // and whatever is still in stdio's buffer then is lost
+        if (!batch.empty() && (fwrite(batch.data(), 1, batch.size(), captureFile) != batch.size() ||
+                               fflush(captureFile) != 0)) {
+            LOG_ERROR("Capture", "Write failed, capture is incomplete");
+        }
+        batch.clear();
+        if (done) break;
+        lock.lock();
+    }
+}
+
+bool Capture::start(const std::string& path) {
+    std::lock_guard<std::mutex> lock(captureMutex);
+    if (captureFile) return false;
+    captureFile = fopen(path.c_str(), "wb");
+    if (!captureFile) {
+        LOG_ERROR("Capture", "Cannot create capture file", kv("path", path));
+        return false;
+    }
+    fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_SIZE, captureFile);
+
+    startedAt = Metrics::now();
+    stopping = false;
+    writer = std::thread(writerLoop);
+    running().store(true, std::memory_order_relaxed);
+    LOG_INFO("Capture", "Recording requests", kv("path", path));
+    return true;
+}
+
+void Capture::stop() {
+    {
+        std::lock_guard<std::mutex> lock(captureMutex);
+        if (!captureFile) return;
+        running().store(false, std::memory_order_relaxed);
+        stopping = true;
+    }
+    captureWake.notify_all();
+    writer.join();
+
+    std::lock_guard<std::mutex> lock(captureMutex);
+    fclose(captureFile);
+    captureFile = nullptr;
+    LOG_INFO("Capture", "Capture closed", kv("records", (unsigned long)recorded), kv("dropped", (unsigned long)dropped));
+}
+
+void Capture::record(uint32_t connection, CaptureKind kind, uint64_t receivedAt, std::string_view data) {
+    char header[CAPTURE_RECORD_HEADER];
+    putU32(header + 8, connection);
+    header[12] = static_cast<char>(kind);
+    putU32(header + 13, data.size());
+
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(captureMutex);
+        if (!running().load(std::memory_order_relaxed)) return;
+        if (pending.size() + sizeof(header) + data.size() > CAPTURE_BUFFER_LIMIT) {
+            dropped++;
+            return;
+        }
+        putU64(header, receivedAt > startedAt ? receivedAt - startedAt : 0);
+        pending.append(header, sizeof(header));
+        pending.append(data.data(), data.size());
+        recorded++;
+        wake = pending.size() >= CAPTURE_FLUSH_SIZE;
+    }
+    if (wake) captureWake.notify_one();
+}
@@ -0,0 +1,100 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include "BinaryProtocol.hpp"
+
+// Records every request the server receives, exactly as it arrived, so a
+// real workload can be replayed later with bench/replay.cpp. Recording
+// appends to a shared buffer under a short lock; a background thread writes
+// the buffer out. If the disk cannot keep up, records are dropped and
+// counted rather than stalling requests.
+//
+// Captures contain request payloads verbatim, passwords included.
+//
+// File layout, integers little-endian:
+//   8 bytes magic "FMSCAP1\n"
+//   records: u64 nanoseconds since the capture started
+//            u32 connection id
+//            u8  kind (CaptureKind)
+//            u32 length, then length bytes
+// TEXT records hold one text message, BINARY records one frame without its
+// length prefix; CLOSE marks the client disconnecting.
+
+enum class CaptureKind : uint8_t {
+    TEXT = 1,
+    BINARY = 2,
+    CLOSE = 3
+};
+
+const char CAPTURE_MAGIC[] = "FMSCAP1\n";
+const size_t CAPTURE_MAGIC_SIZE = 8;
+const size_t CAPTURE_RECORD_HEADER = 17;
+const size_t CAPTURE_BUFFER_LIMIT = 64 * 1024 * 1024;   // unwritten bytes before records are dropped
+
+struct CaptureRecord {
+    uint64_t offsetNs;
+    uint32_t connection;
+    CaptureKind kind;
+    std::string data;
+};
+
+class Capture {
+public:
+    // Starts writing to path, replacing it. Returns false if it cannot be created.
+    static bool start(const std::string& path);
+    // Writes out what is buffered and closes the file
+    static void stop();
+
+    static bool active() { return running().load(std::memory_order_relaxed); }
+
+    // receivedAt is a Metrics::now() timestamp
+    static void record(uint32_t connection, CaptureKind kind, uint64_t receivedAt, std::string_view data);
+
+private:
+    static std::atomic<bool>& running();
+};
+
+// Reads captures back, one record at a time
+class CaptureReader {
+private:
+    FILE* file = nullptr;
+
+public:
+    ~CaptureReader() { close(); }
+
+    bool open(const std::string& path) {
+        file = fopen(path.c_str(), "rb");
+        char magic[CAPTURE_MAGIC_SIZE];
+        if (!file || fread(magic, 1, CAPTURE_MAGIC_SIZE, file) != CAPTURE_MAGIC_SIZE ||
+            std::string_view(magic, CAPTURE_MAGIC_SIZE) != std::string_view(CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (file) fclose(file);
+        file = nullptr;
+    }
+
+    // Returns false at the end of the file or on a truncated record
+    bool next(CaptureRecord& record) {
+        char header[CAPTURE_RECORD_HEADER];
+        if (!file || fread(header, 1, sizeof(header), file) != sizeof(header)) return false;
+        record.offsetNs = getU64(header);
+        record.connection = getU32(header + 8);
+        record.kind = static_cast<CaptureKind>(static_cast<uint8_t>(header[12]));
+        uint32_t length = getU32(header + 13);
+        if (length > MAX_FRAME_SIZE) return false;
+        record.data.resize(length);
+        return fread(&record.data[0], 1, length, file) == length;
+    }
+};
+
+#endif // CAPTURE_HPP
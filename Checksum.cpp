@@ -0,0 +1,173 @@
+#include "Checksum.hpp"
+#include <cstring>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+const uint32_t POLY = 0x82f63b78;   // the Castagnoli polynomial, bit-reflected
+const size_t LONG_STRIDE = 8192;    // bytes per stream when three run at once
+const size_t SHORT_STRIDE = 256;    // the same for what is left after that
+
+// Multiplies vector by the 32x32 bit matrix mat over GF(2)
+static uint32_t matrixTimes(const uint32_t* mat, uint32_t vector) {
+    uint32_t sum = 0;
+    for (; vector; vector >>= 1, mat++) {
+        if (vector & 1) sum ^= *mat;
+    }
+    return sum;
+}
+
+static void matrixSquare(uint32_t* square, const uint32_t* mat) {
+    for (int n = 0; n < 32; n++) square[n] = matrixTimes(mat, mat[n]);
+}
+
+// Tables that advance a CRC over length zero bytes one byte of it at a
+// time, which is how the interleaved streams are joined: the CRC of a
+// followed by b is that of a moved past len(b) zeros, xored with that of b
+static void zeroTables(uint32_t tables[4][256], size_t length) {
+    uint32_t even[32];
+    uint32_t odd[32];
+    // The operator for one zero bit, then squared to two and four
+    odd[0] = POLY;
+    for (int n = 1; n < 32; n++) odd[n] = 1u << (n - 1);
+    matrixSquare(even, odd);
+    matrixSquare(odd, even);
+    // Squared on to one zero byte, and onward to length zero bytes
+    uint32_t* op = odd;
+    do {
+        matrixSquare(even, odd);
+        op = even;
+        length >>= 1;
+        if (length == 0) break;
+        matrixSquare(odd, even);
+        op = odd;
+        length >>= 1;
+    } while (length);
+    for (uint32_t n = 0; n < 256; n++) {
+        tables[0][n] = matrixTimes(op, n);
+        tables[1][n] = matrixTimes(op, n << 8);
+        tables[2][n] = matrixTimes(op, n << 16);
+        tables[3][n] = matrixTimes(op, n << 24);
+    }
+}
+
+struct Tables {
+    uint32_t bytes[8][256];         // slicing-by-8
+    uint32_t longShift[4][256];
+    uint32_t shortShift[4][256];
+
+    Tables() {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t crc = n;
+            for (int k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+            bytes[0][n] = crc;
+        }
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t crc = bytes[0][n];
+            for (int k = 1; k < 8; k++) {
+                crc = bytes[0][crc & 0xff] ^ (crc >> 8);
+                bytes[k][n] = crc;
+            }
+        }
+        zeroTables(longShift, LONG_STRIDE);
+        zeroTables(shortShift, SHORT_STRIDE);
+    }
+};
+
+static const Tables tables;
+
+static uint32_t shift(const uint32_t table[4][256], uint32_t crc) {
+    return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^ table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+uint32_t Checksum::crc32cPortable(const void* data, size_t size, uint32_t crc) {
+    const unsigned char* next = static_cast<const unsigned char*>(data);
+    uint64_t state = ~crc;
+    while (size >= sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, next, sizeof(word));
+        word ^= state;
+        state = tables.bytes[7][word & 0xff] ^ tables.bytes[6][(word >> 8) & 0xff] ^
+                tables.bytes[5][(word >> 16) & 0xff] ^ tables.bytes[4][(word >> 24) & 0xff] ^
+                tables.bytes[3][(word >> 32) & 0xff] ^ tables.bytes[2][(word >> 40) & 0xff] ^
+                tables.bytes[1][(word >> 48) & 0xff] ^ tables.bytes[0][word >> 56];
+        next += sizeof(word);
+        size -= sizeof(word);
+    }
+    while (size--) state = tables.bytes[0][(state ^ *next++) & 0xff] ^ (state >> 8);
+    return ~(uint32_t)state;
+}
+
+#if defined(__x86_64__)
+
+// Three streams over consecutive strides, each its own dependency chain,
+// joined by shifting the earlier ones past the later ones
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(const void* data, size_t size, uint32_t crc) {
+    const unsigned char* next = static_cast<const unsigned char*>(data);
+    uint64_t crc0 = ~crc;
+    while (size && ((uintptr_t)next & 7)) {
+        crc0 = _mm_crc32_u8(crc0, *next++);
+        size--;
+    }
+
+    const size_t strides[] = {LONG_STRIDE, SHORT_STRIDE};
+    for (size_t stride : strides) {
+        const uint32_t (*table)[256] = stride == LONG_STRIDE ? tables.longShift : tables.shortShift;
+        while (size >= 3 * stride) {
+            uint64_t crc1 = 0;
+            uint64_t crc2 = 0;
+            const unsigned char* end = next + stride;
+            do {
+                uint64_t word0, word1, word2;
+                std::memcpy(&word0, next, sizeof(word0));
+                std::memcpy(&word1, next + stride, sizeof(word1));
+                std::memcpy(&word2, next + 2 * stride, sizeof(word2));
+                crc0 = _mm_crc32_u64(crc0, word0);
+                crc1 = _mm_crc32_u64(crc1, word1);
+                crc2 = _mm_crc32_u64(crc2, word2);
+                next += sizeof(uint64_t);
+            } while (next < end);
+            crc0 = shift(table, crc0) ^ crc1;
+            crc0 = shift(table, crc0) ^ crc2;
+            next += 2 * stride;
+            size -= 3 * stride;
+        }
+    }
+
+    while (size >= sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, next, sizeof(word));
+        crc0 = _mm_crc32_u64(crc0, word);
+        next += sizeof(word);
+        size -= sizeof(word);
+    }
+    while (size--) crc0 = _mm_crc32_u8(crc0, *next++);
+    return ~(uint32_t)crc0;
+}
+
+static bool detectHardware() {
+    // May run before the compiler's own CPU detection has
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+static const bool useHardware = detectHardware();
+
+#else
+
+static uint32_t crc32cHardware(const void* data, size_t size, uint32_t crc) {
+    return Checksum::crc32cPortable(data, size, crc);
+}
+
+static const bool useHardware = false;
+
+#endif
+
+uint32_t Checksum::crc32c(const void* data, size_t size, uint32_t crc) {
+    return useHardware ? crc32cHardware(data, size, crc) : crc32cPortable(data, size, crc);
+}
+
+bool Checksum::hardware() {
+    return useHardware;
+}
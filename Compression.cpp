@@ -0,0 +1,187 @@
+#include "Compression.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+const size_t MIN_MATCH = 4;
+const size_t LAST_LITERALS = 8;     // no match reaches into the last bytes
+const size_t MAX_OFFSET = 65535;
+const int HASH_BITS = 14;
+const int SKIP_SHIFT = 6;           // after 64 misses in a row, probe every other byte, and so on
+const size_t WILD_COPY = 16;
+
+static uint32_t read32(const char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hashOf(uint32_t value) {
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Bytes from a and b that agree, up to limit
+static size_t commonLength(const char* a, const char* b, size_t limit) {
+    size_t length = 0;
+    while (length + sizeof(uint64_t) <= limit) {
+        uint64_t x, y;
+        std::memcpy(&x, a + length, sizeof(x));
+        std::memcpy(&y, b + length, sizeof(y));
+        if (x != y) return length + (__builtin_ctzll(x ^ y) >> 3);
+        length += sizeof(uint64_t);
+    }
+    while (length < limit && a[length] == b[length]) length++;
+    return length;
+}
+
+// Appends a length continued in extension bytes
+static char* putLength(char* out, size_t length) {
+    while (length >= 255) {
+        *out++ = (char)255;
+        length -= 255;
+    }
+    *out++ = (char)length;
+    return out;
+}
+
+// Bytes a sequence takes in the output, at most
+static size_t sequenceBound(size_t literalCount, size_t matchLength) {
+    return 1 + literalCount + literalCount / 255 + 1 + 2 + matchLength / 255 + 1;
+}
+
+static char* putSequence(char* out, const char* literals, size_t literalCount, size_t offset, size_t matchLength) {
+    size_t extra = matchLength - MIN_MATCH;
+    *out++ = (char)((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(extra, 15));
+    if (literalCount >= 15) out = putLength(out, literalCount - 15);
+    std::memcpy(out, literals, literalCount);
+    out += literalCount;
+    *out++ = (char)(offset & 0xff);
+    *out++ = (char)(offset >> 8);
+    if (extra >= 15) out = putLength(out, extra - 15);
+    return out;
+}
+
+bool Compression::compress(const char* data, size_t size, std::string& out, size_t limit) {
+    if (size > UINT32_MAX) return false;
+    // Slots hold base + position. Those from earlier calls are below base and
+    // count as empty, so equal data always compresses to equal output.
+    static thread_local uint32_t table[1 << HASH_BITS];
+    static thread_local uint32_t base = 1;
+    if (size >= UINT32_MAX - base) {
+        std::memset(table, 0, sizeof(table));
+        base = 1;
+    }
+    uint32_t callBase = base;
+    base += size + 1;
+
+    uint32_t length = size;
+    out.resize(std::min(limit, sizeof(length) + sequenceBound(size, 0)));
+    char* output = &out[0];
+    char* outputEnd = output + out.size();
+    if (outputEnd - output < (long)sizeof(length)) return false;
+    std::memcpy(output, &length, sizeof(length));
+    output += sizeof(length);
+
+    size_t anchor = 0;
+    size_t pos = 0;
+    if (size > MIN_MATCH + LAST_LITERALS) {
+        size_t matchEnd = size - LAST_LITERALS;
+        size_t misses = 0;
+        while (pos + MIN_MATCH <= matchEnd) {
+            uint32_t value = read32(data + pos);
+            uint32_t& slot = table[hashOf(value)];
+            uint32_t previous = slot;
+            slot = callBase + pos;
+            size_t candidate = previous - callBase;
+            if (previous < callBase || pos - candidate > MAX_OFFSET || read32(data + candidate) != value) {
+                pos += 1 + (misses++ >> SKIP_SHIFT);
+                continue;
+            }
+
+            size_t matchLength = MIN_MATCH + commonLength(data + candidate + MIN_MATCH, data + pos + MIN_MATCH,
+                                                          matchEnd - pos - MIN_MATCH);
+            if ((size_t)(outputEnd - output) < sequenceBound(pos - anchor, matchLength)) return false;
+            output = putSequence(output, data + anchor, pos - anchor, pos - candidate, matchLength);
+            pos += matchLength;
+            anchor = pos;
+            misses = 0;
+        }
+    }
+
+    size_t literalCount = size - anchor;
+    if ((size_t)(outputEnd - output) < sequenceBound(literalCount, 0)) return false;
+    *output++ = (char)(std::min<size_t>(literalCount, 15) << 4);
+    if (literalCount >= 15) output = putLength(output, literalCount - 15);
+    std::memcpy(output, data + anchor, literalCount);
+    output += literalCount;
+    out.resize(output - out.data());
+    return true;
+}
+
+// Reads a length continued in extension bytes; false if data runs out
+static bool getLength(const unsigned char*& in, const unsigned char* end, size_t& length) {
+    if (length < 15) return true;
+    while (true) {
+        if (in == end) return false;
+        unsigned char byte = *in++;
+        length += byte;
+        if (byte != 255) return true;
+    }
+}
+
+bool Compression::decompress(const char* data, size_t size, std::string& out) {
+    uint32_t length;
+    if (size < sizeof(length)) return false;
+    std::memcpy(&length, data, sizeof(length));
+    // No stream expands by more than 255 times
+    if (length / 255 > size) return false;
+
+    // Copies run up to WILD_COPY bytes past their end, into the slack
+    out.resize(length + WILD_COPY);
+    char* output = &out[0];
+    size_t written = 0;
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data) + sizeof(length);
+    const unsigned char* end = reinterpret_cast<const unsigned char*>(data) + size;
+    while (in < end) {
+        unsigned char token = *in++;
+        size_t literalCount = token >> 4;
+        if (!getLength(in, end, literalCount)) return false;
+        if (literalCount > (size_t)(end - in) || literalCount > length - written) return false;
+        if (literalCount <= WILD_COPY && end - in >= (long)WILD_COPY) {
+            std::memcpy(output + written, in, WILD_COPY);
+        } else {
+            std::memcpy(output + written, in, literalCount);
+        }
+        in += literalCount;
+        written += literalCount;
+        if (in == end) break;
+
+        if (end - in < 2) return false;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        size_t matchLength = token & 15;
+        if (!getLength(in, end, matchLength)) return false;
+        matchLength += MIN_MATCH;
+        if (offset == 0 || offset > written || matchLength > length - written) return false;
+
+        char* to = output + written;
+        const char* from = to - offset;
+        if (offset >= sizeof(uint64_t)) {
+            // Words never overlap at this distance, so copying them in order
+            // repeats the bytes the match is itself producing
+            for (size_t i = 0; i < matchLength; i += sizeof(uint64_t)) std::memcpy(to + i, from + i, sizeof(uint64_t));
+        } else {
+            for (size_t i = 0; i < matchLength; i++) to[i] = from[i];
+        }
+        written += matchLength;
+    }
+    out.resize(length);
+    return written == length;
+}
+
+bool Compression::worthCompressing(const char* data, size_t size) {
+    if (size < COMPRESS_MIN_SIZE) return false;
+    if (size <= COMPRESS_PROBE_SIZE) return true;
+    std::string probe;
+    return compress(data, COMPRESS_PROBE_SIZE, probe, COMPRESS_PROBE_SIZE / 8 * 7);
+}
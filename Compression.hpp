@@ -0,0 +1,38 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <cstddef>
+#include <string>
+
+// How a file's content is stored in its blocks
+enum class Codec : int {
+    NONE = 0,
+    LZ = 1
+};
+
+const size_t COMPRESS_MIN_SIZE = 512;            // smaller content is stored as is
+const size_t COMPRESS_PROBE_SIZE = 64 * 1024;    // tried first, to skip incompressible content cheaply
+
+// A byte-oriented LZ77 codec in the style of LZ4: sequences of literals
+// followed by a match of at least 4 bytes within the last 64 KiB, found
+// through a single hash probe, with no entropy coding. Fast enough to run
+// on every save; text typically shrinks to a third or half.
+//
+// Format: the content length as a 4-byte integer, then sequences. Each
+// sequence is a token (literal count in the high nibble, match length - 4
+// in the low one; 15 means more length bytes follow, each adding up to 255),
+// the literals, a 2-byte offset back into the output, and the match length
+// bytes. The last sequence is literals only.
+class Compression {
+public:
+    // Replaces out with the compressed form of data. Gives up, returning
+    // false, as soon as that would be longer than limit.
+    static bool compress(const char* data, size_t size, std::string& out, size_t limit);
+    // Replaces out with the content; false if data is not a valid stream
+    static bool decompress(const char* data, size_t size, std::string& out);
+    // Whether compressing data is worth it: long enough, and its first
+    // COMPRESS_PROBE_SIZE bytes shrink to no more than 7/8
+    static bool worthCompressing(const char* data, size_t size);
+};
+
+#endif // COMPRESSION_HPP
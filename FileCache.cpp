@@ -0,0 +1,83 @@
+#include "FileCache.hpp"
+#include "Metrics.hpp"
+
+static size_t costOf(const FileEntry& f) {
+    return f.content.size() + f.name.size() + FILE_CACHE_ENTRY_OVERHEAD;
+}
+
+FileCache::FileCache(size_t capacityBytes) : capacity(capacityBytes), used(0) {}
+
+bool FileCache::get(int fileId, FileEntry& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(fileId);
+    if (it == index.end()) {
+        Metrics::add(Counter::CACHE_MISSES);
+        return false;
+    }
+    order.splice(order.begin(), order, it->second);
+    out = it->second->entry;
+    Metrics::add(Counter::CACHE_HITS);
+    return true;
+}
+
+bool FileCache::contains(int fileId) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return index.count(fileId) != 0;
+}
+
+void FileCache::put(const FileEntry& f) {
+    size_t cost = costOf(f);
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = index.find(f.fileId);
+    if (it != index.end()) eraseLocked(it);
+    // One large file would push out many small ones
+    if (cost > capacity / FILE_CACHE_MAX_SHARE) return;
+
+    order.push_front(Node{f, cost});
+    index[f.fileId] = order.begin();
+    used += cost;
+    evictLocked();
+}
+
+void FileCache::invalidate(int fileId) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(fileId);
+    if (it == index.end()) return;
+    eraseLocked(it);
+    Metrics::add(Counter::CACHE_INVALIDATIONS);
+}
+
+void FileCache::setCapacity(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity = bytes;
+    evictLocked();
+}
+
+size_t FileCache::getCapacity() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return capacity;
+}
+
+size_t FileCache::getUsedBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+}
+
+size_t FileCache::getCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return index.size();
+}
+
+void FileCache::eraseLocked(std::unordered_map<int, std::list<Node>::iterator>::iterator it) {
+    used -= it->second->cost;
+    order.erase(it->second);
+    index.erase(it);
+}
+
+void FileCache::evictLocked() {
+    while (used > capacity && !order.empty()) {
+        eraseLocked(index.find(order.back().entry.fileId));
+        Metrics::add(Counter::CACHE_EVICTIONS);
+    }
+}
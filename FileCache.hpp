@@ -0,0 +1,52 @@
+#ifndef FILECACHE_HPP
+#define FILECACHE_HPP
+
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "FileEntry.hpp"
+
+const size_t FILE_CACHE_DEFAULT_BYTES = 128 * 1024 * 1024;
+const size_t FILE_CACHE_ENTRY_OVERHEAD = 128;   // list node, index slot and strings, roughly
+const size_t FILE_CACHE_MAX_SHARE = 8;          // files above capacity / this are not cached
+
+// Least-recently-used cache of files as they are stored on disk, metadata and
+// content, keyed by fileId. It lives in FileManagerDisk, so it outlasts the
+// sessions that filled it: a user who logs out and back in is served from
+// memory. The disk layer keeps it exact, refreshing an entry on every full
+// save and dropping it on range writes and deletes. Safe to call from any thread.
+class FileCache {
+private:
+    struct Node {
+        FileEntry entry;
+        size_t cost;
+    };
+
+    mutable std::mutex mutex;
+    std::list<Node> order;    // most recently used first
+    std::unordered_map<int, std::list<Node>::iterator> index;
+    size_t capacity;
+    size_t used;
+
+    void eraseLocked(std::unordered_map<int, std::list<Node>::iterator>::iterator it);
+    void evictLocked();
+
+public:
+    explicit FileCache(size_t capacityBytes = FILE_CACHE_DEFAULT_BYTES);
+
+    // Copies the cached file into out; false on a miss
+    bool get(int fileId, FileEntry& out);
+    // Neither counts as a hit or miss nor refreshes the entry
+    bool contains(int fileId) const;
+    void put(const FileEntry& f);
+    void invalidate(int fileId);
+
+    // 0 disables the cache and empties it
+    void setCapacity(size_t bytes);
+    size_t getCapacity() const;
+    size_t getUsedBytes() const;
+    size_t getCount() const;
+};
+
+#endif // FILECACHE_HPP
@@ -1,5 +1,8 @@
 
 #include "FileManager.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
 #include <algorithm>
 #include <iostream>
 #include <ctime>
@@ -17,68 +20,74 @@ void FileManager::setDiskManager(FileManagerDisk* dm) {
 
 bool FileManager::loadUserFiles(int userId) {
     if (!diskManager) {
-        std::cerr << "[FileManager] No disk manager set!\n";
+        LOG_ERROR("FileManager", "No disk manager set");
         return false;
     }
     
-    std::cout << "[FileManager] Loading files for user " << userId << "...\n";
-    std::vector<int> allFileIds = diskManager->getAllFileIds();
-    
+    LOG_INFO("FileManager", "Loading files", kv("user", userId));
+    std::vector<FileEntry> files = diskManager->loadFilesOwnedBy(userId);
+    addUserFiles(userId, files);
+    return true;
+}
+
+void FileManager::addUserFiles(int userId, std::vector<FileEntry>& files) {
     time_t now = std::time(nullptr);
     int loadedCount = 0;
     int activeCount = 0;
     int binCount = 0;
     
-    for (int fileId : allFileIds) {
- 
-        FileEntry* diskFile = diskManager->loadFile(fileId);
-        if (!diskFile) continue;
-        if (diskFile->userId != userId) {
-            delete diskFile;
-            continue;
-        }
-        if (fileMap.search(fileId) != nullptr) {
-            std::cout << "[FileManager] File " << fileId << " already in memory, skipping\n";
-            delete diskFile;
+    for (FileEntry& diskFile : files) {
+        if (fileMap.search(diskFile.fileId) != nullptr) {
+            LOG_DEBUG("FileManager", "File already in memory, skipping", kv("file", diskFile.fileId));
             continue;
         }
-        if (diskFile->expireTime < now) {
-            diskFile->inBin = true;
-            diskFile->inUse = true;
-            diskManager->updateFile(*diskFile);
+        if (diskFile.expireTime < now) {
+            diskFile.inBin = true;
+            diskFile.inUse = true;
+            if (diskManager) diskManager->updateFile(diskFile);
             binCount++;
-            std::cout << "[FileManager] File '" << diskFile->name << "' expired, loaded to BIN\n";
+            LOG_DEBUG("FileManager", "File expired, loaded to bin", kv("name", diskFile.name));
         } else {
           
-            diskFile->inBin = false;
-            diskFile->inUse = true;
+            diskFile.inBin = false;
+            diskFile.inUse = true;
             activeCount++;
-            std::cout << "[FileManager] File '" << diskFile->name << "' loaded as ACTIVE\n";
+            LOG_DEBUG("FileManager", "File loaded as active", kv("name", diskFile.name));
         }
         
      
-        if (fileMap.insert(*diskFile)) {
-  
-            if (!diskFile->inBin) {
-                FileEntry* filePtr = fileMap.search(fileId);
-                if (filePtr) {
-                    expiryHeap.push(filePtr);
-                }
-            }
-        }
-        
-        delete diskFile;
+        insertEntry(diskFile);
         loadedCount++;
     }
     
-    std::cout << "[FileManager] Loaded " << loadedCount << " files for user " << userId 
-              << " (" << activeCount << " active, " << binCount << " in bin)\n";
-    
+    LOG_INFO("FileManager", "Loaded files", kv("user", userId), kv("count", loadedCount),
+             kv("active", activeCount), kv("bin", binCount));
+}
+
+// Adds f to fileMap and, unless it is in the bin, to the expiry heap. The
+// heap points into fileMap's table, so a rehash means rebuilding it.
+bool FileManager::insertEntry(const FileEntry& f) {
+    int capacityBefore = fileMap.getCapacity();
+    if (!fileMap.insert(f)) return false;
+
+    if (fileMap.getCapacity() != capacityBefore) {
+        rebuildExpiryHeap();
+    } else if (!f.inBin) {
+        FileEntry* filePtr = fileMap.search(f.fileId);
+        if (filePtr) expiryHeap.push(filePtr);
+    }
     return true;
 }
 
+void FileManager::rebuildExpiryHeap() {
+    expiryHeap.clear();
+    fileMap.forEach([this](FileEntry& f) {
+        if (!f.inBin) expiryHeap.push(&f);
+    });
+}
+
 void FileManager::unloadUserFiles(int userId) {
-    std::cout << "[FileManager] Unloading files for user " << userId << "...\n";
+    LOG_DEBUG("FileManager", "Unloading files", kv("user", userId));
     
     std::vector<FileEntry> allFiles = fileMap.getAll();
     int removedCount = 0;
@@ -97,41 +106,43 @@ void FileManager::unloadUserFiles(int userId) {
             fileMap.remove(file.fileId);
             removedCount++;
             
-            std::cout << "[FileManager] Removed file '" << file.name << "' from memory\n";
+            LOG_DEBUG("FileManager", "Removed file from memory", kv("name", file.name));
         }
     }
     
-    std::cout << "[FileManager] Unloaded " << removedCount << " files for user " << userId << "\n";
+    LOG_INFO("FileManager", "Unloaded files", kv("user", userId), kv("count", removedCount));
 }
 
 bool FileManager::createFile(const std::string& name, const std::string& content, long expireSeconds) {
+    TRACE_SPAN("FileManager::createFile");
     if (name.empty()) {
-        std::cerr << "[FileManager] Cannot create file with empty name.\n";
+        LOG_WARN("FileManager", "Cannot create file with empty name");
         return false;
     }
 
-    std::vector<FileEntry> allFiles = fileMap.getAll();
-    for (auto& f : allFiles) {
-        if (f.userId == currentUserId && f.name == name && !f.inBin) {
-            std::cerr << "[FileManager] File with name '" << name << "' already exists.\n";
-            return false;
-        }
+    FileEntry* existing = fileMap.findIf([&](const FileEntry& f) {
+        return f.userId == currentUserId && f.name == name && !f.inBin;
+    });
+    if (existing) {
+        LOG_WARN("FileManager", "File already exists", kv("name", name));
+        return false;
     }
 
-    int maxId = 0;
+    int fileId = 1;
     if (diskManager) {
-        std::vector<int> allFileIds = diskManager->getAllFileIds();
-        for (int id : allFileIds) {
-            if (id > maxId) maxId = id;
+        fileId = diskManager->allocateFileId();
+        if (fileId == -1) {
+            LOG_ERROR("FileManager", "Could not allocate a file ID");
+            return false;
         }
-    }
-    
-    for (auto& existing : allFiles) {
-        if (existing.fileId > maxId) maxId = existing.fileId;
+    } else {
+        fileMap.forEach([&](const FileEntry& f) {
+            if (f.fileId >= fileId) fileId = f.fileId + 1;
+        });
     }
 
     FileEntry f;
-    f.fileId = maxId + 1;
+    f.fileId = fileId;
     f.userId = currentUserId;
     f.ownerId = currentUserId;
     f.name = name;
@@ -144,21 +155,17 @@ bool FileManager::createFile(const std::string& name, const std::string& content
 
     if (diskManager) {
         if (!diskManager->saveFile(f)) {
-            std::cerr << "[FileManager] CRITICAL: Failed to save file to disk!\n";
+            LOG_ERROR("FileManager", "Failed to save file to disk", kv("name", name));
             return false;
         }
-        std::cout << "[FileManager] File '" << name << "' saved to disk (ID: " << f.fileId << ")\n";
+        LOG_DEBUG("FileManager", "File saved to disk", kv("name", name), kv("file", f.fileId));
     }
-    if (!fileMap.insert(f)) {
-        std::cerr << "[FileManager] Failed to insert file into HashMap.\n";
+    if (!insertEntry(f)) {
+        LOG_ERROR("FileManager", "Failed to insert file into HashMap", kv("name", name));
         return false;
     }
-    FileEntry* filePtr = fileMap.search(f.fileId);
-    if (filePtr) {
-        expiryHeap.push(filePtr);
-    }
 
-    std::cout << "[FileManager] File '" << name << "' created in memory (ID: " << f.fileId << ")\n";
+    LOG_DEBUG("FileManager", "File created", kv("name", name), kv("file", f.fileId), payload("content", content));
 
     return true;
 }
@@ -166,12 +173,12 @@ bool FileManager::createFile(const std::string& name, const std::string& content
 bool FileManager::writeFile(const std::string& name, const std::string& content) {
     FileEntry* f = searchFile(name);
     if (!f) {
-        std::cerr << "[FileManager] File '" << name << "' not found.\n";
+        LOG_WARN("FileManager", "File not found", kv("name", name));
         return false;
     }
     
     if (f->inBin) {
-        std::cerr << "[FileManager] Cannot write to file in bin.\n";
+        LOG_WARN("FileManager", "Cannot write to file in bin", kv("name", name));
         return false;
     }
 
@@ -179,10 +186,73 @@ bool FileManager::writeFile(const std::string& name, const std::string& content)
     
     if (diskManager) {
         if (!diskManager->saveFile(*f)) {
-            std::cerr << "[FileManager] CRITICAL: Failed to update file on disk!\n";
+            LOG_ERROR("FileManager", "Failed to update file on disk", kv("name", name));
             return false;
         }
-        std::cout << "[FileManager] File '" << name << "' updated on disk.\n";
+        LOG_DEBUG("FileManager", "File updated on disk", kv("name", name), payload("content", content));
+    }
+    
+    return true;
+}
+
+bool FileManager::appendFile(const std::string& name, const std::string& data) {
+    FileEntry* f = searchFile(name);
+    if (!f) {
+        LOG_WARN("FileManager", "File not found", kv("name", name));
+        return false;
+    }
+    
+    if (f->inBin) {
+        LOG_WARN("FileManager", "Cannot append to file in bin", kv("name", name));
+        return false;
+    }
+
+    size_t oldSize = f->content.size();
+    f->content += data;
+    
+    if (diskManager) {
+        if (!diskManager->writeFileRange(*f, oldSize, data.size())) {
+            // Back to what the disk holds
+            f->content.resize(oldSize);
+            LOG_ERROR("FileManager", "Failed to append to file on disk", kv("name", name));
+            return false;
+        }
+        LOG_DEBUG("FileManager", "Appended on disk", kv("name", name), payload("data", data));
+    }
+    
+    return true;
+}
+
+bool FileManager::writeFileAt(const std::string& name, size_t offset, const std::string& data) {
+    FileEntry* f = searchFile(name);
+    if (!f) {
+        LOG_WARN("FileManager", "File not found", kv("name", name));
+        return false;
+    }
+    
+    if (f->inBin) {
+        LOG_WARN("FileManager", "Cannot write to file in bin", kv("name", name));
+        return false;
+    }
+    
+    if (offset > f->content.size()) {
+        LOG_WARN("FileManager", "Offset is past the end of file", kv("name", name), kv("offset", offset));
+        return false;
+    }
+
+    // Only the bytes the write covers are kept, to put back if the disk refuses it
+    size_t oldSize = f->content.size();
+    std::string overwritten = f->content.substr(offset, data.size());
+    f->content.replace(offset, data.size(), data);
+    
+    if (diskManager) {
+        if (!diskManager->writeFileRange(*f, offset, data.size())) {
+            f->content.resize(oldSize);
+            f->content.replace(offset, overwritten.size(), overwritten);
+            LOG_ERROR("FileManager", "Failed to update file range on disk", kv("name", name));
+            return false;
+        }
+        LOG_DEBUG("FileManager", "Wrote range on disk", kv("name", name), kv("offset", offset), payload("data", data));
     }
     
     return true;
@@ -197,6 +267,24 @@ bool FileManager::readFile(const std::string& name, std::string& content) {
     return true;
 }
 
+bool FileManager::readFileRange(const FileEntry& f, size_t offset, size_t length, std::string& content) {
+    if (f.inBin) return false;
+    if (offset > f.content.size()) return false;
+
+    length = std::min(length, f.content.size() - offset);
+    if (!diskManager || length == 0) {
+        content.assign(f.content, offset, length);
+        return true;
+    }
+    // Only the blocks holding the range are read
+    content.clear();
+    content.reserve(length);
+    return diskManager->readFileRange(f.fileId, offset, length, [&](const char* data, size_t size) {
+        content.append(data, size);
+        return true;
+    });
+}
+
 bool FileManager::truncateFile(const std::string& name) {
     FileEntry* f = searchFile(name);
     if (!f) return false;
@@ -206,10 +294,10 @@ bool FileManager::truncateFile(const std::string& name) {
     
     if (diskManager) {
         if (!diskManager->saveFile(*f)) {
-            std::cerr << "[FileManager] CRITICAL: Failed to truncate file on disk!\n";
+            LOG_ERROR("FileManager", "Failed to truncate file on disk", kv("name", name));
             return false;
         }
-        std::cout << "[FileManager] File '" << name << "' truncated on disk.\n";
+        LOG_DEBUG("FileManager", "File truncated on disk", kv("name", name));
     }
     
     return true;
@@ -227,24 +315,24 @@ bool FileManager::moveToBin(const std::string& name) {
 
     if (diskManager) {
         if (!diskManager->updateFile(*f)) {
-            std::cerr << "[FileManager] CRITICAL: Failed to update file status on disk!\n";
+            LOG_ERROR("FileManager", "Failed to update file status on disk", kv("name", name));
             return false;
         }
     }
     
-    std::cout << "[FileManager] File '" << name << "' moved to bin.\n";
+    LOG_DEBUG("FileManager", "File moved to bin", kv("name", name));
     return true;
 }
 
 bool FileManager::retrieveFromBin(const std::string& name) {
     FileEntry* f = searchFile(name);
     if (!f) {
-        std::cerr << "[FileManager] File '" << name << "' not found.\n";
+        LOG_WARN("FileManager", "File not found", kv("name", name));
         return false;
     }
     
     if (!f->inBin) {
-        std::cerr << "[FileManager] File '" << name << "' is not in bin.\n";
+        LOG_WARN("FileManager", "File is not in bin", kv("name", name));
         return false;
     }
 
@@ -254,19 +342,19 @@ bool FileManager::retrieveFromBin(const std::string& name) {
     long remainingTime = f->expireTime - std::time(nullptr);
     if (remainingTime <= 0) {
         f->expireTime = std::time(nullptr) + 3600; 
-        std::cout << "[FileManager] File was expired. Expiry reset to 1 hour from now.\n";
+        LOG_DEBUG("FileManager", "File was expired, expiry reset to 1 hour from now", kv("name", name));
     }
 
     expiryHeap.push(f);
 
     if (diskManager) {
         if (!diskManager->updateFile(*f)) {
-            std::cerr << "[FileManager] CRITICAL: Failed to update file status on disk!\n";
+            LOG_ERROR("FileManager", "Failed to update file status on disk", kv("name", name));
             return false;
         }
     }
     
-    std::cout << "[FileManager] File '" << name << "' retrieved from bin.\n";
+    LOG_DEBUG("FileManager", "File retrieved from bin", kv("name", name));
     return true;
 }
 
@@ -288,19 +376,17 @@ void FileManager::updateExpiryStatus() {
             diskManager->updateFile(*f);
         }
         
-        std::cout << "[AUTO-EXPIRY] File '" << f->name << "' (ID: " << f->fileId << ") expired and moved to bin.\n";
+        Metrics::add(Counter::FILES_EXPIRED);
+        LOG_INFO("AUTO-EXPIRY", "File expired and moved to bin", kv("name", f->name), kv("file", f->fileId));
     }
 }
 
 FileEntry* FileManager::searchFile(const std::string& name) {
-   
-    std::vector<FileEntry> allFiles = fileMap.getAll();
-    for (auto& f : allFiles) {
-        if (f.userId == currentUserId && f.name == name) {
-            return fileMap.search(f.fileId);
-        }
-    }
-    return nullptr;
+    TRACE_SPAN("FileManager::searchFile");
+    // Scanned in place; nothing is copied
+    return fileMap.findIf([&](const FileEntry& f) {
+        return f.userId == currentUserId && f.name == name;
+    });
 }
 
 FileEntry* FileManager::searchFileById(int fileId) {
@@ -315,7 +401,7 @@ FileEntry* FileManager::searchFileById(int fileId) {
 bool FileManager::restoreFile(int fileId, const std::string& name, const std::string& content, 
                               long expireSeconds, int ownerId, bool wasInBin, 
                               time_t originalCreateTime, time_t originalExpireTime) {
-    std::cerr << "[FileManager] restoreFile() is deprecated. Use loadUserFiles() instead.\n";
+    LOG_WARN("FileManager", "restoreFile() is deprecated, use loadUserFiles() instead");
     return false;
 }
 
@@ -397,7 +483,7 @@ bool FileManager::removeFileCompletely(const std::string& name) {
 
     if (diskManager) {
         if (!diskManager->deleteFile(fileId)) {
-            std::cerr << "[FileManager] Failed to delete file from disk!\n";
+            LOG_ERROR("FileManager", "Failed to delete file from disk", kv("name", name));
             return false;
         }
     }
@@ -405,10 +491,10 @@ bool FileManager::removeFileCompletely(const std::string& name) {
         expiryHeap.remove(f);
     }
     if (!fileMap.remove(fileId)) {
-        std::cerr << "[FileManager] Failed to remove file from HashMap!\n";
+        LOG_ERROR("FileManager", "Failed to remove file from HashMap", kv("name", name));
         return false;
     }
 
-    std::cout << "[FileManager] File '" << name << "' permanently deleted.\n";
+    LOG_DEBUG("FileManager", "File permanently deleted", kv("name", name));
     return true;
 }
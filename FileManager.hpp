@@ -20,6 +20,9 @@ private:
     FileManagerDisk* diskManager;
     FileEntryHeap expiryHeap;        
 
+    bool insertEntry(const FileEntry& f);
+    void rebuildExpiryHeap();
+
 public:
     FileManager(int userId = -1);
     ~FileManager() = default;
@@ -28,11 +31,17 @@ public:
     void setDiskManager(FileManagerDisk* dm);
 
     bool loadUserFiles(int userId);   
+    // Takes files already read with FileManagerDisk::loadFilesOwnedBy(userId)
+    void addUserFiles(int userId, std::vector<FileEntry>& files);
     void unloadUserFiles(int userId);  
 
     bool createFile(const std::string& name, const std::string& content, long expireSeconds);
     bool writeFile(const std::string& name, const std::string& content);
+    bool appendFile(const std::string& name, const std::string& data);
+    bool writeFileAt(const std::string& name, size_t offset, const std::string& data);
     bool readFile(const std::string& name, std::string& content);
+    // f is an entry searchFile() returned
+    bool readFileRange(const FileEntry& f, size_t offset, size_t length, std::string& content);
     bool truncateFile(const std::string& name);
     bool moveToBin(const std::string& name);
     bool retrieveFromBin(const std::string& name);
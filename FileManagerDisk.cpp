@@ -1,26 +1,147 @@
 
 #include "FileManagerDisk.hpp"
 #include "FileManager.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "WriteBackBuffer.hpp"
+#include "AlignedBuffer.hpp"
+#include "Checksum.hpp"
 #include <iostream>
 #include <fstream>
 #include <cstring>
 #include <algorithm>
 #include <ctime>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-FileManagerDisk::FileManagerDisk(const std::string& diskPath)
-    : diskFilePath(diskPath), blockBitmap(TOTAL_BLOCKS, false), totalBlocks(TOTAL_BLOCKS), usedBlocks(0)
+// Whole-buffer pread/pwrite; false on an error or a short transfer
+static bool readAt(int fd, char* data, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t n = pread(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool writeAt(int fd, const char* data, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static off_t blockOffset(int blockNum) {
+    return (off_t)blockNum * BLOCK_SIZE;
+}
+
+static size_t roundUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Smallest offset and length alignment O_DIRECT accepts on fd, or 0 if
+// none of those that divide BLOCK_SIZE works
+static size_t probeDirectAlignment(int fd) {
+    AlignedBuffer buffer(BLOCK_SIZE);
+    for (size_t alignment = 512; BLOCK_SIZE % alignment == 0; alignment *= 2) {
+        if (pread(fd, buffer.get(), alignment, alignment) == (ssize_t)alignment) return alignment;
+    }
+    return 0;
+}
+
+// Every block of a chain but the last is full, so block i continues the
+// run of its predecessor on disk when it directly follows it
+static bool continuesRun(const std::vector<int>& blocks, const std::vector<BlockMetadata>& metas, size_t i) {
+    return i > 0 && blocks[i] == blocks[i - 1] + 1 &&
+           metas[i - 1].size() == (int)(BLOCK_SIZE - sizeof(BlockMetadata));
+}
+
+// Points each request at its share of iov, once iov has stopped growing
+static void attachIov(std::vector<IoRequest>& batch, const std::vector<size_t>& firstIov,
+                      std::vector<struct iovec>& iov) {
+    for (size_t r = 0; r < batch.size(); r++) {
+        size_t end = r + 1 < batch.size() ? firstIov[r + 1] : iov.size();
+        batch[r].iov = &iov[firstIov[r]];
+        batch[r].iovCount = end - firstIov[r];
+    }
+}
+
+static std::atomic<uint64_t> nextInstance{1};
+
+// Checksum of a block as stored: its metadata, then its data
+static uint32_t blockChecksum(const BlockMetadata& meta, const char* data) {
+    return Checksum::crc32c(data, meta.size(), Checksum::crc32c(&meta, sizeof(meta)));
+}
+
+// Hash of a block's content, a word at a time. It only nominates a shared
+// block: the bytes are compared before a file takes a reference to it.
+static uint64_t fingerprint(const char* data, size_t size) {
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ size;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; i++) hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+// The list a deduplicated chain holds after its header: a count, that many
+// shared blocks, then the rest of the content. Sets tail to where that starts.
+static bool parseSharedList(const char* data, size_t size, std::vector<int>& shared, size_t& tail) {
+    int count;
+    if (size < sizeof(count)) return false;
+    std::memcpy(&count, data, sizeof(count));
+    if (count < 0 || (size - sizeof(count)) / sizeof(int) < (size_t)count) return false;
+    shared.resize(count);
+    std::memcpy(shared.data(), data + sizeof(count), count * sizeof(int));
+    for (int block : shared) {
+        if (block < 0 || block >= TOTAL_BLOCKS) return false;
+    }
+    tail = sizeof(count) + count * sizeof(int);
+    return true;
+}
+
+FileManagerDisk::FileManagerDisk(const std::string& diskPath, IoBackend ioBackend, bool directIo)
+    : diskFilePath(diskPath), diskFd(-1), direct(false), directAlignment(1), io(nullptr), blockBitmap(TOTAL_BLOCKS, false), totalBlocks(TOTAL_BLOCKS), usedBlocks(0),
+      batchDepth(0), bitmapDirty(false), nextLeaseId(1), instance(nextInstance++), writeBack(nullptr), compression(false), dedup(false), generation(0),
+      ioPool(IO_POOL_THREADS), ownersReady(false), reclaimStopping(false), punchSupported(true),
+      sharedReferences(0), dedupDirty(false), checksumFd(-1), blockChecksums(TOTAL_BLOCKS, 0)
 {
-    std::cout << "\n[FileManagerDisk] Initializing disk subsystem...\n";
+    LOG_INFO("FileManagerDisk", "Initializing disk subsystem", kv("path", diskFilePath));
     
     if (!initializeDisk()) {
-        std::cerr << "[ERROR] Disk initialization failed.\n";
+        LOG_ERROR("FileManagerDisk", "Disk initialization failed");
+        Logger::shutdown();
         exit(1);
     }
+    if (directIo) openDirect();
+    io = BlockIO::create(diskFd, ioBackend, ioPool);
+    LOG_INFO("FileManagerDisk", "Block I/O ready", kv("backend", io->name()));
 
     btree = new BTree(3, "btree.dat");
-    std::cout << "[FileManagerDisk] B-Tree index loaded from disk.\n";
+    LOG_INFO("FileManagerDisk", "B-Tree index loaded from disk");
 
     loadBitmap();
+    loadDedupIndex();
+    loadChecksums();
+    loadIdCounter();
+    ownerIndexer = std::thread(&FileManagerDisk::buildOwnerIndex, this);
+    reclaimer = std::thread(&FileManagerDisk::reclaimBlocks, this);
 
     usedBlocks = 0;
     for (bool b : blockBitmap) {
@@ -30,28 +151,37 @@ FileManagerDisk::FileManagerDisk(const std::string& diskPath)
     float usedMB = (usedBlocks * BLOCK_SIZE) / (1024.0 * 1024.0);
     float totalMB = (totalBlocks * BLOCK_SIZE) / (1024.0 * 1024.0);
     
-    std::cout << "[FileManagerDisk] Disk initialized successfully.\n";
-    std::cout << "[FileManagerDisk] Used blocks: " << usedBlocks << "/" << totalBlocks 
-              << " (" << usedMB << " MB / " << totalMB << " MB)\n";
+    LOG_INFO("FileManagerDisk", "Disk initialized", kv("usedBlocks", usedBlocks), kv("totalBlocks", totalBlocks),
+             kv("usedMB", usedMB), kv("totalMB", totalMB));
 }
 
 FileManagerDisk::~FileManagerDisk() {
-    std::cout << "[FileManagerDisk] Shutting down disk subsystem...\n";
+    LOG_INFO("FileManagerDisk", "Shutting down disk subsystem");
+    if (ownerIndexer.joinable()) ownerIndexer.join();
+    {
+        std::lock_guard<std::mutex> lock(reclaimMutex);
+        reclaimStopping = true;
+    }
+    reclaimWake.notify_one();
+    if (reclaimer.joinable()) reclaimer.join();
     saveBitmap();
-    if (diskFile.is_open()) diskFile.close();
+    saveChecksums();
+    if (checksumFd != -1) close(checksumFd);
+    delete io;
+    if (diskFd != -1) close(diskFd);
     if (btree) delete btree;
-    std::cout << "[FileManagerDisk] Disk subsystem closed.\n";
+    LOG_INFO("FileManagerDisk", "Disk subsystem closed");
 }
 
 bool FileManagerDisk::initializeDisk() {
-    diskFile.open(diskFilePath, std::ios::in | std::ios::out | std::ios::binary);
+    diskFd = open(diskFilePath.c_str(), O_RDWR);
     
-    if (!diskFile.is_open()) {
-        std::cout << "[FileManagerDisk] No existing disk found. Creating new disk file...\n";
+    if (diskFd == -1) {
+        LOG_INFO("FileManagerDisk", "No existing disk found, creating new disk file");
         
         std::ofstream creator(diskFilePath, std::ios::binary);
         if (!creator.is_open()) {
-            std::cerr << "[ERROR] Cannot create disk file at: " << diskFilePath << "\n";
+            LOG_ERROR("FileManagerDisk", "Cannot create disk file", kv("path", diskFilePath));
             return false;
         }
 
@@ -64,24 +194,188 @@ bool FileManagerDisk::initializeDisk() {
             }
         }
         creator.close();
-        std::cout << "[FileManagerDisk] Disk formatting complete.          \n";
+        std::cout << "\n";
+        LOG_INFO("FileManagerDisk", "Disk formatting complete");
 
-        diskFile.open(diskFilePath, std::ios::in | std::ios::out | std::ios::binary);
-        if (!diskFile.is_open()) {
-            std::cerr << "[ERROR] Cannot open newly created disk file.\n";
+        diskFd = open(diskFilePath.c_str(), O_RDWR);
+        if (diskFd == -1) {
+            LOG_ERROR("FileManagerDisk", "Cannot open newly created disk file");
             return false;
         }
     } else {
-        std::cout << "[FileManagerDisk] Existing disk file found and opened.\n";
+        LOG_INFO("FileManagerDisk", "Existing disk file opened");
     }
     
     return true;
 }
 
+// Switches block I/O to an O_DIRECT descriptor in place of the buffered one
+void FileManagerDisk::openDirect() {
+    int fd = open(diskFilePath.c_str(), O_RDWR | O_DIRECT);
+    size_t alignment = fd == -1 ? 0 : probeDirectAlignment(fd);
+    if (alignment == 0) {
+        LOG_WARN("FileManagerDisk", "O_DIRECT unavailable for disk.bin, staying buffered", kv("errno", errno));
+        if (fd != -1) close(fd);
+        return;
+    }
+    
+    // Pages cached before the switch would only go stale
+    fdatasync(diskFd);
+    posix_fadvise(diskFd, 0, 0, POSIX_FADV_DONTNEED);
+    close(diskFd);
+    diskFd = fd;
+    direct = true;
+    directAlignment = alignment;
+    LOG_INFO("FileManagerDisk", "Direct I/O enabled", kv("alignment", (unsigned long)alignment));
+}
+
+// pread in buffered mode. In direct mode the aligned span around the range
+// is read into a pooled buffer and the range copied out.
+bool FileManagerDisk::readBytes(char* data, size_t size, off_t offset) {
+    if (!direct) return readAt(diskFd, data, size, offset);
+    
+    off_t start = offset / directAlignment * directAlignment;
+    size_t span = roundUp(offset - start + size, directAlignment);
+    AlignedBuffer buffer(span);
+    if (!readAt(diskFd, buffer.get(), span, start)) return false;
+    std::memcpy(data, buffer.get() + (offset - start), size);
+    return true;
+}
+
+// pwrite in buffered mode. In direct mode a range that does not cover its
+// aligned span is patched into the span read back first. Spans never cross
+// a block, and writers hold the store exclusively, so that cannot race.
+bool FileManagerDisk::writeBytes(const char* data, size_t size, off_t offset) {
+    if (!direct) return writeAt(diskFd, data, size, offset);
+    
+    off_t start = offset / directAlignment * directAlignment;
+    size_t span = roundUp(offset - start + size, directAlignment);
+    AlignedBuffer buffer(span);
+    if ((size_t)(offset - start) != 0 || span != size) {
+        if (!readAt(diskFd, buffer.get(), span, start)) return false;
+    }
+    std::memcpy(buffer.get() + (offset - start), data, size);
+    return writeAt(diskFd, buffer.get(), span, start);
+}
+
+// io->run() in buffered mode. In direct mode every request goes through a
+// pooled aligned buffer, its length rounded up: writes are copied in first
+// and padded with zeros, reads copied out after. Requests must start on an
+// aligned offset, and a write's padding must land on space the caller owns;
+// the chain writers start at a block and end inside their last block.
+bool FileManagerDisk::runBatch(const std::vector<IoRequest>& batch) {
+    if (!direct) return io->run(batch);
+    
+    std::vector<AlignedBuffer> buffers;
+    std::vector<struct iovec> iov(batch.size());
+    std::vector<IoRequest> bounced(batch);
+    buffers.reserve(batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+        const IoRequest& request = batch[i];
+        if (request.op == IoOp::SYNC) {
+            buffers.emplace_back(0);
+            continue;
+        }
+        if (request.offset % directAlignment != 0) {
+            LOG_ERROR("Disk", "Unaligned direct request", kv("offset", (long)request.offset));
+            return false;
+        }
+        
+        size_t span = roundUp(request.length, directAlignment);
+        buffers.emplace_back(span);
+        char* data = buffers.back().get();
+        if (request.op == IoOp::WRITE) {
+            for (int k = 0; k < request.iovCount; k++) {
+                std::memcpy(data, request.iov[k].iov_base, request.iov[k].iov_len);
+                data += request.iov[k].iov_len;
+            }
+            std::memset(data, 0, span - request.length);
+        }
+        iov[i] = {buffers.back().get(), span};
+        bounced[i].iov = &iov[i];
+        bounced[i].iovCount = 1;
+        bounced[i].length = span;
+    }
+    
+    if (!io->run(bounced)) return false;
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (batch[i].op != IoOp::READ) continue;
+        const char* data = buffers[i].get();
+        for (int k = 0; k < batch[i].iovCount; k++) {
+            std::memcpy(batch[i].iov[k].iov_base, data, batch[i].iov[k].iov_len);
+            data += batch[i].iov[k].iov_len;
+        }
+    }
+    return true;
+}
+
+void FileManagerDisk::loadIdCounter() {
+    std::ifstream counter("fileid.dat", std::ios::binary);
+    if (counter.is_open() && counter.read(reinterpret_cast<char*>(&nextLeaseId), sizeof(int))) {
+        LOG_INFO("FileId", "Counter loaded", kv("next", nextLeaseId));
+        return;
+    }
+    
+    // First start on this disk: continue after the highest indexed ID
+    int maxId = 0;
+    for (int id : btree->getAllFileIds()) {
+        if (id > maxId) maxId = id;
+    }
+    nextLeaseId = maxId + 1;
+    saveIdCounter();
+    LOG_INFO("FileId", "Counter initialized from index", kv("next", nextLeaseId));
+}
+
+// Written to a temporary file and renamed, so a crash leaves either the old
+// or the new value
+bool FileManagerDisk::saveIdCounter() {
+    std::ofstream counter("fileid.dat.tmp", std::ios::binary | std::ios::trunc);
+    if (!counter.is_open()) {
+        LOG_ERROR("FileId", "Failed to save file ID counter");
+        return false;
+    }
+    counter.write(reinterpret_cast<const char*>(&nextLeaseId), sizeof(int));
+    counter.close();
+    if (!counter || std::rename("fileid.dat.tmp", "fileid.dat") != 0) {
+        LOG_ERROR("FileId", "Failed to save file ID counter");
+        return false;
+    }
+    return true;
+}
+
+int FileManagerDisk::allocateFileId() {
+    struct Lease {
+        uint64_t owner = 0;
+        int next = 0;
+        int end = 0;
+    };
+    static thread_local Lease lease;
+    
+    if (lease.owner != instance || lease.next >= lease.end) {
+        std::lock_guard<std::mutex> lock(idMutex);
+        int start = nextLeaseId;
+        nextLeaseId += FILE_ID_LEASE;
+        if (!saveIdCounter()) {
+            nextLeaseId = start;
+            return -1;
+        }
+        lease.owner = instance;
+        lease.next = start;
+        lease.end = start + FILE_ID_LEASE;
+    }
+    return lease.next++;
+}
+
 void FileManagerDisk::saveBitmap() {
+    TRACE_SPAN("FileManagerDisk::saveBitmap");
+    if (batchDepth > 0) {
+        bitmapDirty = true;
+        return;
+    }
+    
     std::ofstream bmp("bitmap.dat", std::ios::binary);
     if (!bmp.is_open()) {
-        std::cerr << "[ERROR] Failed to save bitmap!\n";
+        LOG_ERROR("Bitmap", "Failed to save bitmap");
         return;
     }
     
@@ -94,13 +388,200 @@ void FileManagerDisk::saveBitmap() {
     }
     bmp.close();
     
-    std::cout << "[Bitmap] Saved to disk. Used blocks: " << usedBlocks << "/" << totalBlocks << "\n";
+    LOG_DEBUG("Bitmap", "Saved to disk", kv("used", usedBlocks), kv("total", totalBlocks));
+}
+
+bool FileManagerDisk::ownsBatch() const {
+    return batchOwner.load(std::memory_order_relaxed) == std::this_thread::get_id();
+}
+
+FileManagerDisk::ReadScope::ReadScope(FileManagerDisk& disk) {
+    if (!disk.ownsBatch()) lock = std::shared_lock<std::shared_mutex>(disk.storeMutex);
+}
+
+void FileManagerDisk::beginBatch() {
+    if (ownsBatch()) {
+        batchDepth++;
+        return;
+    }
+    storeMutex.lock();
+    batchOwner.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    batchDepth = 1;
+    btree->beginBatch();
+}
+
+void FileManagerDisk::commitBatch() {
+    if (!ownsBatch() || --batchDepth > 0) return;
+    
+    btree->commitBatch();
+    if (bitmapDirty) {
+        bitmapDirty = false;
+        saveBitmap();
+    }
+    if (dedupDirty) {
+        dedupDirty = false;
+        saveDedupIndex();
+    }
+    saveChecksums();
+    batchOwner.store(std::thread::id(), std::memory_order_relaxed);
+    storeMutex.unlock();
+}
+
+// Runs task(0) .. task(count - 1) on the I/O pool and waits for all of them
+void FileManagerDisk::runParallel(size_t count, const std::function<void(size_t)>& task) {
+    std::mutex doneMutex;
+    std::condition_variable done;
+    size_t left = count;
+    for (size_t i = 0; i < count; i++) {
+        ioPool.submit([&, i] {
+            task(i);
+            std::lock_guard<std::mutex> lock(doneMutex);
+            left--;
+            done.notify_one();
+        });
+    }
+    std::unique_lock<std::mutex> lock(doneMutex);
+    done.wait(lock, [&] { return left == 0; });
+}
+
+// Reads the user of every indexed file from the header in its first block.
+// The reads go in block order, split over the I/O pool.
+void FileManagerDisk::buildOwnerIndex() {
+    TRACE_SPAN("FileManagerDisk::buildOwnerIndex");
+    uint64_t start = Metrics::now();
+    std::vector<FileIndexEntry> entries;
+    {
+        ReadScope store(*this);
+        std::lock_guard<std::mutex> lock(indexMutex);
+        entries = btree->getAllEntries();
+    }
+    std::sort(entries.begin(), entries.end(), [](const FileIndexEntry& a, const FileIndexEntry& b) {
+        return a.firstBlock < b.firstBlock;
+    });
+    
+    // The store is held one chunk at a time, so saves and deletes get in
+    // between chunks instead of waiting for the whole scan. A file they
+    // changed since the copy above is theirs to index, with setOwner or
+    // clearOwner, so the chunk skips any whose first block moved.
+    const size_t prefix = sizeof(BlockMetadata) + 2 * sizeof(int);   // fileId, then userId
+    size_t indexed = 0;
+    for (size_t chunk = 0; chunk < entries.size(); chunk += OWNER_INDEX_CHUNK) {
+        size_t count = std::min(OWNER_INDEX_CHUNK, entries.size() - chunk);
+        std::vector<int> users(count, -1);
+        ReadScope store(*this);
+        size_t slices = std::min<size_t>(IO_POOL_THREADS, count);
+        runParallel(slices, [&](size_t slice) {
+            size_t first = chunk + count * slice / slices;
+            size_t last = chunk + count * (slice + 1) / slices;
+            std::vector<char> buffers((last - first) * prefix, 0);
+            std::vector<struct iovec> iov;
+            std::vector<IoRequest> batch;
+            iov.reserve(last - first);
+            for (size_t i = first; i < last; i++) {
+                int blockNum = entries[i].firstBlock;
+                int current;
+                if (blockNum < 0 || blockNum >= TOTAL_BLOCKS ||
+                    !findFirstBlock(entries[i].fileId, current) || current != blockNum) continue;
+                iov.push_back({&buffers[(i - first) * prefix], prefix});
+                batch.push_back(IoRequest{IoOp::READ, &iov.back(), 1, blockOffset(blockNum), prefix});
+            }
+            // A read that failed, or was skipped, leaves zeros, which the check below rejects
+            runBatch(batch);
+            
+            for (size_t i = first; i < last; i++) {
+                const char* buffer = &buffers[(i - first) * prefix];
+                BlockMetadata meta;
+                std::memcpy(&meta, buffer, sizeof(meta));
+                if (meta.fileId != entries[i].fileId || meta.blockNumber != 0 ||
+                    meta.size() < (int)(2 * sizeof(int))) continue;
+                std::memcpy(&users[i - chunk], buffer + sizeof(meta) + sizeof(int), sizeof(int));
+            }
+        });
+        
+        // Merged before the store is let go, so a delete that follows finds it
+        std::lock_guard<std::mutex> lock(ownerMutex);
+        for (size_t i = 0; i < count; i++) {
+            if (users[i] == -1) continue;
+            // A save staged while this ran is newer than what is on disk
+            int fileId = entries[chunk + i].fileId;
+            if (ownerOf.emplace(fileId, users[i]).second) filesOf[users[i]].insert(fileId);
+            indexed++;
+        }
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(ownerMutex);
+        ownersReady = true;
+    }
+    ownersBuilt.notify_all();
+    
+    LOG_INFO("FileManagerDisk", "Owner index built", kv("files", (unsigned long)indexed),
+             kv("skipped", (unsigned long)(entries.size() - indexed)), kv("ms", (Metrics::now() - start) / 1e6));
+}
+
+void FileManagerDisk::setOwner(int fileId, int userId) {
+    std::lock_guard<std::mutex> lock(ownerMutex);
+    auto it = ownerOf.find(fileId);
+    if (it != ownerOf.end()) {
+        if (it->second == userId) return;
+        auto files = filesOf.find(it->second);
+        files->second.erase(fileId);
+        if (files->second.empty()) filesOf.erase(files);
+        it->second = userId;
+    } else {
+        ownerOf.emplace(fileId, userId);
+    }
+    filesOf[userId].insert(fileId);
+}
+
+void FileManagerDisk::clearOwner(int fileId) {
+    std::lock_guard<std::mutex> lock(ownerMutex);
+    auto it = ownerOf.find(fileId);
+    if (it == ownerOf.end()) return;
+    auto files = filesOf.find(it->second);
+    files->second.erase(fileId);
+    if (files->second.empty()) filesOf.erase(files);
+    ownerOf.erase(it);
+}
+
+// Starts the kernel reading the first block of every file not in memory,
+// so the loads that follow find it in the page cache. readFile advises the
+// rest of a chain once it knows it.
+void FileManagerDisk::prefetchFiles(const std::vector<int>& fileIds) {
+    std::vector<int> blocks;
+    {
+        ReadScope store(*this);
+        for (int fileId : fileIds) {
+            int firstBlock;
+            if (!cache.contains(fileId) && findFirstBlock(fileId, firstBlock)) blocks.push_back(firstBlock);
+        }
+    }
+    adviseBlocks(std::move(blocks));
+}
+
+// One POSIX_FADV_WILLNEED per run of adjacent blocks
+void FileManagerDisk::adviseBlocks(std::vector<int> blocks) {
+    // Direct reads bypass the page cache, so there is nothing to warm
+    if (direct) return;
+    std::sort(blocks.begin(), blocks.end());
+    size_t i = 0;
+    while (i < blocks.size()) {
+        size_t run = 1;
+        while (i + run < blocks.size() && blocks[i + run] == blocks[i] + (int)run) run++;
+        posix_fadvise(diskFd, blockOffset(blocks[i]), (off_t)run * BLOCK_SIZE, POSIX_FADV_WILLNEED);
+        i += run;
+    }
+    Metrics::add(Counter::BLOCKS_PREFETCHED, blocks.size());
+}
+
+uint64_t FileManagerDisk::getGeneration() const {
+    return generation.load(std::memory_order_acquire);
 }
 
 void FileManagerDisk::loadBitmap() {
     std::ifstream bmp("bitmap.dat", std::ios::binary);
     if (!bmp.is_open()) {
-        std::cout << "[Bitmap] No existing bitmap found. Starting with clean disk.\n";
+        LOG_INFO("Bitmap", "No existing bitmap found, starting with clean disk");
         return;
     }
     
@@ -117,335 +598,1181 @@ void FileManagerDisk::loadBitmap() {
     bmp.close();
     
     if (header != loadedBlocks) {
-        std::cerr << "[WARNING] Bitmap header mismatch! Header: " << header 
-                  << ", Actual: " << loadedBlocks << "\n";
+        LOG_WARN("Bitmap", "Header mismatch", kv("header", header), kv("actual", loadedBlocks));
+    }
+    
+    LOG_INFO("Bitmap", "Loaded from disk", kv("used", loadedBlocks));
+}
+
+// Entries whose block is not in use, left by a crash between a bitmap
+// save and a dedup.dat save, are dropped
+void FileManagerDisk::loadDedupIndex() {
+    std::ifstream index("dedup.dat", std::ios::binary);
+    if (!index.is_open()) return;
+    
+    int count = 0;
+    index.read(reinterpret_cast<char*>(&count), sizeof(int));
+    int dropped = 0;
+    for (int i = 0; i < count; i++) {
+        int block;
+        SharedBlock shared;
+        if (!index.read(reinterpret_cast<char*>(&block), sizeof(int)) ||
+            !index.read(reinterpret_cast<char*>(&shared.references), sizeof(int)) ||
+            !index.read(reinterpret_cast<char*>(&shared.fingerprint), sizeof(uint64_t))) break;
+        if (block < 0 || block >= TOTAL_BLOCKS || !blockBitmap[block] || shared.references <= 0) {
+            dropped++;
+            continue;
+        }
+        sharedBlocks[block] = shared;
+        fingerprints.emplace(shared.fingerprint, block);
+        sharedReferences += shared.references;
+    }
+    
+    if ((int)sharedBlocks.size() + dropped != count) {
+        LOG_WARN("Dedup", "Index truncated", kv("header", count), kv("read", (int)sharedBlocks.size() + dropped));
+    }
+    if (dropped > 0) LOG_WARN("Dedup", "Dropped entries for free blocks", kv("dropped", dropped));
+    LOG_INFO("Dedup", "Index loaded", kv("blocks", sharedBlocks.size()), kv("references", sharedReferences));
+}
+
+// Written to a temporary file and renamed, like the ID counter
+void FileManagerDisk::saveDedupIndex() {
+    if (batchDepth > 0) {
+        dedupDirty = true;
+        return;
     }
     
-    std::cout << "[Bitmap] Loaded from disk. " << loadedBlocks << " blocks marked as used.\n";
+    std::ofstream index("dedup.dat.tmp", std::ios::binary | std::ios::trunc);
+    if (!index.is_open()) {
+        LOG_ERROR("Dedup", "Failed to save index");
+        return;
+    }
+    int count = sharedBlocks.size();
+    index.write(reinterpret_cast<const char*>(&count), sizeof(int));
+    for (const auto& entry : sharedBlocks) {
+        index.write(reinterpret_cast<const char*>(&entry.first), sizeof(int));
+        index.write(reinterpret_cast<const char*>(&entry.second.references), sizeof(int));
+        index.write(reinterpret_cast<const char*>(&entry.second.fingerprint), sizeof(uint64_t));
+    }
+    index.close();
+    if (!index || std::rename("dedup.dat.tmp", "dedup.dat") != 0) {
+        LOG_ERROR("Dedup", "Failed to save index");
+        return;
+    }
+    LOG_DEBUG("Dedup", "Saved index", kv("blocks", count), kv("references", sharedReferences));
 }
 
-int FileManagerDisk::allocateBlock() {
+void FileManagerDisk::loadChecksums() {
+    checksumFd = open("checksums.dat", O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (checksumFd == -1 || fstat(checksumFd, &st) != 0) {
+        LOG_ERROR("Checksum", "Failed to open checksums.dat, blocks will not be verified");
+        if (checksumFd != -1) close(checksumFd);
+        checksumFd = -1;
+        return;
+    }
+    
+    size_t bytes = blockChecksums.size() * sizeof(uint32_t);
+    size_t stored = std::min<size_t>(st.st_size, bytes) / sizeof(uint32_t) * sizeof(uint32_t);
+    if (stored > 0 && !readAt(checksumFd, reinterpret_cast<char*>(blockChecksums.data()), stored, 0)) {
+        LOG_ERROR("Checksum", "Failed to read checksums.dat, blocks will not be verified");
+        std::fill(blockChecksums.begin(), blockChecksums.end(), 0);
+    }
+    if ((size_t)st.st_size < bytes && ftruncate(checksumFd, bytes) != 0) {
+        LOG_WARN("Checksum", "Failed to extend checksums.dat", kv("errno", errno));
+    }
+    
+    // A free block's entry is stale, say from a bitmap.dat that was reset
+    int known = 0;
+    int missing = 0;
     for (int i = 0; i < TOTAL_BLOCKS; i++) {
+        if (!blockBitmap[i]) setChecksum(i, 0);
+        else if (blockChecksums[i] != 0) known++;
+        else missing++;
+    }
+    if (missing > 0) {
+        // A disk from before checksums: its blocks gain one when rewritten
+        LOG_INFO("Checksum", "Some blocks have no checksum yet", kv("blocks", missing));
+    }
+    LOG_INFO("Checksum", "Checksums loaded", kv("checksummed", known),
+             kv("implementation", Checksum::hardware() ? "sse4.2" : "portable"));
+}
+
+// Writes the entries changed since the last save, one write per run of
+// adjacent ones
+bool FileManagerDisk::saveChecksums() {
+    if (checksumsChanged.empty() || checksumFd == -1) {
+        checksumsChanged.clear();
+        return true;
+    }
+    std::sort(checksumsChanged.begin(), checksumsChanged.end());
+    checksumsChanged.erase(std::unique(checksumsChanged.begin(), checksumsChanged.end()), checksumsChanged.end());
+    
+    bool saved = true;
+    size_t i = 0;
+    while (i < checksumsChanged.size()) {
+        size_t run = 1;
+        while (i + run < checksumsChanged.size() && checksumsChanged[i + run] == checksumsChanged[i] + (int)run) run++;
+        int first = checksumsChanged[i];
+        if (!writeAt(checksumFd, reinterpret_cast<const char*>(&blockChecksums[first]), run * sizeof(uint32_t),
+                     (off_t)first * sizeof(uint32_t))) {
+            LOG_ERROR("Checksum", "Failed to save checksums", kv("block", first), kv("blocks", run));
+            saved = false;
+        }
+        i += run;
+    }
+    LOG_DEBUG("Checksum", "Saved checksums", kv("blocks", checksumsChanged.size()));
+    checksumsChanged.clear();
+    return saved;
+}
+
+// Drops the checksums of blocks about to be rewritten from checksums.dat
+// before their data changes. One that crashes mid-batch is left with no
+// checksum, unverified, rather than failing against the old one until it is
+// rewritten; its new checksum is saved when the batch commits.
+bool FileManagerDisk::clearChecksums(const std::vector<int>& blocks) {
+    for (int block : blocks) setChecksum(block, 0);
+    if (saveChecksums()) return true;
+    LOG_ERROR("Checksum", "Cannot clear checksums, not writing blocks", kv("blocks", blocks.size()));
+    return false;
+}
+
+// Caller holds the store exclusively
+void FileManagerDisk::setChecksum(int blockNum, uint32_t checksum) {
+    if (blockChecksums[blockNum] == checksum) return;
+    blockChecksums[blockNum] = checksum;
+    checksumsChanged.push_back(blockNum);
+}
+
+// Whether a block read as meta and data matches its checksum. A block with
+// none, or whose checksum happens to be 0, passes.
+bool FileManagerDisk::verifyBlock(int blockNum, const BlockMetadata& meta, const char* data) {
+    uint32_t expected = blockChecksums[blockNum];
+    if (expected == 0) return true;
+    if (meta.dataSize >= 0 && meta.size() <= BLOCK_SIZE - (int)sizeof(BlockMetadata) &&
+        blockChecksum(meta, data) == expected) {
+        Metrics::add(Counter::BLOCKS_VERIFIED);
+        return true;
+    }
+    Metrics::add(Counter::CHECKSUM_FAILURES);
+    LOG_ERROR("Checksum", "Block does not match its checksum", kv("block", blockNum), kv("file", meta.fileId));
+    return false;
+}
+
+// Recomputes the checksum of a block changed in place, from the disk;
+// caller holds the store exclusively
+bool FileManagerDisk::refreshChecksum(int blockNum) {
+    BlockMetadata meta;
+    AlignedBuffer data(BLOCK_SIZE);
+    if (!readBlockMeta(blockNum, meta) || meta.dataSize < 0 ||
+        meta.size() > BLOCK_SIZE - (int)sizeof(BlockMetadata) ||
+        !readBlockData(blockNum, 0, data.get(), meta.size())) {
+        setChecksum(blockNum, 0);
+        return false;
+    }
+    setChecksum(blockNum, blockChecksum(meta, data.get()));
+    return true;
+}
+
+// First free block at or after hint, wrapping around, so a chain allocated
+// with hint = previous block + 1 stays contiguous where the disk allows
+int FileManagerDisk::allocateBlock(int hint) {
+    if (hint < 0 || hint >= TOTAL_BLOCKS) hint = 0;
+    for (int n = 0; n < TOTAL_BLOCKS; n++) {
+        int i = (hint + n) % TOTAL_BLOCKS;
         if (!blockBitmap[i]) {
             blockBitmap[i] = true;
             usedBlocks++;
-            std::cout << "[Disk] Allocated block #" << i << " (used: " << usedBlocks << ")\n";
+            // Taken back before its hole was punched; the reclaimer cannot be
+            // punching now, as it holds the store shared and we exclusively
+            std::lock_guard<std::mutex> lock(reclaimMutex);
+            pendingReclaim.erase(i);
+            Metrics::add(Counter::BLOCKS_ALLOCATED);
+            LOG_DEBUG("Disk", "Allocated block", kv("block", i), kv("used", usedBlocks));
             return i;
         }
     }
     
-    std::cerr << "[ERROR] DISK FULL! No free blocks available. Used: " << usedBlocks << "/" << totalBlocks << "\n";
+    LOG_ERROR("Disk", "Disk full, no free blocks available", kv("used", usedBlocks), kv("total", totalBlocks));
     return -1;
 }
 
 void FileManagerDisk::freeBlock(int blockNum) {
     if (blockNum < 0 || blockNum >= TOTAL_BLOCKS) {
-        std::cerr << "[ERROR] Invalid block number: " << blockNum << "\n";
+        LOG_ERROR("Disk", "Invalid block number", kv("block", blockNum));
         return;
     }
     
     if (!blockBitmap[blockNum]) {
-        std::cerr << "[WARNING] Attempting to free already free block #" << blockNum << "\n";
+        LOG_WARN("Disk", "Attempting to free already free block", kv("block", blockNum));
         return;
     }
     
     blockBitmap[blockNum] = false;
     usedBlocks--;
+    setChecksum(blockNum, 0);
+    {
+        std::lock_guard<std::mutex> lock(reclaimMutex);
+        pendingReclaim.insert(blockNum);
+    }
+    reclaimWake.notify_one();
+    Metrics::add(Counter::BLOCKS_FREED);
     
-    char zero[BLOCK_SIZE] = {0};
-    diskFile.seekp(blockNum * BLOCK_SIZE, std::ios::beg);
-    diskFile.write(zero, BLOCK_SIZE);
-    diskFile.flush();
+    LOG_DEBUG("Disk", "Freed block", kv("block", blockNum), kv("used", usedBlocks));
+}
+
+// Background thread: punches a hole over every freed block, one fallocate
+// per run of adjacent blocks. It takes the blocks while holding the store
+// shared, so none of them can be allocated again until their holes are
+// punched; a block allocated before that is dropped from the set instead.
+void FileManagerDisk::reclaimBlocks() {
+    std::unique_lock<std::mutex> lock(reclaimMutex);
+    while (true) {
+        reclaimWake.wait(lock, [this] { return reclaimStopping || !pendingReclaim.empty(); });
+        if (pendingReclaim.empty()) return;
+        lock.unlock();
+        
+        {
+            // Waits out the batch that freed them
+            std::shared_lock<std::shared_mutex> store(storeMutex);
+            std::set<int> blocks;
+            {
+                std::lock_guard<std::mutex> taken(reclaimMutex);
+                blocks.swap(pendingReclaim);
+            }
+            punchRuns(blocks);
+        }
+        lock.lock();
+    }
+}
+
+void FileManagerDisk::punchRuns(const std::set<int>& blocks) {
+    TRACE_SPAN("FileManagerDisk::punchRuns");
+    if (!punchSupported) return;
+    
+    size_t runs = 0;
+    for (auto it = blocks.begin(); it != blocks.end();) {
+        int first = *it;
+        int count = 0;
+        while (it != blocks.end() && *it == first + count) {
+            ++it;
+            count++;
+        }
+        
+        if (fallocate(diskFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      blockOffset(first), (off_t)count * BLOCK_SIZE) != 0) {
+            if (errno == EOPNOTSUPP) {
+                // Freed blocks then simply keep their old contents
+                LOG_WARN("Disk", "File system cannot punch holes, freed blocks stay allocated");
+                punchSupported = false;
+                return;
+            }
+            LOG_WARN("Disk", "Failed to punch hole", kv("block", first), kv("blocks", count), kv("errno", errno));
+            continue;
+        }
+        runs++;
+        Metrics::add(Counter::BLOCKS_RECLAIMED, count);
+    }
+    LOG_DEBUG("Disk", "Reclaimed blocks", kv("blocks", blocks.size()), kv("runs", runs));
+}
+
+// Takes a reference to a shared block for each full block of body, whose
+// fingerprints are in prints. A block whose bytes are already in a shared
+// one reuses it; the others go to new shared blocks, written as one batch.
+// Caller holds the store exclusively.
+bool FileManagerDisk::acquireShared(const char* body, const std::vector<uint64_t>& prints, std::vector<int>& shared) {
+    const size_t dataPerBlock = BLOCK_SIZE - sizeof(BlockMetadata);
+    std::vector<int> fresh;
+    std::vector<BlockMetadata> metas;
+    std::unordered_map<int, const char*> unwritten;
+    std::string stored(dataPerBlock, '\0');
+    
+    for (size_t i = 0; i < prints.size(); i++) {
+        const char* data = body + i * dataPerBlock;
+        int block = -1;
+        auto match = fingerprints.find(prints[i]);
+        if (match != fingerprints.end()) {
+            auto pending = unwritten.find(match->second);
+            const char* candidate = pending != unwritten.end() ? pending->second : stored.data();
+            if (pending != unwritten.end() || readBlockData(match->second, 0, &stored[0], dataPerBlock)) {
+                if (std::memcmp(candidate, data, dataPerBlock) == 0) block = match->second;
+            }
+        }
+        
+        if (block != -1) {
+            Metrics::add(Counter::DEDUP_BLOCKS_SHARED);
+        } else {
+            block = allocateBlock(fresh.empty() ? 0 : fresh.back() + 1);
+            if (block == -1) {
+                LOG_ERROR("Dedup", "Disk full, cannot allocate a shared block");
+                releaseShared(shared);
+                shared.clear();
+                return false;
+            }
+            // A different block with the same fingerprint keeps the index entry
+            sharedBlocks[block] = SharedBlock{prints[i], 0};
+            fingerprints.emplace(prints[i], block);
+            unwritten[block] = data;
+            fresh.push_back(block);
+            metas.emplace_back();
+            metas.back().fileId = SHARED_BLOCK_FILE_ID;
+            metas.back().blockNumber = 0;
+            metas.back().nextBlock = -1;
+            metas.back().setSize(dataPerBlock, Codec::NONE);
+            Metrics::add(Counter::DEDUP_BLOCKS_STORED);
+        }
+        sharedBlocks[block].references++;
+        sharedReferences++;
+        shared.push_back(block);
+    }
+    
+    // Every shared block is full, so adjacent ones form one request
+    std::vector<struct iovec> iov;
+    std::vector<size_t> firstIov;
+    std::vector<IoRequest> batch;
+    for (size_t i = 0; i < fresh.size(); i++) {
+        if (!continuesRun(fresh, metas, i)) {
+            firstIov.push_back(iov.size());
+            batch.push_back(IoRequest{IoOp::WRITE, nullptr, 0, blockOffset(fresh[i]), 0});
+        }
+        iov.push_back({&metas[i], sizeof(BlockMetadata)});
+        iov.push_back({const_cast<char*>(unwritten[fresh[i]]), dataPerBlock});
+        batch.back().length += BLOCK_SIZE;
+    }
+    attachIov(batch, firstIov, iov);
+    if (!clearChecksums(fresh) || !runBatch(batch)) {
+        LOG_ERROR("Dedup", "Failed to write shared blocks", kv("blocks", fresh.size()), kv("runs", batch.size()));
+        releaseShared(shared);
+        shared.clear();
+        return false;
+    }
+    Metrics::add(Counter::BYTES_WRITTEN, fresh.size() * dataPerBlock);
+    for (size_t i = 0; i < fresh.size(); i++) setChecksum(fresh[i], blockChecksum(metas[i], unwritten[fresh[i]]));
     
-    std::cout << "[Disk] Freed block #" << blockNum << " (used: " << usedBlocks << ")\n";
+    saveDedupIndex();
+    LOG_DEBUG("Dedup", "Acquired shared blocks", kv("blocks", shared.size()), kv("new", fresh.size()));
+    return true;
+}
+
+// Drops one reference to each block; a block nobody refers to is freed.
+// Caller holds the store exclusively.
+void FileManagerDisk::releaseShared(const std::vector<int>& shared) {
+    if (shared.empty()) return;
+    for (int block : shared) {
+        auto it = sharedBlocks.find(block);
+        if (it == sharedBlocks.end()) {
+            LOG_WARN("Dedup", "Releasing a block that is not shared", kv("block", block));
+            continue;
+        }
+        sharedReferences--;
+        if (--it->second.references > 0) continue;
+        
+        auto print = fingerprints.find(it->second.fingerprint);
+        if (print != fingerprints.end() && print->second == block) fingerprints.erase(print);
+        sharedBlocks.erase(it);
+        freeBlock(block);
+    }
+    saveDedupIndex();
+}
+
+// Writes each block's metadata followed by its share of the stream, which is
+// head followed by body, starting at stream position pos. A run of adjacent
+// blocks is one contiguous range of disk.bin and one request, built straight
+// from head and body; all runs go to the disk as one batch.
+bool FileManagerDisk::writeChain(const std::vector<int>& blocks, const std::vector<BlockMetadata>& metas,
+                                 const std::string& head, const char* body, size_t pos) {
+    std::vector<struct iovec> iov;
+    std::vector<size_t> firstIov;
+    std::vector<IoRequest> batch;
+    std::vector<uint32_t> checksums(blocks.size());
+    size_t bytes = 0;
+    
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (blocks[i] < 0 || blocks[i] >= TOTAL_BLOCKS || metas[i].dataSize < 0 ||
+            metas[i].size() > BLOCK_SIZE - (int)sizeof(BlockMetadata)) {
+            LOG_ERROR("Disk", "Invalid block for write", kv("block", blocks[i]), kv("size", metas[i].dataSize));
+            return false;
+        }
+        if (!continuesRun(blocks, metas, i)) {
+            firstIov.push_back(iov.size());
+            batch.push_back(IoRequest{IoOp::WRITE, nullptr, 0, blockOffset(blocks[i]), 0});
+        }
+        
+        iov.push_back({const_cast<BlockMetadata*>(&metas[i]), sizeof(BlockMetadata)});
+        checksums[i] = Checksum::crc32c(&metas[i], sizeof(BlockMetadata));
+        size_t end = pos + metas[i].size();
+        if (pos < head.size()) {
+            size_t inHead = std::min(end, head.size()) - pos;
+            iov.push_back({const_cast<char*>(head.data() + pos), inHead});
+            checksums[i] = Checksum::crc32c(head.data() + pos, inHead, checksums[i]);
+            pos += inHead;
+        }
+        if (end > pos) {
+            iov.push_back({const_cast<char*>(body + (pos - head.size())), end - pos});
+            checksums[i] = Checksum::crc32c(body + (pos - head.size()), end - pos, checksums[i]);
+            pos = end;
+        }
+        batch.back().length += sizeof(BlockMetadata) + metas[i].size();
+        bytes += metas[i].size();
+    }
+    attachIov(batch, firstIov, iov);
+    
+    if (!clearChecksums(blocks)) return false;
+    if (!runBatch(batch)) {
+        LOG_ERROR("Disk", "Failed to write blocks", kv("firstBlock", blocks.empty() ? -1 : blocks[0]),
+                  kv("runs", batch.size()));
+        return false;
+    }
+    for (size_t i = 0; i < blocks.size(); i++) setChecksum(blocks[i], checksums[i]);
+    LOG_DEBUG("Disk", "Wrote blocks", kv("blocks", blocks.size()), kv("runs", batch.size()));
+    Metrics::add(Counter::BYTES_WRITTEN, bytes);
+    
+    return true;
 }
 
-bool FileManagerDisk::writeBlock(int blockNum, const BlockMetadata& meta, const char* data, int dataSize) {
+bool FileManagerDisk::readBlockData(int blockNum, int offset, char* data, int dataSize) {
     if (blockNum < 0 || blockNum >= TOTAL_BLOCKS) {
-        std::cerr << "[ERROR] Invalid block number for write: " << blockNum << "\n";
+        LOG_ERROR("Disk", "Invalid block number for read", kv("block", blockNum));
         return false;
     }
     
-    if (dataSize > BLOCK_SIZE - sizeof(BlockMetadata)) {
-        std::cerr << "[ERROR] Data size exceeds block capacity: " << dataSize << "\n";
+    if (offset < 0 || offset + dataSize > BLOCK_SIZE - (int)sizeof(BlockMetadata)) {
+        LOG_ERROR("Disk", "Data range exceeds block capacity", kv("offset", offset), kv("size", dataSize));
         return false;
     }
     
-    diskFile.seekp(blockNum * BLOCK_SIZE, std::ios::beg);
-    diskFile.write(reinterpret_cast<const char*>(&meta), sizeof(BlockMetadata));
-    diskFile.write(data, dataSize);
-    diskFile.flush();
+    if (!readBytes(data, dataSize, blockOffset(blockNum) + sizeof(BlockMetadata) + offset)) {
+        LOG_ERROR("Disk", "Failed to read block data", kv("block", blockNum));
+        return false;
+    }
+    Metrics::add(Counter::BYTES_READ, dataSize);
+    
+    return true;
+}
+
+bool FileManagerDisk::readBlockMeta(int blockNum, BlockMetadata& meta) {
+    if (blockNum < 0 || blockNum >= TOTAL_BLOCKS) {
+        LOG_ERROR("Disk", "Invalid block number for read", kv("block", blockNum));
+        return false;
+    }
+    
+    if (!readBytes(reinterpret_cast<char*>(&meta), sizeof(BlockMetadata), blockOffset(blockNum))) {
+        LOG_ERROR("Disk", "Failed to read block metadata", kv("block", blockNum));
+        return false;
+    }
+    
+    return true;
+}
+
+bool FileManagerDisk::writeBlockMeta(int blockNum, const BlockMetadata& meta) {
+    if (blockNum < 0 || blockNum >= TOTAL_BLOCKS) {
+        LOG_ERROR("Disk", "Invalid block number for write", kv("block", blockNum));
+        return false;
+    }
+    
+    if (!writeBytes(reinterpret_cast<const char*>(&meta), sizeof(BlockMetadata), blockOffset(blockNum))) {
+        LOG_ERROR("Disk", "Failed to write block metadata", kv("block", blockNum));
+        return false;
+    }
     
     return true;
 }
 
-bool FileManagerDisk::readBlock(int blockNum, BlockMetadata& meta, char* data) {
+bool FileManagerDisk::writeBlockData(int blockNum, int offset, const char* data, int dataSize) {
     if (blockNum < 0 || blockNum >= TOTAL_BLOCKS) {
-        std::cerr << "[ERROR] Invalid block number for read: " << blockNum << "\n";
+        LOG_ERROR("Disk", "Invalid block number for write", kv("block", blockNum));
         return false;
     }
     
-    diskFile.seekg(blockNum * BLOCK_SIZE, std::ios::beg);
-    diskFile.read(reinterpret_cast<char*>(&meta), sizeof(BlockMetadata));
-    diskFile.read(data, meta.dataSize);
+    if (offset < 0 || offset + dataSize > BLOCK_SIZE - (int)sizeof(BlockMetadata)) {
+        LOG_ERROR("Disk", "Data range exceeds block capacity", kv("offset", offset), kv("size", dataSize));
+        return false;
+    }
     
-    if (diskFile.fail()) {
-        std::cerr << "[ERROR] Failed to read block #" << blockNum << "\n";
+    if (!writeBytes(data, dataSize, blockOffset(blockNum) + sizeof(BlockMetadata) + offset)) {
+        LOG_ERROR("Disk", "Failed to write block data", kv("block", blockNum));
         return false;
     }
+    Metrics::add(Counter::BYTES_WRITTEN, dataSize);
     
     return true;
 }
 
-std::vector<int> FileManagerDisk::getFileBlocks(int fileId) {
+std::vector<int> FileManagerDisk::getFileBlocks(int fileId, std::vector<BlockMetadata>* metas) {
+    TRACE_SPAN("FileManagerDisk::getFileBlocks");
     std::vector<int> blocks;
     
-    FileIndexEntry* entry = btree->search(fileId);
-    if (!entry) {
+    int blockNum;
+    if (!findFirstBlock(fileId, blockNum)) {
         return blocks;
     }
     
-    int blockNum = entry->firstBlock;
     int safetyCounter = 0;
     
     while (blockNum != -1 && safetyCounter < TOTAL_BLOCKS) {
         blocks.push_back(blockNum);
         
         BlockMetadata meta;
-        char buffer[BLOCK_SIZE] = {0};
         
-        if (!readBlock(blockNum, meta, buffer)) {
-            std::cerr << "[ERROR] Failed to read block chain at block #" << blockNum << "\n";
+        if (!readBlockMeta(blockNum, meta)) {
+            LOG_ERROR("Disk", "Failed to read block chain", kv("block", blockNum));
             break;
         }
+        if (metas) metas->push_back(meta);
         
         blockNum = meta.nextBlock;
         safetyCounter++;
     }
     
     if (safetyCounter >= TOTAL_BLOCKS) {
-        std::cerr << "[ERROR] Infinite loop detected in block chain for file " << fileId << "\n";
+        LOG_ERROR("Disk", "Infinite loop detected in block chain", kv("file", fileId));
     }
     
     return blocks;
 }
 
-bool FileManagerDisk::saveFile(const FileEntry& f) {
-    std::cout << "\n[Disk] ===== Saving File =====\n";
-    std::cout << "[Disk] File ID: " << f.fileId << "\n";
-    std::cout << "[Disk] Name: " << f.name << "\n";
-    std::cout << "[Disk] Content size: " << f.content.size() << " bytes\n";
+bool FileManagerDisk::findFirstBlock(int fileId, int& firstBlock) {
+    std::lock_guard<std::mutex> lock(indexMutex);
+    FileIndexEntry* entry = btree->search(fileId);
+    if (!entry) return false;
+    firstBlock = entry->firstBlock;
+    return true;
+}
+
+std::vector<int> FileManagerDisk::getAllFileIds() {
+    std::vector<int> ids;
+    {
+        ReadScope store(*this);
+        std::lock_guard<std::mutex> lock(indexMutex);
+        ids = btree->getAllFileIds();
+    }
+    // Files created since the last flush are only in the buffer
+    if (writeBack) {
+        std::vector<int> dirty = writeBack->getDirtyIds();
+        if (!dirty.empty()) {
+            ids.insert(ids.end(), dirty.begin(), dirty.end());
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        }
+    }
+    return ids;
+}
+
+size_t FileManagerDisk::headerSize(size_t nameLen) {
+    return 4 * sizeof(int) + nameLen + 2 * sizeof(time_t) + 2 * sizeof(bool);
+}
+
+// Where the content starts in a chain's stream, from the name length in the header
+bool FileManagerDisk::contentStart(const std::string& stream, size_t& start) {
+    int nameLen = -1;
+    if (stream.size() >= headerSize(0)) std::memcpy(&nameLen, stream.data() + 3 * sizeof(int), sizeof(int));
+    if (nameLen < 0) return false;
+    start = headerSize(nameLen);
+    return stream.size() >= start;
+}
+
+std::string FileManagerDisk::serializeHeader(const FileEntry& f) {
+    std::string header;
+    header.reserve(headerSize(f.name.size()));
     
-  
-    std::vector<int> existingBlocks = getFileBlocks(f.fileId);
+    header.append(reinterpret_cast<const char*>(&f.fileId), sizeof(int));
+    header.append(reinterpret_cast<const char*>(&f.userId), sizeof(int));
+    header.append(reinterpret_cast<const char*>(&f.ownerId), sizeof(int));
     
-    if (!existingBlocks.empty()) {
-        std::cout << "[Disk] File already exists with " << existingBlocks.size() << " blocks. Will reuse them.\n";
-    } else {
-        std::cout << "[Disk] New file - no existing blocks.\n";
-    }
+    int nameLen = f.name.size();
+    header.append(reinterpret_cast<const char*>(&nameLen), sizeof(int));
+    header.append(f.name);
+    
+    header.append(reinterpret_cast<const char*>(&f.createTime), sizeof(time_t));
+    header.append(reinterpret_cast<const char*>(&f.expireTime), sizeof(time_t));
+    header.append(reinterpret_cast<const char*>(&f.inBin), sizeof(bool));
+    header.append(reinterpret_cast<const char*>(&f.inUse), sizeof(bool));
+    
+    return header;
+}
 
- 
-    char metaBuffer[256] = {0};
-    int offset = 0;
+// Inverse of serializeHeader() followed by the content
+bool FileManagerDisk::parseFile(const std::string& data, FileEntry& f) {
+    int nameLen = 0;
+    if (data.size() < headerSize(0)) return false;
+    std::memcpy(&nameLen, data.data() + 3 * sizeof(int), sizeof(int));
+    if (nameLen < 0 || data.size() < headerSize(nameLen)) return false;
     
-    std::memcpy(metaBuffer + offset, &f.fileId, sizeof(int)); 
-    offset += sizeof(int);
+    size_t pos = 0;
+    std::memcpy(&f.fileId, data.data() + pos, sizeof(int)); 
+    pos += sizeof(int);
     
-    std::memcpy(metaBuffer + offset, &f.userId, sizeof(int)); 
-    offset += sizeof(int);
+    std::memcpy(&f.userId, data.data() + pos, sizeof(int)); 
+    pos += sizeof(int);
     
-    std::memcpy(metaBuffer + offset, &f.ownerId, sizeof(int)); 
-    offset += sizeof(int);
+    std::memcpy(&f.ownerId, data.data() + pos, sizeof(int)); 
+    pos += 2 * sizeof(int);   // past the name length, read above
     
-    int nameLen = f.name.size();
-    std::memcpy(metaBuffer + offset, &nameLen, sizeof(int)); 
-    offset += sizeof(int);
-    std::memcpy(metaBuffer + offset, f.name.data(), nameLen); 
-    offset += nameLen;
+    f.name = data.substr(pos, nameLen); 
+    pos += nameLen;
     
-    std::memcpy(metaBuffer + offset, &f.createTime, sizeof(time_t)); 
-    offset += sizeof(time_t);
+    std::memcpy(&f.createTime, data.data() + pos, sizeof(time_t)); 
+    pos += sizeof(time_t);
     
-    std::memcpy(metaBuffer + offset, &f.expireTime, sizeof(time_t)); 
-    offset += sizeof(time_t);
+    std::memcpy(&f.expireTime, data.data() + pos, sizeof(time_t)); 
+    pos += sizeof(time_t);
     
-    std::memcpy(metaBuffer + offset, &f.inBin, sizeof(bool)); 
-    offset += sizeof(bool);
+    std::memcpy(&f.inBin, data.data() + pos, sizeof(bool)); 
+    pos += sizeof(bool);
     
-    std::memcpy(metaBuffer + offset, &f.inUse, sizeof(bool)); 
-    offset += sizeof(bool);
+    std::memcpy(&f.inUse, data.data() + pos, sizeof(bool)); 
+    pos += sizeof(bool);
+
+    f.content = data.substr(pos);
+    f.expired = false;
+    return true;
+}
 
-    std::string totalData(metaBuffer, offset);
-    totalData += f.content;
+bool FileManagerDisk::saveFile(const FileEntry& f) {
+    if (writeBack) {
+        TRACE_SPAN("FileManagerDisk::stageFile");
+        generation.fetch_add(1, std::memory_order_release);
+        if (!writeBack->stage(f, !ownsBatch())) return false;
+        setOwner(f.fileId, f.userId);
+        return true;
+    }
+    return storeFile(f);
+}
 
-    size_t totalSize = totalData.size();
+bool FileManagerDisk::storeFile(const FileEntry& f, bool encode) {
+    TRACE_SPAN("FileManagerDisk::saveFile");
+    // Compressed and fingerprinted outside the store, which only the disk
+    // writes need
+    Codec codec = Codec::NONE;
+    std::string compressed;
+    if (compression && encode) {
+        if (Compression::worthCompressing(f.content.data(), f.content.size()) &&
+            Compression::compress(f.content.data(), f.content.size(), compressed, f.content.size() / 8 * 7)) {
+            codec = Codec::LZ;
+            Metrics::add(Counter::FILES_COMPRESSED);
+            Metrics::add(Counter::COMPRESSION_BYTES_IN, f.content.size());
+            Metrics::add(Counter::COMPRESSION_BYTES_OUT, compressed.size());
+        } else {
+            Metrics::add(Counter::COMPRESSION_SKIPPED);
+        }
+    }
+    const char* body = codec == Codec::NONE ? f.content.data() : compressed.data();
+    size_t bodySize = codec == Codec::NONE ? f.content.size() : compressed.size();
     size_t dataPerBlock = BLOCK_SIZE - sizeof(BlockMetadata);
+    
+    // The full blocks of the body go to shared blocks; the chain keeps the
+    // list of them and the rest of the body
+    bool deduped = dedup && encode && bodySize >= dataPerBlock;
+    std::vector<uint64_t> prints;
+    if (deduped) {
+        for (size_t i = 0; i < bodySize / dataPerBlock; i++) {
+            prints.push_back(fingerprint(body + i * dataPerBlock, dataPerBlock));
+        }
+    }
+    
+    WriteScope store(*this);
+    generation.fetch_add(1, std::memory_order_release);
+    std::vector<BlockMetadata> existingMetas;
+    std::vector<int> existingBlocks = getFileBlocks(f.fileId, &existingMetas);
+    
+    // Released once the new chain is written, so blocks both versions share
+    // are not freed in between
+    std::vector<int> oldShared;
+    if (!existingMetas.empty() && existingMetas[0].deduped() &&
+        !sharedBlocksOf(existingBlocks, existingMetas, oldShared)) {
+        LOG_WARN("Dedup", "Unreadable list of shared blocks, leaving them allocated", kv("file", f.fileId));
+    }
+    
+    std::vector<int> shared;
+    std::string list;
+    if (deduped) {
+        if (!acquireShared(body, prints, shared)) {
+            cache.invalidate(f.fileId);
+            return false;
+        }
+        int count = shared.size();
+        size_t tail = count * dataPerBlock;
+        list.reserve(sizeof(int) * (count + 1) + bodySize - tail);
+        list.append(reinterpret_cast<const char*>(&count), sizeof(int));
+        list.append(reinterpret_cast<const char*>(shared.data()), count * sizeof(int));
+        list.append(body + tail, bodySize - tail);
+        body = list.data();
+        bodySize = list.size();
+    }
+
+    // Written from header and content in place, without joining them
+    std::string header = serializeHeader(f);
+
+    size_t totalSize = header.size() + bodySize;
     size_t blocksNeeded = (totalSize + dataPerBlock - 1) / dataPerBlock; 
 
-    std::cout << "[Disk] Total data size: " << totalSize << " bytes\n";
-    std::cout << "[Disk] Blocks needed: " << blocksNeeded << "\n";
-    std::cout << "[Disk] Existing blocks: " << existingBlocks.size() << "\n";
+    LOG_DEBUG("Disk", "Saving file", kv("file", f.fileId), kv("name", f.name), payload("content", f.content),
+              kv("blocksNeeded", blocksNeeded), kv("existingBlocks", existingBlocks.size()));
 
     std::vector<int> blocksToUse;
     
     for (size_t i = 0; i < blocksNeeded && i < existingBlocks.size(); i++) {
         blocksToUse.push_back(existingBlocks[i]);
-        std::cout << "[Disk] ✓ Reusing block #" << existingBlocks[i] << "\n";
     }
     
+    // A failed save gives back what it took: the blocks past the stored
+    // chain and its references to shared blocks
+    auto abandonSave = [&] {
+        for (size_t i = existingBlocks.size(); i < blocksToUse.size(); i++) {
+            freeBlock(blocksToUse[i]);
+        }
+        releaseShared(shared);
+        saveBitmap();
+        cache.invalidate(f.fileId);
+    };
+    
     if (blocksNeeded > existingBlocks.size()) {
         size_t newBlocksNeeded = blocksNeeded - existingBlocks.size();
-        std::cout << "[Disk] Need " << newBlocksNeeded << " NEW blocks.\n";
-        
         for (size_t i = 0; i < newBlocksNeeded; i++) {
-            int newBlock = allocateBlock();
+            int newBlock = allocateBlock(blocksToUse.empty() ? 0 : blocksToUse.back() + 1);
             if (newBlock == -1) {
-                std::cerr << "[ERROR] Disk full! Cannot allocate more blocks.\n";
+                LOG_ERROR("Disk", "Disk full, cannot allocate more blocks");
+                abandonSave();
                 return false;
             }
             blocksToUse.push_back(newBlock);
         }
     }
-
+    
+    std::vector<BlockMetadata> metas(blocksToUse.size());
+    for (size_t i = 0; i < blocksToUse.size(); i++) {
+        metas[i].fileId = f.fileId;
+        metas[i].blockNumber = i;
+        metas[i].nextBlock = (i + 1 < blocksToUse.size()) ? blocksToUse[i + 1] : -1;
+        metas[i].setSize(std::min(totalSize - i * dataPerBlock, dataPerBlock), codec, deduped);
+    }
+    if (!writeChain(blocksToUse, metas, header, body, 0)) {
+        abandonSave();
+        return false;
+    }
+    
+    // Freed only now, so a failed write leaves the old chain's blocks allocated
     if (blocksNeeded < existingBlocks.size()) {
-        size_t blocksToFree = existingBlocks.size() - blocksNeeded;
-        std::cout << "[Disk] File shrunk. Freeing " << blocksToFree << " unused blocks.\n";
+        LOG_DEBUG("Disk", "File shrunk, freeing unused blocks", kv("file", f.fileId),
+                  kv("blocks", existingBlocks.size() - blocksNeeded));
         
         for (size_t i = blocksNeeded; i < existingBlocks.size(); i++) {
             freeBlock(existingBlocks[i]);
         }
     }
-    size_t written = 0;
-    
-    for (size_t i = 0; i < blocksToUse.size(); i++) {
-        int blockNum = blocksToUse[i];
-        size_t remainingData = totalSize - written;
-        size_t writeSize = std::min(remainingData, dataPerBlock);
-
-        BlockMetadata meta;
-        meta.fileId = f.fileId;
-        meta.blockNumber = i;
-        meta.nextBlock = (i + 1 < blocksToUse.size()) ? blocksToUse[i + 1] : -1;
-        meta.dataSize = writeSize;
-
-        char buffer[BLOCK_SIZE] = {0};
-        std::memcpy(buffer, totalData.data() + written, writeSize);
-       
-        if (!writeBlock(blockNum, meta, buffer, writeSize)) {
-            std::cerr << "[ERROR] Failed to write block #" << blockNum << "\n";
-            return false;
-        }
-
-        std::cout << "[Disk] Wrote " << writeSize << " bytes to block #" << blockNum 
-                  << " (next: " << meta.nextBlock << ")\n";
-
-        written += writeSize;
-    }
 
     btree->insert(f.fileId, blocksToUse[0]);
-    std::cout << "[Disk] B-tree index updated: File " << f.fileId << " -> Block " << blocksToUse[0] << "\n";
+    releaseShared(oldShared);
 
     saveBitmap();
+    cache.put(f);
+    setOwner(f.fileId, f.userId);
 
-    std::cout << "[Disk] ===== Save Complete =====\n";
-    std::cout << "[Disk] Used " << blocksToUse.size() << " blocks for file " << f.fileId << "\n";
-    std::cout << "[Disk] Disk usage: " << usedBlocks << "/" << totalBlocks << " blocks\n\n";
+    LOG_DEBUG("Disk", "Save complete", kv("file", f.fileId), kv("blocks", blocksToUse.size()),
+              kv("firstBlock", blocksToUse[0]), kv("used", usedBlocks));
     
     return true;
 }
 
 FileEntry* FileManagerDisk::loadFile(int fileId) {
-    std::cout << "[Disk] Loading file ID " << fileId << "...\n";
+    TRACE_SPAN("FileManagerDisk::loadFile");
+    LOG_DEBUG("Disk", "Loading file", kv("file", fileId));
     
-    std::vector<int> blocks = getFileBlocks(fileId);
+    FileEntry* cached = new FileEntry();
+    if (writeBack && writeBack->lookup(fileId, *cached)) {
+        return cached;
+    }
+    if (cache.get(fileId, *cached)) {
+        cached->expired = false;
+        return cached;
+    }
+    delete cached;
+    
+    // Inside a batch this thread holds the store exclusively, so waiting on
+    // another thread's read could deadlock
+    if (ownsBatch()) return readFile(fileId);
+    
+    std::promise<std::shared_ptr<const FileEntry>> promise;
+    PendingLoad pending;
+    bool leader = false;
+    {
+        std::lock_guard<std::mutex> lock(flightMutex);
+        auto it = inFlight.find(fileId);
+        if (it != inFlight.end()) {
+            pending = it->second;
+        } else {
+            pending = promise.get_future().share();
+            inFlight.emplace(fileId, pending);
+            leader = true;
+        }
+    }
     
-    if (blocks.empty()) {
-        std::cerr << "[Disk] No blocks found for file ID " << fileId << "\n";
-        return nullptr;
+    if (!leader) {
+        Metrics::add(Counter::LOADS_COALESCED);
+        std::shared_ptr<const FileEntry> shared = pending.get();
+        return shared ? new FileEntry(*shared) : nullptr;
     }
     
-    std::cout << "[Disk] Found " << blocks.size() << " blocks for file " << fileId << "\n";
+    std::shared_ptr<const FileEntry> loaded;
+    {
+        ReadScope store(*this);
+        loaded.reset(readFile(fileId));
+        // Retired before the store is released, so a later request cannot
+        // join a read that a write has since made stale
+        std::lock_guard<std::mutex> lock(flightMutex);
+        inFlight.erase(fileId);
+    }
+    promise.set_value(loaded);
+    return loaded ? new FileEntry(*loaded) : nullptr;
+}
 
-    std::string totalData;
-    
-    for (int blockNum : blocks) {
-        BlockMetadata meta;
-        char buffer[BLOCK_SIZE] = {0};
-        
-        if (!readBlock(blockNum, meta, buffer)) {
-            std::cerr << "[ERROR] Failed to read block #" << blockNum << "\n";
-            return nullptr;
+// The whole chain is read as one batch, one request per run of adjacent
+// blocks starting at the first block's metadata, straight into stream; the
+// metadata lands in scratch. Caller holds the store.
+bool FileManagerDisk::readChain(const std::vector<int>& blocks, const std::vector<BlockMetadata>& metas,
+                                std::string& stream) {
+    size_t totalSize = 0;
+    for (const BlockMetadata& meta : metas) totalSize += meta.size();
+    
+    stream.assign(totalSize, '\0');
+    std::vector<BlockMetadata> scratch(blocks.size());
+    std::vector<struct iovec> iov;
+    std::vector<size_t> firstIov;
+    std::vector<IoRequest> batch;
+    size_t pos = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (!continuesRun(blocks, metas, i)) {
+            firstIov.push_back(iov.size());
+            batch.push_back(IoRequest{IoOp::READ, nullptr, 0, blockOffset(blocks[i]), 0});
         }
-        
-        totalData.append(buffer, meta.dataSize);
+        iov.push_back({&scratch[i], sizeof(BlockMetadata)});
+        batch.back().length += sizeof(BlockMetadata);
+        iov.push_back({&stream[pos], (size_t)metas[i].size()});
+        batch.back().length += metas[i].size();
+        pos += metas[i].size();
+    }
+    attachIov(batch, firstIov, iov);
+    if (!runBatch(batch)) {
+        LOG_ERROR("Disk", "Failed to read blocks", kv("firstBlock", blocks.empty() ? -1 : blocks[0]),
+                  kv("runs", batch.size()));
+        return false;
+    }
+    Metrics::add(Counter::BYTES_READ, totalSize);
+    
+    pos = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (!verifyBlock(blocks[i], scratch[i], &stream[pos])) return false;
+        pos += metas[i].size();
     }
+    return true;
+}
 
-    size_t pos = 0;
-    FileEntry* f = new FileEntry();
+// The shared blocks a deduplicated chain refers to; caller holds the store
+bool FileManagerDisk::sharedBlocksOf(const std::vector<int>& blocks, const std::vector<BlockMetadata>& metas,
+                                     std::vector<int>& shared) {
+    std::string stream;
+    size_t start, tail;
+    return readChain(blocks, metas, stream) && contentStart(stream, start) &&
+           parseSharedList(stream.data() + start, stream.size() - start, shared, tail);
+}
 
-    std::memcpy(&f->fileId, totalData.data() + pos, sizeof(int)); 
-    pos += sizeof(int);
-    
-    std::memcpy(&f->userId, totalData.data() + pos, sizeof(int)); 
-    pos += sizeof(int);
+// Replaces body with the content a deduplicated chain stores from list on:
+// the shared blocks it names, in one batch, then the rest of list
+bool FileManagerDisk::readDeduped(const char* list, size_t size, std::string& body) {
+    const size_t dataPerBlock = BLOCK_SIZE - sizeof(BlockMetadata);
+    std::vector<int> shared;
+    size_t tail;
+    if (!parseSharedList(list, size, shared, tail)) return false;
+    
+    body.assign(shared.size() * dataPerBlock + (size - tail), '\0');
+    std::vector<BlockMetadata> scratch(shared.size());
+    std::vector<struct iovec> iov;
+    std::vector<size_t> firstIov;
+    std::vector<IoRequest> batch;
+    for (size_t i = 0; i < shared.size(); i++) {
+        if (i == 0 || shared[i] != shared[i - 1] + 1) {
+            firstIov.push_back(iov.size());
+            batch.push_back(IoRequest{IoOp::READ, nullptr, 0, blockOffset(shared[i]), 0});
+        }
+        iov.push_back({&scratch[i], sizeof(BlockMetadata)});
+        iov.push_back({&body[i * dataPerBlock], dataPerBlock});
+        batch.back().length += BLOCK_SIZE;
+    }
+    attachIov(batch, firstIov, iov);
+    if (!runBatch(batch)) return false;
+    for (size_t i = 0; i < shared.size(); i++) {
+        if (!verifyBlock(shared[i], scratch[i], &body[i * dataPerBlock]) ||
+            scratch[i].fileId != SHARED_BLOCK_FILE_ID || scratch[i].size() != (int)dataPerBlock) return false;
+    }
+    Metrics::add(Counter::BYTES_READ, shared.size() * dataPerBlock);
     
-    std::memcpy(&f->ownerId, totalData.data() + pos, sizeof(int)); 
-    pos += sizeof(int);
+    std::memcpy(&body[shared.size() * dataPerBlock], list + tail, size - tail);
+    return true;
+}
+
+// Reads and parses the chain; caller holds the store
+FileEntry* FileManagerDisk::readFile(int fileId) {
+    std::vector<BlockMetadata> metas;
+    std::vector<int> blocks = getFileBlocks(fileId, &metas);
     
-    int nameLen = 0;
-    std::memcpy(&nameLen, totalData.data() + pos, sizeof(int)); 
-    pos += sizeof(int);
+    if (blocks.empty() || metas.size() != blocks.size()) {
+        LOG_WARN("Disk", "No blocks found", kv("file", fileId));
+        return nullptr;
+    }
     
-    f->name = totalData.substr(pos, nameLen); 
-    pos += nameLen;
+    LOG_DEBUG("Disk", "Found blocks", kv("file", fileId), kv("blocks", blocks.size()));
     
-    std::memcpy(&f->createTime, totalData.data() + pos, sizeof(time_t)); 
-    pos += sizeof(time_t);
+    Codec codec = metas[0].codec();
+    bool deduped = metas[0].deduped();
+    for (const BlockMetadata& meta : metas) {
+        if (meta.dataSize < 0 || meta.size() > BLOCK_SIZE - (int)sizeof(BlockMetadata) ||
+            meta.codec() != codec || meta.deduped() != deduped) {
+            LOG_ERROR("Disk", "Corrupt block metadata", kv("file", fileId), kv("size", meta.dataSize));
+            return nullptr;
+        }
+    }
     
-    std::memcpy(&f->expireTime, totalData.data() + pos, sizeof(time_t)); 
-    pos += sizeof(time_t);
+    std::string totalData;
+    if (!readChain(blocks, metas, totalData)) {
+        LOG_ERROR("Disk", "Failed to read file", kv("file", fileId));
+        return nullptr;
+    }
+
+    // Content that is not stored as is is decoded apart from the header
+    std::string content;
+    bool encoded = codec != Codec::NONE || deduped;
+    if (encoded) {
+        size_t header;
+        if (!contentStart(totalData, header)) {
+            LOG_ERROR("Disk", "Corrupt file header", kv("file", fileId));
+            return nullptr;
+        }
+        const char* body = totalData.data() + header;
+        size_t bodySize = totalData.size() - header;
+        std::string joined;
+        if (deduped) {
+            if (!readDeduped(body, bodySize, joined)) {
+                LOG_ERROR("Disk", "Corrupt deduplicated content", kv("file", fileId));
+                return nullptr;
+            }
+            body = joined.data();
+            bodySize = joined.size();
+        }
+        if (codec == Codec::NONE) {
+            content = std::move(joined);
+        } else if (codec != Codec::LZ || !Compression::decompress(body, bodySize, content)) {
+            LOG_ERROR("Disk", "Corrupt compressed content", kv("file", fileId), kv("codec", (int)codec));
+            return nullptr;
+        } else {
+            Metrics::add(Counter::BYTES_DECOMPRESSED, content.size());
+        }
+        totalData.resize(header);
+    }
+
+    FileEntry* f = new FileEntry();
+    if (!parseFile(totalData, *f)) {
+        LOG_ERROR("Disk", "Corrupt file header", kv("file", fileId));
+        delete f;
+        return nullptr;
+    }
+    if (encoded) f->content = std::move(content);
+
+    LOG_DEBUG("Disk", "Loaded file", kv("name", f->name), payload("content", f->content));
+    cache.put(*f);
     
-    std::memcpy(&f->inBin, totalData.data() + pos, sizeof(bool)); 
-    pos += sizeof(bool);
+    return f;
+}
+
+std::vector<FileEntry> FileManagerDisk::loadFilesOwnedBy(int userId) {
+    TRACE_SPAN("FileManagerDisk::loadFilesOwnedBy");
+    std::vector<int> fileIds;
+    {
+        std::unique_lock<std::mutex> lock(ownerMutex);
+        ownersBuilt.wait(lock, [this] { return ownersReady; });
+        auto it = filesOf.find(userId);
+        if (it != filesOf.end()) fileIds.assign(it->second.begin(), it->second.end());
+    }
+    prefetchFiles(fileIds);
+    
+    std::vector<std::unique_ptr<FileEntry>> loaded(fileIds.size());
+    // Pool threads cannot take the store while this thread holds it for a batch
+    size_t slices = ownsBatch() ? 1 : std::min<size_t>(IO_POOL_THREADS, fileIds.size());
+    auto loadSlice = [&](size_t slice) {
+        for (size_t i = fileIds.size() * slice / slices; i < fileIds.size() * (slice + 1) / slices; i++) {
+            loaded[i].reset(loadFile(fileIds[i]));
+        }
+    };
+    if (slices <= 1) {
+        slices = 1;
+        loadSlice(0);
+    } else {
+        runParallel(slices, loadSlice);
+    }
     
-    std::memcpy(&f->inUse, totalData.data() + pos, sizeof(bool)); 
-    pos += sizeof(bool);
+    std::vector<FileEntry> files;
+    for (auto& f : loaded) {
+        if (f && f->userId == userId) files.push_back(std::move(*f));
+    }
+    return files;
+}
 
-    f->content = totalData.substr(pos);
-    f->expired = false;
+bool FileManagerDisk::snapshotExtents(int fileId, size_t offset, size_t length, ExtentSnapshot& snapshot) {
+    TRACE_SPAN("FileManagerDisk::snapshotExtents");
+    if (writeBack) writeBack->flushFile(fileId);
+    ReadScope store(*this);
+    snapshot.fileId = fileId;
+    snapshot.generation = generation.load(std::memory_order_acquire);
+    snapshot.extents.clear();
+    return walkExtents(fileId, offset, length, false, [&](const DiskExtent& extent) {
+        snapshot.extents.push_back(extent);
+        return true;
+    });
+}
 
-    std::cout << "[Disk] Loaded file: " << f->name << " (" << f->content.size() << " bytes)\n";
+bool FileManagerDisk::readExtent(const ExtentSnapshot& snapshot, const DiskExtent& extent, std::string& bytes) {
+    AlignedBuffer data(BLOCK_SIZE);
+    ReadScope store(*this);
+    bool unchanged = extent.checksum != 0
+        ? blockChecksums[extent.blockNum] == extent.checksum
+        : generation.load(std::memory_order_acquire) == snapshot.generation;
+    if (!unchanged) {
+        LOG_WARN("Disk", "Block changed since the snapshot", kv("file", snapshot.fileId), kv("block", extent.blockNum));
+        return false;
+    }
     
-    return f;
+    BlockMetadata meta;
+    if (!readBlockMeta(extent.blockNum, meta) || meta.fileId != snapshot.fileId ||
+        meta.dataSize < 0 || meta.size() > BLOCK_SIZE - (int)sizeof(BlockMetadata) ||
+        (size_t)meta.size() < extent.blockOffset + extent.length ||
+        !readBlockData(extent.blockNum, 0, data.get(), meta.size()) || !verifyBlock(extent.blockNum, meta, data.get())) {
+        return false;
+    }
+    bytes.assign(data.get() + extent.blockOffset, extent.length);
+    return true;
+}
+
+bool FileManagerDisk::walkExtents(int fileId, size_t offset, size_t length, bool withData,
+                                  const std::function<bool(const DiskExtent&)>& visit) {
+    int blockNum;
+    if (!findFirstBlock(fileId, blockNum)) {
+        LOG_WARN("Disk", "No blocks found", kv("file", fileId));
+        return false;
+    }
+    
+    size_t blockStart = 0;
+    size_t start = 0;
+    size_t end = 0;
+    bool firstBlock = true;
+    int safetyCounter = 0;
+    AlignedBuffer data(BLOCK_SIZE);
+    
+    while (blockNum != -1 && safetyCounter < TOTAL_BLOCKS) {
+        BlockMetadata meta;
+        if (!readBlockMeta(blockNum, meta)) {
+            return false;
+        }
+        
+        if (firstBlock) {
+            if (meta.codec() != Codec::NONE || meta.deduped()) {
+                LOG_DEBUG("Disk", "No extents for an encoded file", kv("file", fileId));
+                return false;
+            }
+            // The name length decides where the content starts in the stream
+            int nameLen = 0;
+            if (!readBlockData(blockNum, 3 * sizeof(int), reinterpret_cast<char*>(&nameLen), sizeof(int))) {
+                return false;
+            }
+            start = headerSize(nameLen) + offset;
+            end = start + length;
+            firstBlock = false;
+        }
+        
+        size_t blockEnd = blockStart + meta.size();
+        size_t from = std::max(start, blockStart);
+        size_t to = std::min(end, blockEnd);
+        
+        if (to > from) {
+            // Only blocks the range touches are read, whole, to be verified
+            if (meta.dataSize < 0 || meta.size() > BLOCK_SIZE - (int)sizeof(BlockMetadata)) {
+                return false;
+            }
+            if (withData && (!readBlockData(blockNum, 0, data.get(), meta.size()) ||
+                             !verifyBlock(blockNum, meta, data.get()))) {
+                return false;
+            }
+            DiskExtent extent;
+            extent.blockNum = blockNum;
+            extent.blockOffset = from - blockStart;
+            extent.length = to - from;
+            extent.data = withData ? data.get() + extent.blockOffset : nullptr;
+            extent.checksum = blockChecksums[blockNum];
+            if (!visit(extent)) {
+                return false;
+            }
+        }
+        
+        if (blockEnd >= end) break;
+        
+        blockStart = blockEnd;
+        blockNum = meta.nextBlock;
+        safetyCounter++;
+    }
+    
+    return true;
+}
+
+bool FileManagerDisk::readFileRange(int fileId, size_t offset, size_t length,
+                                    const std::function<bool(const char*, size_t)>& sink) {
+    AlignedBuffer buffer(BLOCK_SIZE - sizeof(BlockMetadata));
+    
+    if (writeBack) writeBack->flushFile(fileId);
+    ReadScope store(*this);
+    if (!storedAsIs(fileId)) {
+        // Only the whole content can be decoded
+        std::unique_ptr<FileEntry> f(readFile(fileId));
+        if (!f || offset > f->content.size()) return false;
+        length = std::min(length, f->content.size() - offset);
+        for (size_t done = 0; done < length; done += buffer.size()) {
+            if (!sink(f->content.data() + offset + done, std::min(buffer.size(), length - done))) return false;
+        }
+        return true;
+    }
+    return walkExtents(fileId, offset, length, true, [&](const DiskExtent& extent) {
+        return sink(extent.data, extent.length);
+    });
 }
 
 bool FileManagerDisk::deleteFile(int fileId) {
-    std::cout << "\n[Disk] ===== Deleting File =====\n";
-    std::cout << "[Disk] File ID: " << fileId << "\n";
-  
-    std::vector<int> blocks = getFileBlocks(fileId);
+    TRACE_SPAN("FileManagerDisk::deleteFile");
+    WriteScope store(*this);
+    generation.fetch_add(1, std::memory_order_release);
+    if (writeBack) writeBack->discard(fileId);
+    cache.invalidate(fileId);
+    clearOwner(fileId);
+    std::vector<BlockMetadata> metas;
+    std::vector<int> blocks = getFileBlocks(fileId, &metas);
     
     if (blocks.empty()) {
-        std::cerr << "[WARNING] No blocks found for file " << fileId << ". Already deleted?\n";
+        LOG_WARN("Disk", "No blocks found, already deleted?", kv("file", fileId));
         btree->remove(fileId); 
         return true;
     }
     
-    std::cout << "[Disk] Found " << blocks.size() << " blocks to delete.\n";
+    std::vector<int> shared;
+    if (!metas.empty() && metas[0].deduped() && !sharedBlocksOf(blocks, metas, shared)) {
+        LOG_WARN("Dedup", "Unreadable list of shared blocks, leaving them allocated", kv("file", fileId));
+    }
     
     for (int blockNum : blocks) {
         freeBlock(blockNum);
     }
+    releaseShared(shared);
     
     btree->remove(fileId);
-    std::cout << "[Disk] Removed from B-tree index.\n";
     
     saveBitmap();
     
-    std::cout << "[Disk] ===== Delete Complete =====\n";
-    std::cout << "[Disk] Freed " << blocks.size() << " blocks.\n";
-    std::cout << "[Disk] Disk usage: " << usedBlocks << "/" << totalBlocks << " blocks\n\n";
+    LOG_DEBUG("Disk", "Deleted file", kv("file", fileId), kv("freed", blocks.size()), kv("used", usedBlocks));
     
     return true;
 }
@@ -454,14 +1781,149 @@ bool FileManagerDisk::updateFile(const FileEntry& f) {
     return saveFile(f);
 }
 
-bool FileManagerDisk::loadAllFiles(FileManager& fm) {
-    std::cout << "\n[Disk] ========== Loading All Files ==========\n";
+bool FileManagerDisk::syncData() {
+    TRACE_SPAN("FileManagerDisk::syncData");
+    if (io->run({IoRequest{IoOp::SYNC, nullptr, 0, 0, 0}})) return true;
+    LOG_ERROR("Disk", "Could not sync the disk file", kv("errno", errno));
+    return false;
+}
+
+bool FileManagerDisk::writeFileRange(const FileEntry& f, size_t offset, size_t length) {
+    TRACE_SPAN("FileManagerDisk::writeFileRange");
+    if (writeBack) return saveFile(f);
+    WriteScope store(*this);
+    generation.fetch_add(1, std::memory_order_release);
+    // The header on disk is not rewritten here, so f may not match it
+    cache.invalidate(f.fileId);
+    std::vector<BlockMetadata> metas;
+    std::vector<int> blocks = getFileBlocks(f.fileId, &metas);
+    
+    if (blocks.empty() || metas.size() != blocks.size()) {
+        LOG_DEBUG("Disk", "No block chain yet, doing a full save", kv("file", f.fileId));
+        return saveFile(f);
+    }
+    if (metas[0].codec() != Codec::NONE || metas[0].deduped()) {
+        LOG_DEBUG("Disk", "Range write to an encoded file, storing it as is", kv("file", f.fileId));
+        return storeFile(f, false);
+    }
     
-    std::vector<int> allFileIds = btree->getAllFileIds();
-    std::cout << "[Disk] Found " << allFileIds.size() << " files in B-tree index.\n";
+    const size_t dataPerBlock = BLOCK_SIZE - sizeof(BlockMetadata);
+    const size_t headerSize = FileManagerDisk::headerSize(f.name.size());
+    
+    size_t oldSize = 0;
+    for (const BlockMetadata& meta : metas) {
+        oldSize += meta.size();
+    }
+    
+    size_t start = headerSize + offset;
+    size_t end = headerSize + offset + length;
+    size_t newSize = headerSize + f.content.size();
+    
+    if (start > oldSize || end > newSize) {
+        LOG_ERROR("Disk", "Range is outside file", kv("file", f.fileId), kv("offset", offset), kv("length", length));
+        return false;
+    }
+    
+    LOG_DEBUG("Disk", "Range write", kv("file", f.fileId), kv("offset", offset), kv("length", length),
+              kv("storedSize", oldSize));
+    
+    // Every block except the last one is full, so a stream position maps
+    // directly to (block index, offset in block).
+    int lastBlock = blocks.back();
+    BlockMetadata lastMeta = metas.back();
+    size_t fill = newSize > oldSize ? std::min(dataPerBlock - lastMeta.size(), newSize - oldSize) : 0;
+    
+    // Bytes that do not fit the last block go to new blocks first, so a
+    // failure there leaves the chain on disk as it was
+    std::vector<int> newBlocks;
+    size_t pos = oldSize + fill;
+    size_t blocksNeeded = newSize > pos ? (newSize - pos + dataPerBlock - 1) / dataPerBlock : 0;
+    for (size_t i = 0; i < blocksNeeded; i++) {
+        int newBlock = allocateBlock((newBlocks.empty() ? lastBlock : newBlocks.back()) + 1);
+        if (newBlock == -1) {
+            LOG_ERROR("Disk", "Disk full, cannot allocate more blocks");
+            for (int b : newBlocks) freeBlock(b);
+            return false;
+        }
+        newBlocks.push_back(newBlock);
+    }
+    
+    std::vector<BlockMetadata> newMetas(newBlocks.size());
+    for (size_t i = 0; i < newBlocks.size(); i++) {
+        newMetas[i].fileId = f.fileId;
+        newMetas[i].blockNumber = blocks.size() + i;
+        newMetas[i].nextBlock = (i + 1 < newBlocks.size()) ? newBlocks[i + 1] : -1;
+        newMetas[i].setSize(std::min(newSize - pos - i * dataPerBlock, dataPerBlock), Codec::NONE);
+    }
+    if (!writeChain(newBlocks, newMetas, std::string(), f.content.data(), pos - headerSize)) {
+        for (int b : newBlocks) freeBlock(b);
+        return false;
+    }
+    
+    // Until the last block links them, nothing else would ever free them
+    auto dropNewBlocks = [&] { for (int b : newBlocks) freeBlock(b); };
+    
+    pos = start;
+    size_t overwriteEnd = std::min(end, oldSize);
+    std::vector<int> changed;
+    if (pos < overwriteEnd) {
+        changed.assign(blocks.begin() + pos / dataPerBlock, blocks.begin() + (overwriteEnd - 1) / dataPerBlock + 1);
+    }
+    if (newSize > oldSize && (changed.empty() || changed.back() != lastBlock)) changed.push_back(lastBlock);
+    if (!clearChecksums(changed)) {
+        dropNewBlocks();
+        return false;
+    }
+    while (pos < overwriteEnd) {
+        size_t idx = pos / dataPerBlock;
+        size_t within = pos % dataPerBlock;
+        size_t chunk = std::min(dataPerBlock - within, overwriteEnd - pos);
+        
+        if (!writeBlockData(blocks[idx], within, f.content.data() + (pos - headerSize), chunk) ||
+            !refreshChecksum(blocks[idx])) {
+            LOG_ERROR("Disk", "Failed to overwrite block", kv("block", blocks[idx]));
+            dropNewBlocks();
+            return false;
+        }
+        LOG_DEBUG("Disk", "Overwrote block", kv("block", blocks[idx]), kv("bytes", chunk));
+        pos += chunk;
+    }
+    
+    if (newSize <= oldSize) {
+        return true;
+    }
+    
+    if (fill > 0) {
+        if (!writeBlockData(lastBlock, lastMeta.size(), f.content.data() + (oldSize - headerSize), fill)) {
+            LOG_ERROR("Disk", "Failed to extend block", kv("block", lastBlock));
+            dropNewBlocks();
+            return false;
+        }
+        lastMeta.setSize(lastMeta.size() + fill, Codec::NONE);
+    }
+    if (!newBlocks.empty()) {
+        lastMeta.nextBlock = newBlocks[0];
+    }
+    if (!writeBlockMeta(lastBlock, lastMeta) || !refreshChecksum(lastBlock)) {
+        LOG_ERROR("Disk", "Failed to update block metadata", kv("block", lastBlock));
+        dropNewBlocks();
+        return false;
+    }
+    
+    if (!newBlocks.empty()) {
+        saveBitmap();
+    }
+    
+    LOG_DEBUG("Disk", "Range write complete", kv("file", f.fileId), kv("blocks", blocks.size() + newBlocks.size()));
+    return true;
+}
+
+bool FileManagerDisk::loadAllFiles(FileManager& fm) {
+    std::vector<int> allFileIds = getAllFileIds();
+    LOG_INFO("Disk", "Loading all files", kv("indexed", allFileIds.size()));
     
     if (allFileIds.empty()) {
-        std::cout << "[Disk] No files to load. Starting with empty file system.\n";
+        LOG_INFO("Disk", "No files to load, starting with empty file system");
         return true;
     }
     
@@ -473,7 +1935,7 @@ bool FileManagerDisk::loadAllFiles(FileManager& fm) {
         FileEntry* f = loadFile(fileId);
         
         if (!f) {
-            std::cerr << "[ERROR] Failed to load file ID " << fileId << "\n";
+            LOG_ERROR("Disk", "Failed to load file", kv("file", fileId));
             failCount++;
             continue;
         }
@@ -493,23 +1955,42 @@ bool FileManagerDisk::loadAllFiles(FileManager& fm) {
         )) {
             successCount++;
         } else {
-            std::cerr << "[WARNING] Failed to restore file ID " << fileId << " to FileManager.\n";
+            LOG_WARN("Disk", "Failed to restore file to FileManager", kv("file", fileId));
             failCount++;
         }
 
         delete f;
     }
 
-    std::cout << "[Disk] ========== Load Complete ==========\n";
-    std::cout << "[Disk] Successfully loaded: " << successCount << " files\n";
-    if (failCount > 0) {
-        std::cout << "[Disk] Failed to load: " << failCount << " files\n";
-    }
-    std::cout << "\n";
+    LOG_INFO("Disk", "Load complete", kv("loaded", successCount), kv("failed", failCount));
     
     return true;
 }
 
+FileCache& FileManagerDisk::getCache() {
+    return cache;
+}
+
+void FileManagerDisk::setWriteBack(WriteBackBuffer* buffer) {
+    writeBack = buffer;
+}
+
+void FileManagerDisk::setCompression(bool enabled) {
+    compression = enabled;
+}
+
+void FileManagerDisk::setDeduplication(bool enabled) {
+    dedup = enabled;
+}
+
+// From the first block of the stored file; caller holds the store
+bool FileManagerDisk::storedAsIs(int fileId) {
+    int blockNum;
+    BlockMetadata meta;
+    if (!findFirstBlock(fileId, blockNum) || !readBlockMeta(blockNum, meta)) return true;
+    return meta.codec() == Codec::NONE && !meta.deduped();
+}
+
 int FileManagerDisk::getUsedBlocks() const { 
     return usedBlocks; 
 }
@@ -517,3 +1998,9 @@ int FileManagerDisk::getUsedBlocks() const {
 int FileManagerDisk::getFreeBlocks() const { 
     return totalBlocks - usedBlocks; 
 }
+
+void FileManagerDisk::getDedupStats(int& blocks, long& references) {
+    ReadScope store(*this);
+    blocks = sharedBlocks.size();
+    references = sharedReferences;
+}
@@ -4,64 +4,291 @@
 
 #include <string>
 #include <vector>
-#include <fstream>
+#include <atomic>
+#include <condition_variable>
 #include <ctime>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
 #include "FileEntry.hpp"
 #include "FileManager.hpp"
 #include "BTree.hpp"
+#include "BlockIO.hpp"
+#include "Compression.hpp"
+#include "FileCache.hpp"
+#include "RequestExecutor.hpp"
 
 const long DISK_SIZE = 2L * 1024 * 1024 * 1024; 
 const int BLOCK_SIZE = 50 * 1024;               
 const int TOTAL_BLOCKS = DISK_SIZE / BLOCK_SIZE;
+const int FILE_ID_LEASE = 64;                   // IDs reserved per counter write
+const int IO_POOL_THREADS = 8;                  // concurrent reads at startup and login
+const size_t OWNER_INDEX_CHUNK = 1024;          // headers read per shared hold of the store at startup
+
+const int BLOCK_CODEC_SHIFT = 24;               // dataSize keeps the codec in bits 24-27
+const int BLOCK_CODEC_MASK = 0xf;
+const int BLOCK_DEDUPED = 1 << 28;              // and this flag above it
+const int SHARED_BLOCK_FILE_ID = -2;            // fileId in the metadata of a shared block
 
 struct BlockMetadata {
     int fileId;
     int blockNumber;
     int nextBlock;
     int dataSize;
+    
+    // Bytes of the stream stored in this block
+    int size() const { return dataSize & ((1 << BLOCK_CODEC_SHIFT) - 1); }
+    // How the content of the whole chain is stored; the header never is compressed
+    Codec codec() const { return (Codec)((dataSize >> BLOCK_CODEC_SHIFT) & BLOCK_CODEC_MASK); }
+    // Whether the chain holds, after the header, a list of the shared blocks
+    // with the content's full blocks and then the rest of the content
+    bool deduped() const { return (dataSize & BLOCK_DEDUPED) != 0; }
+    void setSize(int size, Codec codec, bool deduped = false) {
+        dataSize = size | ((int)codec << BLOCK_CODEC_SHIFT) | (deduped ? BLOCK_DEDUPED : 0);
+    }
+};
+
+// A contiguous run of file content inside disk.bin
+struct DiskExtent {
+    int blockNum;
+    int blockOffset;      // offset inside the block's data area
+    size_t length;
+    const char* data;     // the bytes themselves, checksum-verified, while visit runs; null in a snapshot
+    uint32_t checksum;    // the block's checksum when it was walked, 0 if it has none
+};
+
+// Where a range of a file's content lay at one moment, taken by
+// snapshotExtents, so it can be read back later without holding the store
+struct ExtentSnapshot {
+    int fileId = -1;
+    uint64_t generation = 0;
+    std::vector<DiskExtent> extents;   // data is null; read each with readExtent
 };
 
 class FileManager;
+class WriteBackBuffer;
 
+// Thread-safe: loads and range reads run concurrently under a shared hold
+// on the store, while writes and batches hold it exclusively. Concurrent
+// loads of one file that miss the cache share a single disk read.
 class FileManagerDisk {
 private:
     std::string diskFilePath;
-    std::fstream diskFile;
+    int diskFd;
+    bool direct;
+    size_t directAlignment;    // offsets and lengths of direct requests are multiples of this
+    BlockIO* io;
     int totalBlocks;
     int usedBlocks;
     std::vector<bool> blockBitmap;
     BTree* btree;
+    int batchDepth;
+    bool bitmapDirty;
+    int nextLeaseId;      // first ID not yet handed out in a lease
+    uint64_t instance;    // unique per store, so a thread's lease is never
+                          // taken for one of a store at the same address
+    std::mutex idMutex;
+    FileCache cache;
+    WriteBackBuffer* writeBack;
+    bool compression;
+    bool dedup;
+    
+    std::shared_mutex storeMutex;
+    std::atomic<std::thread::id> batchOwner;   // thread holding storeMutex exclusively
+    std::mutex indexMutex;                     // BTree reads are not thread-safe
+    std::atomic<uint64_t> generation;          // bumped by every write
+    
+    typedef std::shared_future<std::shared_ptr<const FileEntry>> PendingLoad;
+    std::mutex flightMutex;
+    std::unordered_map<int, PendingLoad> inFlight;
+    
+    RequestExecutor ioPool;
+    
+    // The user of every stored or staged file, so a login reads only its
+    // own files. Built from disk.bin in the background at startup.
+    std::mutex ownerMutex;
+    std::condition_variable ownersBuilt;
+    bool ownersReady;
+    std::unordered_map<int, int> ownerOf;
+    std::unordered_map<int, std::set<int>> filesOf;
+    std::thread ownerIndexer;
+    
+    // Freed blocks waiting for their space to be given back to the file
+    // system, in the background, so a delete only updates the bitmap
+    std::mutex reclaimMutex;
+    std::condition_variable reclaimWake;
+    std::set<int> pendingReclaim;
+    bool reclaimStopping;
+    bool punchSupported;
+    std::thread reclaimer;
+    
+    // Blocks holding one full block of content each, shared by every file
+    // whose content has that block at a block boundary. Found by the
+    // fingerprint of their bytes, counted by reference, kept in dedup.dat.
+    struct SharedBlock {
+        uint64_t fingerprint;
+        int references;
+    };
+    std::unordered_map<int, SharedBlock> sharedBlocks;
+    std::unordered_map<uint64_t, int> fingerprints;   // to the first block stored with it
+    long sharedReferences;
+    bool dedupDirty;
+    
+    // CRC-32C of each block's metadata and data, as of its last write; 0 for
+    // a free block or one last written before checksums were kept. Mirrored
+    // in checksums.dat, four bytes per block, where only changed entries are
+    // rewritten when a batch commits; a block's entry is cleared there before
+    // the block itself is rewritten.
+    int checksumFd;
+    std::vector<uint32_t> blockChecksums;
+    std::vector<int> checksumsChanged;
+    
+    // Shared hold on the store, unless this thread is already inside a batch
+    class ReadScope {
+    private:
+        std::shared_lock<std::shared_mutex> lock;
+    public:
+        explicit ReadScope(FileManagerDisk& disk);
+    };
+    // Every write runs as a batch of its own, if not already inside one
+    class WriteScope {
+    private:
+        FileManagerDisk& disk;
+    public:
+        explicit WriteScope(FileManagerDisk& disk) : disk(disk) { disk.beginBatch(); }
+        ~WriteScope() { disk.commitBatch(); }
+    };
     
     bool initializeDisk();
+    void openDirect();
+    bool readBytes(char* data, size_t size, off_t offset);
+    bool writeBytes(const char* data, size_t size, off_t offset);
+    bool runBatch(const std::vector<IoRequest>& batch);
+    void loadIdCounter();
+    bool saveIdCounter();
     void saveBitmap();
     void loadBitmap();
-    int allocateBlock();
+    void loadDedupIndex();
+    void saveDedupIndex();
+    void loadChecksums();
+    bool saveChecksums();
+    bool clearChecksums(const std::vector<int>& blocks);
+    void setChecksum(int blockNum, uint32_t checksum);
+    bool verifyBlock(int blockNum, const BlockMetadata& meta, const char* data);
+    bool refreshChecksum(int blockNum);
+    bool ownsBatch() const;
+    void buildOwnerIndex();
+    void setOwner(int fileId, int userId);
+    void clearOwner(int fileId);
+    void prefetchFiles(const std::vector<int>& fileIds);
+    void adviseBlocks(std::vector<int> blocks);
+    void runParallel(size_t count, const std::function<void(size_t)>& task);
+    bool findFirstBlock(int fileId, int& firstBlock);
+    FileEntry* readFile(int fileId);
+    bool storeFile(const FileEntry& f, bool encode = true);
+    bool storedAsIs(int fileId);
+    bool readChain(const std::vector<int>& blocks, const std::vector<BlockMetadata>& metas, std::string& stream);
+    bool sharedBlocksOf(const std::vector<int>& blocks, const std::vector<BlockMetadata>& metas,
+                        std::vector<int>& shared);
+    bool readDeduped(const char* list, size_t size, std::string& body);
+    bool acquireShared(const char* body, const std::vector<uint64_t>& prints, std::vector<int>& shared);
+    void releaseShared(const std::vector<int>& shared);
+    bool walkExtents(int fileId, size_t offset, size_t length, bool withData,
+                     const std::function<bool(const DiskExtent&)>& visit);
+    int allocateBlock(int hint = 0);
     void freeBlock(int blockNum);
-    bool writeBlock(int blockNum, const BlockMetadata& meta, const char* data, int dataSize);
-    bool readBlock(int blockNum, BlockMetadata& meta, char* data);
-    std::vector<int> getFileBlocks(int fileId);
+    void reclaimBlocks();
+    void punchRuns(const std::set<int>& blocks);
+    bool writeChain(const std::vector<int>& blocks, const std::vector<BlockMetadata>& metas,
+                    const std::string& head, const char* body, size_t pos);
+    bool readBlockMeta(int blockNum, BlockMetadata& meta);
+    bool writeBlockMeta(int blockNum, const BlockMetadata& meta);
+    bool writeBlockData(int blockNum, int offset, const char* data, int dataSize);
+    bool readBlockData(int blockNum, int offset, char* data, int dataSize);
+    std::vector<int> getFileBlocks(int fileId, std::vector<BlockMetadata>* metas = nullptr);
+    static std::string serializeHeader(const FileEntry& f);
+    static bool parseFile(const std::string& data, FileEntry& f);
+    
+    friend class WriteBackBuffer;
+    static size_t headerSize(size_t nameLen);
+    static bool contentStart(const std::string& stream, size_t& start);
 
 public:
-    FileManagerDisk(const std::string& diskPath);
+    // With directIo, disk.bin is read and written with O_DIRECT through
+    // pooled aligned buffers, so file data is cached once, in the FileCache,
+    // rather than again in the page cache. Falls back to buffered I/O if
+    // the file system does not support it at an alignment dividing BLOCK_SIZE.
+    FileManagerDisk(const std::string& diskPath, IoBackend ioBackend = IoBackend::AUTO, bool directIo = false);
     ~FileManagerDisk();
     
+    // Writes between beginBatch() and commitBatch() skip their per-write
+    // index flushes and bitmap saves; commitBatch() does both once. The
+    // calling thread holds the store exclusively throughout. Batches nest.
+    void beginBatch();
+    void commitBatch();
+    
+    // Returns an ID no other file has had, or -1 if the counter can't be
+    // persisted. Each thread takes FILE_ID_LEASE IDs per counter write, so
+    // IDs are unique across threads and restarts but not gap-free.
+    int allocateFileId();
+    
+    // Goes to the write-back buffer when one is attached
     bool saveFile(const FileEntry& f);
+    // Served from the cache when possible; a miss already being read by
+    // another thread waits for that read instead of starting its own
     FileEntry* loadFile(int fileId);
+    // Every stored file belonging to userId. Their blocks are prefetched and
+    // the files loaded in parallel on the I/O pool.
+    std::vector<FileEntry> loadFilesOwnedBy(int userId);
     bool deleteFile(int fileId);
     bool updateFile(const FileEntry& f);
+    // fdatasync()s disk.bin, after every block write already done
+    bool syncData();
+    // Writes f.content[offset, offset + length) in place; bytes past the old end
+    // fill the last block and then go to newly allocated blocks. With a
+    // write-back buffer attached, f is staged whole instead. A compressed or
+    // deduplicated file is rewritten whole, as is, so later range writes are cheap.
+    bool writeFileRange(const FileEntry& f, size_t offset, size_t length);
     bool loadAllFiles(FileManager& fm);
+    // Records, from block metadata alone, where content[offset, offset + length)
+    // lies, one extent per block, along with each block's checksum. Fails for
+    // a compressed or deduplicated file, whose content is not in the chain as is.
+    bool snapshotExtents(int fileId, size_t offset, size_t length, ExtentSnapshot& snapshot);
+    // Reads one extent of a snapshot into bytes, verified, under its own
+    // short hold of the store. Fails if the block has been rewritten since
+    // the snapshot, or, for a block without a checksum, if anything has.
+    bool readExtent(const ExtentSnapshot& snapshot, const DiskExtent& extent, std::string& bytes);
+    // Walks the chain lazily and hands content[offset, offset + length) to sink
+    // one block at a time. Stops early if sink returns false.
+    bool readFileRange(int fileId, size_t offset, size_t length,
+                       const std::function<bool(const char*, size_t)>& sink);
     
+    // Recently loaded and saved files, shared by all sessions
+    FileCache& getCache();
+    // Attach a started buffer before serving and detach it before stopping it
+    void setWriteBack(WriteBackBuffer* buffer);
+    // Whether saves compress content that shrinks enough; set before serving.
+    // Compressed files are read back either way.
+    void setCompression(bool enabled);
+    // Whether saves share the full blocks of content with files holding the
+    // same bytes at the same block boundary; set before serving. Shared
+    // blocks are read back and released either way.
+    void setDeduplication(bool enabled);
     int getUsedBlocks() const;
     int getFreeBlocks() const;
+    // Shared blocks in use and the references files hold to them
+    void getDedupStats(int& blocks, long& references);
     void printDiskStats() const;
+    // Changes whenever a write completes, so a caller can tell whether
+    // something it read without holding the store is still current
+    uint64_t getGeneration() const;
     
-
-    std::vector<int> getAllFileIds() {
-        if (btree) {
-            return btree->getAllFileIds();
-        }
-        return std::vector<int>();
-    }
+    std::vector<int> getAllFileIds();
 };
 
 #endif
@@ -131,6 +131,26 @@ public:
         return true;
     }
     
+    // Grows on rehash, which moves every item
+    int getCapacity() const { return capacity; }
+
+    // Calls fn on each stored item in place
+    template <typename F>
+    void forEach(F fn) {
+        for (auto &entry : table) {
+            if (entry.inUse) fn(entry);
+        }
+    }
+    
+    // First stored item match accepts, in place, or nullptr
+    template <typename F>
+    T* findIf(F match) {
+        for (auto &entry : table) {
+            if (entry.inUse && match(entry)) return &entry;
+        }
+        return nullptr;
+    }
+    
     std::vector<T> getAll() const {
         std::vector<T> all;
         for (const auto &entry : table) {
@@ -0,0 +1,267 @@
+#include "Logger.hpp"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Single-producer single-consumer ring. The owning thread advances head, the
+// writer thread advances tail; each index is only written by one side.
+struct LogRing {
+    LogRecord slots[LOG_RING_SLOTS];
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> retired{false};   // owning thread has exited
+};
+
+namespace {
+
+using Clock = std::chrono::system_clock;
+
+const auto WRITER_IDLE = std::chrono::milliseconds(2);
+
+class LogWriter {
+private:
+    std::mutex ringsMutex;   // guards the ring list, taken once per thread and per drain
+    std::vector<std::shared_ptr<LogRing>> rings;
+    std::thread writer;
+    std::mutex stateMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    uint64_t reportedDrops = 0;
+
+    std::vector<LogRecord*> batch;
+    std::string out;
+    std::string errOut;
+
+    static void formatTime(uint64_t ns, std::string& out) {
+        time_t seconds = ns / 1000000000ull;
+        struct tm parts;
+        localtime_r(&seconds, &parts);
+        char text[40];
+        size_t n = strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &parts);
+        n += snprintf(text + n, sizeof(text) - n, ".%06llu ", (unsigned long long)(ns / 1000 % 1000000));
+        out.append(text, n);
+    }
+
+    static const char* levelName(LogLevel level) {
+        switch (level) {
+        case LogLevel::DEBUG: return "DEBUG ";
+        case LogLevel::INFO:  return "INFO  ";
+        case LogLevel::WARN:  return "WARN  ";
+        default:              return "ERROR ";
+        }
+    }
+
+    // Writes out every published record, oldest first. Returns false if
+    // there was nothing to write.
+    bool drain() {
+        std::vector<std::shared_ptr<LogRing>> current;
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            current = rings;
+        }
+
+        batch.clear();
+        std::vector<uint32_t> ends(current.size());
+        uint64_t drops = 0;
+        for (size_t i = 0; i < current.size(); i++) {
+            LogRing& ring = *current[i];
+            uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+            ends[i] = ring.head.load(std::memory_order_acquire);
+            for (uint32_t at = tail; at != ends[i]; at++) {
+                batch.push_back(&ring.slots[at % LOG_RING_SLOTS]);
+            }
+            drops += ring.dropped.load(std::memory_order_relaxed);
+        }
+
+        std::stable_sort(batch.begin(), batch.end(), [](const LogRecord* a, const LogRecord* b) {
+            return a->timestamp < b->timestamp;
+        });
+
+        out.clear();
+        errOut.clear();
+        for (const LogRecord* record : batch) {
+            std::string& target = record->level >= LogLevel::WARN ? errOut : out;
+            formatTime(record->timestamp, target);
+            target += levelName(record->level);
+            target.append(record->text, record->length);
+            target += '\n';
+        }
+        if (drops > reportedDrops) {
+            errOut += "[Logger] Dropped " + std::to_string(drops - reportedDrops) + " records (ring full)\n";
+            reportedDrops = drops;
+        }
+        if (!out.empty()) {
+            fwrite(out.data(), 1, out.size(), stdout);
+            fflush(stdout);
+        }
+        if (!errOut.empty()) {
+            fwrite(errOut.data(), 1, errOut.size(), stderr);
+            fflush(stderr);
+        }
+
+        // Slots go back to their producers only after they were written
+        for (size_t i = 0; i < current.size(); i++) {
+            current[i]->tail.store(ends[i], std::memory_order_release);
+        }
+
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        rings.erase(std::remove_if(rings.begin(), rings.end(), [](const std::shared_ptr<LogRing>& ring) {
+            return ring->retired.load(std::memory_order_acquire) &&
+                   ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire);
+        }), rings.end());
+        return !batch.empty();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        while (!stopping) {
+            lock.unlock();
+            bool wrote = drain();
+            lock.lock();
+            if (!wrote) wake.wait_for(lock, WRITER_IDLE);
+        }
+        lock.unlock();
+        drain();
+    }
+
+public:
+    void start() {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (writer.joinable()) return;
+        stopping = false;
+        writer = std::thread(&LogWriter::run, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (!writer.joinable()) return;
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+        writer = std::thread();
+    }
+
+    ~LogWriter() { stop(); }
+
+    void attach(const std::shared_ptr<LogRing>& ring) {
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            rings.push_back(ring);
+        }
+        start();
+    }
+};
+
+LogWriter& logWriter() {
+    static LogWriter instance;
+    return instance;
+}
+
+// Registers the thread's ring on first use and retires it at thread exit;
+// the writer keeps it alive until its last records are written
+struct ThreadRing {
+    std::shared_ptr<LogRing> ring;
+    uint32_t claimed = 0;
+
+    LogRing& get() {
+        if (!ring) {
+            ring = std::make_shared<LogRing>();
+            logWriter().attach(ring);
+        }
+        return *ring;
+    }
+
+    ~ThreadRing() {
+        if (ring) ring->retired.store(true, std::memory_order_release);
+    }
+};
+
+thread_local ThreadRing threadRing;
+
+}
+
+void LogFormatter::append(std::string_view text) {
+    size_t n = std::min(text.size(), capacity - used);
+    std::copy(text.data(), text.data() + n, out + used);
+    used += n;
+}
+
+void LogFormatter::append(long value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    append(std::string_view(digits, result.ptr - digits));
+}
+
+void LogFormatter::append(double value) {
+    char digits[32];
+    int n = snprintf(digits, sizeof(digits), "%g", value);
+    append(std::string_view(digits, n > 0 ? n : 0));
+}
+
+void LogFormatter::append(const LogField& field) {
+    append(" ");
+    append(field.key);
+    append("=");
+    switch (field.kind) {
+    case LogField::TEXT:
+        append(field.text);
+        break;
+    case LogField::INT:
+        append(field.number);
+        break;
+    case LogField::FLOAT:
+        append(field.real);
+        break;
+    case LogField::PAYLOAD:
+        append("<");
+        append(field.number);
+        append(" bytes>");
+        break;
+    }
+}
+
+std::atomic<uint8_t>& Logger::runtimeLevel() {
+    static std::atomic<uint8_t> level{(uint8_t)LogLevel::INFO};
+    return level;
+}
+
+bool Logger::parseLevel(std::string_view name, LogLevel& level) {
+    if (name == "debug") level = LogLevel::DEBUG;
+    else if (name == "info") level = LogLevel::INFO;
+    else if (name == "warn") level = LogLevel::WARN;
+    else if (name == "error") level = LogLevel::ERROR;
+    else return false;
+    return true;
+}
+
+LogRecord* Logger::claim() {
+    LogRing& ring = threadRing.get();
+    uint32_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= LOG_RING_SLOTS) {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    threadRing.claimed = head;
+    LogRecord* record = &ring.slots[head % LOG_RING_SLOTS];
+    record->timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now().time_since_epoch()).count();
+    return record;
+}
+
+void Logger::publish() {
+    threadRing.ring->head.store(threadRing.claimed + 1, std::memory_order_release);
+}
+
+void Logger::shutdown() {
+    logWriter().stop();
+}
@@ -0,0 +1,152 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Asynchronous structured logging. A log call formats one fixed-size record
+// into the calling thread's ring buffer and returns; a background thread
+// drains all rings and writes them out. Producers never take a lock or wait:
+// when a ring is full the record is dropped and counted.
+//
+//   LOG_DEBUG("Disk", "Allocated block", kv("block", i), kv("used", usedBlocks));
+//   LOG_INFO("SERVER", "Received", kv("op", name), payload("content", content));
+//
+// prints
+//
+//   2026-01-01 12:00:00.000123 DEBUG [Disk] Allocated block block=7 used=8
+//   2026-01-01 12:00:00.000150 INFO  [SERVER] Received op=WRITE_FILE content=<5120 bytes>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+
+// Calls below this level are compiled out, arguments included
+#ifndef LOG_COMPILE_LEVEL
+#ifdef NDEBUG
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+enum class LogLevel : uint8_t {
+    DEBUG = LOG_LEVEL_DEBUG,
+    INFO = LOG_LEVEL_INFO,
+    WARN = LOG_LEVEL_WARN,
+    ERROR = LOG_LEVEL_ERROR
+};
+
+const size_t LOG_RECORD_TEXT = 232;    // longer lines are truncated
+const uint32_t LOG_RING_SLOTS = 512;   // records per thread
+
+struct LogRecord {
+    uint64_t timestamp;   // ns since the epoch
+    LogLevel level;
+    uint16_t length;
+    char text[LOG_RECORD_TEXT];
+};
+
+// A key=value pair. Payload fields print only their size, so file contents
+// never reach the log.
+struct LogField {
+    enum Kind : uint8_t { TEXT, INT, FLOAT, PAYLOAD };
+
+    std::string_view key;
+    Kind kind;
+    std::string_view text;
+    long number;
+    double real;
+};
+
+inline LogField kv(std::string_view key, std::string_view value) { return {key, LogField::TEXT, value, 0, 0}; }
+inline LogField kv(std::string_view key, const std::string& value) { return {key, LogField::TEXT, value, 0, 0}; }
+inline LogField kv(std::string_view key, const char* value) { return {key, LogField::TEXT, value, 0, 0}; }
+inline LogField kv(std::string_view key, long value) { return {key, LogField::INT, {}, value, 0}; }
+inline LogField kv(std::string_view key, int value) { return {key, LogField::INT, {}, value, 0}; }
+inline LogField kv(std::string_view key, unsigned value) { return {key, LogField::INT, {}, (long)value, 0}; }
+inline LogField kv(std::string_view key, unsigned long value) { return {key, LogField::INT, {}, (long)value, 0}; }
+inline LogField kv(std::string_view key, bool value) { return {key, LogField::TEXT, value ? "true" : "false", 0, 0}; }
+inline LogField kv(std::string_view key, double value) { return {key, LogField::FLOAT, {}, 0, value}; }
+inline LogField kv(std::string_view key, float value) { return {key, LogField::FLOAT, {}, 0, value}; }
+inline LogField payload(std::string_view key, std::string_view value) { return {key, LogField::PAYLOAD, {}, (long)value.size(), 0}; }
+
+// Formats into a record's text buffer, silently truncating at the end
+class LogFormatter {
+private:
+    char* out;
+    size_t capacity;
+    size_t used;
+
+public:
+    LogFormatter(char* buffer, size_t size) : out(buffer), capacity(size), used(0) {}
+
+    void append(std::string_view text);
+    void append(long value);
+    void append(double value);
+    void append(const LogField& field);
+    size_t length() const { return used; }
+};
+
+class Logger {
+public:
+    static void setLevel(LogLevel level) { runtimeLevel().store((uint8_t)level, std::memory_order_relaxed); }
+    static bool enabled(LogLevel level) {
+        return (uint8_t)level >= runtimeLevel().load(std::memory_order_relaxed);
+    }
+    static bool parseLevel(std::string_view name, LogLevel& level);
+
+    template <typename... Fields>
+    static void write(LogLevel level, std::string_view component, std::string_view message, const Fields&... fields) {
+        LogRecord* record = claim();
+        if (!record) return;
+        record->level = level;
+        LogFormatter format(record->text, LOG_RECORD_TEXT);
+        format.append("[");
+        format.append(component);
+        format.append("] ");
+        format.append(message);
+        (format.append(fields), ...);
+        record->length = format.length();
+        publish();
+    }
+
+    // Writes out everything logged so far and stops the writer thread.
+    // Call once, at the end of main; later records are not written.
+    static void shutdown();
+
+private:
+    static std::atomic<uint8_t>& runtimeLevel();
+    static LogRecord* claim();
+    static void publish();
+};
+
+#define LOG_AT(level, component, ...) \
+    do { \
+        if (Logger::enabled(level)) Logger::write(level, component, __VA_ARGS__); \
+    } while (0)
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(component, ...) LOG_AT(LogLevel::DEBUG, component, __VA_ARGS__)
+#else
+#define LOG_DEBUG(component, ...) do {} while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(component, ...) LOG_AT(LogLevel::INFO, component, __VA_ARGS__)
+#else
+#define LOG_INFO(component, ...) do {} while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(component, ...) LOG_AT(LogLevel::WARN, component, __VA_ARGS__)
+#else
+#define LOG_WARN(component, ...) do {} while (0)
+#endif
+
+#define LOG_ERROR(component, ...) LOG_AT(LogLevel::ERROR, component, __VA_ARGS__)
+
+#endif // LOGGER_HPP
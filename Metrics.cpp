@@ -0,0 +1,196 @@
+#include "Metrics.hpp"
+#include "BinaryProtocol.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+// Shards outlive their threads so their counts stay in the totals
+static std::mutex shardsMutex;
+static std::vector<MetricsShard*> shards;
+
+static const char* const COUNTER_NAMES[] = {
+    "requests",
+    "disk_lock_acquires",
+    "disk_lock_wait_ns",
+    "bytes_read",
+    "bytes_written",
+    "blocks_allocated",
+    "blocks_freed",
+    "btree_nodes_read",
+    "btree_nodes_written",
+    "expiry_sweeps",
+    "files_expired",
+    "cache_hits",
+    "cache_misses",
+    "cache_evictions",
+    "cache_invalidations",
+    "loads_coalesced",
+    "writeback_staged",
+    "writeback_coalesced",
+    "writeback_flushed",
+    "writeback_failed",
+    "writeback_stuck",
+    "blocks_prefetched",
+    "io_batches",
+    "io_requests",
+    "aligned_buffers_allocated",
+    "blocks_reclaimed",
+    "files_compressed",
+    "compression_skipped",
+    "compression_bytes_in",
+    "compression_bytes_out",
+    "bytes_decompressed",
+    "dedup_blocks_shared",
+    "dedup_blocks_stored",
+    "blocks_verified",
+    "checksum_failures",
+};
+static_assert(sizeof(COUNTER_NAMES) / sizeof(COUNTER_NAMES[0]) == (size_t)Counter::COUNT,
+              "every Counter needs a name");
+
+// Prometheus histogram boundaries, a factor of four apart from 1 us to 17 s
+static const int PROM_FIRST_EXPONENT = 10;
+static const int PROM_LAST_EXPONENT = 34;
+static const int PROM_EXPONENT_STEP = 2;
+
+MetricsShard* Metrics::registerShard() {
+    MetricsShard* shard = new MetricsShard();
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    shards.push_back(shard);
+    return shard;
+}
+
+uint64_t Metrics::bucketUpperBound(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) return bucket;
+    int exponent = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    uint64_t width = 1ull << (exponent - HISTOGRAM_SUB_BITS);
+    return ((HISTOGRAM_SUB_BUCKETS + sub) << (exponent - HISTOGRAM_SUB_BITS)) + width - 1;
+}
+
+uint64_t Metrics::total(Counter counter) {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    uint64_t sum = 0;
+    for (MetricsShard* shard : shards) {
+        sum += shard->counters[(int)counter].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+LatencySnapshot Metrics::latency(int op) {
+    LatencySnapshot snapshot;
+    if (op < 0 || op >= MAX_TIMED_OPS) return snapshot;
+
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    for (MetricsShard* shard : shards) {
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            uint64_t n = shard->buckets[op][b].load(std::memory_order_relaxed);
+            snapshot.buckets[b] += n;
+            snapshot.count += n;
+        }
+        snapshot.sumNs += shard->sumNs[op].load(std::memory_order_relaxed);
+        uint64_t max = shard->maxNs[op].load(std::memory_order_relaxed);
+        if (max > snapshot.maxNs) snapshot.maxNs = max;
+    }
+    return snapshot;
+}
+
+uint64_t LatencySnapshot::percentile(double q) const {
+    if (count == 0) return 0;
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * count));
+    uint64_t seen = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen >= rank) return std::min(Metrics::bucketUpperBound(b), maxNs);
+    }
+    return maxNs;
+}
+
+void LatencySnapshot::add(uint64_t ns) {
+    buckets[Metrics::bucketFor(ns)]++;
+    count++;
+    sumNs += ns;
+    maxNs = std::max(maxNs, ns);
+}
+
+void LatencySnapshot::merge(const LatencySnapshot& other) {
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) buckets[b] += other.buckets[b];
+    count += other.count;
+    sumNs += other.sumNs;
+    maxNs = std::max(maxNs, other.maxNs);
+}
+
+const char* Metrics::counterName(Counter counter) {
+    return COUNTER_NAMES[(int)counter];
+}
+
+static std::string formatMicros(uint64_t ns) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.1f", ns / 1000.0);
+    return text;
+}
+
+static std::string formatSeconds(double seconds) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.9g", seconds);
+    return text;
+}
+
+std::string Metrics::renderText() {
+    std::string out;
+    for (int c = 0; c < (int)Counter::COUNT; c++) {
+        out += "counter ";
+        out += COUNTER_NAMES[c];
+        out += " " + std::to_string(total((Counter)c)) + "\n";
+    }
+    for (int op = 0; op < MAX_TIMED_OPS; op++) {
+        LatencySnapshot s = latency(op);
+        if (s.count == 0) continue;
+        out += "latency ";
+        out += opcodeName((Opcode)op);
+        out += " count=" + std::to_string(s.count);
+        out += " mean_us=" + formatMicros(s.sumNs / s.count);
+        out += " p50_us=" + formatMicros(s.percentile(0.50));
+        out += " p99_us=" + formatMicros(s.percentile(0.99));
+        out += " p999_us=" + formatMicros(s.percentile(0.999));
+        out += " max_us=" + formatMicros(s.maxNs) + "\n";
+    }
+    return out;
+}
+
+std::string Metrics::renderPrometheus() {
+    std::string out;
+    for (int c = 0; c < (int)Counter::COUNT; c++) {
+        std::string name = COUNTER_NAMES[c];
+        uint64_t value = total((Counter)c);
+        bool nanos = name.size() > 3 && name.compare(name.size() - 3, 3, "_ns") == 0;
+        if (nanos) name = name.substr(0, name.size() - 3) + "_seconds";
+        name = "fms_" + name + "_total";
+
+        out += "# TYPE " + name + " counter\n";
+        out += name + " " + (nanos ? formatSeconds(value / 1e9) : std::to_string(value)) + "\n";
+    }
+
+    out += "# TYPE fms_request_duration_seconds histogram\n";
+    for (int op = 0; op < MAX_TIMED_OPS; op++) {
+        LatencySnapshot s = latency(op);
+        if (s.count == 0) continue;
+        std::string label = "op=\"" + std::string(opcodeName((Opcode)op)) + "\"";
+
+        // Bucket boundaries at powers of two line up with histogram buckets
+        uint64_t cumulative = 0;
+        int b = 0;
+        for (int e = PROM_FIRST_EXPONENT; e <= PROM_LAST_EXPONENT; e += PROM_EXPONENT_STEP) {
+            uint64_t limit = (1ull << e) - 1;
+            while (b < HISTOGRAM_BUCKETS && bucketUpperBound(b) <= limit) cumulative += s.buckets[b++];
+            out += "fms_request_duration_seconds_bucket{" + label + ",le=\"" +
+                   formatSeconds((limit + 1) / 1e9) + "\"} " + std::to_string(cumulative) + "\n";
+        }
+        out += "fms_request_duration_seconds_bucket{" + label + ",le=\"+Inf\"} " + std::to_string(s.count) + "\n";
+        out += "fms_request_duration_seconds_sum{" + label + "} " + formatSeconds(s.sumNs / 1e9) + "\n";
+        out += "fms_request_duration_seconds_count{" + label + "} " + std::to_string(s.count) + "\n";
+    }
+    return out;
+}
@@ -0,0 +1,142 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Process-wide counters and per-command latency histograms. Every thread
+// records into its own shard with plain relaxed loads and stores, so a
+// recording costs a few nanoseconds and never contends; readers sum the
+// shards when STATS asks for a snapshot.
+
+enum class Counter : int {
+    REQUESTS,
+    DISK_LOCK_ACQUIRES,
+    DISK_LOCK_WAIT_NS,
+    BYTES_READ,
+    BYTES_WRITTEN,
+    BLOCKS_ALLOCATED,
+    BLOCKS_FREED,
+    BTREE_NODES_READ,
+    BTREE_NODES_WRITTEN,
+    EXPIRY_SWEEPS,
+    FILES_EXPIRED,
+    CACHE_HITS,
+    CACHE_MISSES,
+    CACHE_EVICTIONS,
+    CACHE_INVALIDATIONS,
+    LOADS_COALESCED,
+    WRITEBACK_STAGED,
+    WRITEBACK_COALESCED,
+    WRITEBACK_FLUSHED,
+    WRITEBACK_FAILED,
+    WRITEBACK_STUCK,
+    BLOCKS_PREFETCHED,
+    IO_BATCHES,
+    IO_REQUESTS,
+    ALIGNED_BUFFERS_ALLOCATED,
+    BLOCKS_RECLAIMED,
+    FILES_COMPRESSED,
+    COMPRESSION_SKIPPED,
+    COMPRESSION_BYTES_IN,
+    COMPRESSION_BYTES_OUT,
+    BYTES_DECOMPRESSED,
+    DEDUP_BLOCKS_SHARED,
+    DEDUP_BLOCKS_STORED,
+    BLOCKS_VERIFIED,
+    CHECKSUM_FAILURES,
+    COUNT
+};
+
+// Log-linear buckets: values below 2^SUB_BITS get a bucket each, above that
+// every power of two is split into 2^SUB_BITS buckets (about 6% wide).
+// Values past 2^MAX_EXPONENT ns (about 18 minutes) land in the last bucket.
+const int HISTOGRAM_SUB_BITS = 4;
+const int HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BITS;
+const int HISTOGRAM_MAX_EXPONENT = 40;
+const int HISTOGRAM_BUCKETS = (HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BITS + 2) * HISTOGRAM_SUB_BUCKETS;
+const int MAX_TIMED_OPS = 32;   // request opcodes below this value are timed
+
+struct MetricsShard {
+    std::atomic<uint64_t> counters[(int)Counter::COUNT];
+    std::atomic<uint64_t> buckets[MAX_TIMED_OPS][HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> sumNs[MAX_TIMED_OPS];
+    std::atomic<uint64_t> maxNs[MAX_TIMED_OPS];
+};
+
+// Merged view of all shards for one command
+struct LatencySnapshot {
+    uint64_t count = 0;
+    uint64_t sumNs = 0;
+    uint64_t maxNs = 0;
+    uint64_t buckets[HISTOGRAM_BUCKETS] = {};
+
+    // Upper bound of the bucket holding the q-th quantile, q in [0, 1]
+    uint64_t percentile(double q) const;
+
+    // For tools that keep their own histograms (bench/)
+    void add(uint64_t ns);
+    void merge(const LatencySnapshot& other);
+};
+
+class Metrics {
+public:
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static void add(Counter counter, uint64_t amount = 1) {
+        bump(shard().counters[(int)counter], amount);
+    }
+
+    static void recordLatency(int op, uint64_t ns) {
+        if (op < 0 || op >= MAX_TIMED_OPS) return;
+        MetricsShard& s = shard();
+        bump(s.buckets[op][bucketFor(ns)], 1);
+        bump(s.sumNs[op], ns);
+        if (ns > s.maxNs[op].load(std::memory_order_relaxed)) {
+            s.maxNs[op].store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    static int bucketFor(uint64_t ns) {
+        if (ns < (uint64_t)HISTOGRAM_SUB_BUCKETS) return (int)ns;
+        int exponent = 63 - __builtin_clzll(ns);
+        if (exponent > HISTOGRAM_MAX_EXPONENT) return HISTOGRAM_BUCKETS - 1;
+        int sub = (ns >> (exponent - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+        return (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+    }
+
+    // Largest value that maps to bucket
+    static uint64_t bucketUpperBound(int bucket);
+
+    static uint64_t total(Counter counter);
+    static LatencySnapshot latency(int op);
+    static const char* counterName(Counter counter);
+
+    // One line per counter and per command that has been seen; no '|' so the
+    // text protocol can carry it in a single field
+    static std::string renderText();
+    // Prometheus text exposition format
+    static std::string renderPrometheus();
+
+private:
+    static inline thread_local MetricsShard* localShard = nullptr;
+
+    // Only the owning thread writes a shard, so no read-modify-write is needed
+    static void bump(std::atomic<uint64_t>& cell, uint64_t amount) {
+        cell.store(cell.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    static MetricsShard& shard() {
+        if (!localShard) localShard = registerShard();
+        return *localShard;
+    }
+
+    static MetricsShard* registerShard();
+};
+
+#endif // METRICS_HPP
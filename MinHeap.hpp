@@ -83,6 +83,7 @@ void update(FileEntry* f) {
 }
 
 
+    void clear() { heap.clear(); }
     bool isEmpty() const { return heap.empty(); }
     size_t size() const { return heap.size(); }
 };
@@ -0,0 +1,61 @@
+#ifndef REQUESTEXECUTOR_HPP
+#define REQUESTEXECUTOR_HPP
+
+#include <functional>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "Queue.hpp"
+
+// Fixed pool of threads that runs submitted tasks in FIFO order
+class RequestExecutor {
+private:
+    Queue<std::function<void()>> tasks;
+    std::mutex tasksMutex;
+    std::condition_variable tasksReady;
+    std::vector<std::thread> threads;
+    bool stopping;
+
+    void run() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(tasksMutex);
+                tasksReady.wait(lock, [this] { return stopping || !tasks.isEmpty(); });
+                if (tasks.isEmpty()) return;
+                task = tasks.dequeue();
+            }
+            task();
+        }
+    }
+
+public:
+    explicit RequestExecutor(int numThreads) : stopping(false) {
+        for (int i = 0; i < numThreads; i++) {
+            threads.emplace_back(&RequestExecutor::run, this);
+        }
+    }
+
+    // Finishes the queued tasks, then joins the threads
+    ~RequestExecutor() {
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            stopping = true;
+        }
+        tasksReady.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            tasks.enqueue(std::move(task));
+        }
+        tasksReady.notify_one();
+    }
+
+    int size() const { return threads.size(); }
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "Trace.hpp"
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TraceEvent {
+    std::string_view name;
+    uint64_t startNs;
+    uint64_t durationNs;
+    uint32_t requestId;
+};
+
+// Only the owning thread appends; the mutex is there for dumpJson and is
+// otherwise uncontended
+struct TraceBuffer {
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+    uint64_t dropped = 0;
+    int tid = 0;
+};
+
+static std::mutex buffersMutex;
+static std::vector<std::shared_ptr<TraceBuffer>> buffers;
+
+static TraceBuffer& threadBuffer() {
+    static thread_local std::shared_ptr<TraceBuffer> buffer;
+    if (!buffer) {
+        buffer = std::make_shared<TraceBuffer>();
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        buffer->tid = buffers.size() + 1;
+        buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+std::atomic<uint8_t>& Trace::currentMode() {
+    static std::atomic<uint8_t> mode{(uint8_t)TraceMode::OFF};
+    return mode;
+}
+
+bool Trace::parseMode(std::string_view name, TraceMode& mode) {
+    if (name == "off") mode = TraceMode::OFF;
+    else if (name == "sample") mode = TraceMode::SAMPLE;
+    else if (name == "all") mode = TraceMode::ALL;
+    else return false;
+    return true;
+}
+
+const char* Trace::modeName(TraceMode mode) {
+    switch (mode) {
+    case TraceMode::SAMPLE: return "sample";
+    case TraceMode::ALL:    return "all";
+    default:                return "off";
+    }
+}
+
+void Trace::record(std::string_view name, uint64_t startNs, uint64_t endNs) {
+    TraceBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    if (buffer.events.size() >= TRACE_MAX_EVENTS_PER_THREAD) {
+        buffer.dropped++;
+        return;
+    }
+    buffer.events.push_back({name, startNs, endNs - startNs, threadRequestId});
+}
+
+static void appendJsonString(std::string& out, std::string_view text) {
+    out += '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c < 0x20) continue;
+        out += c;
+    }
+    out += '"';
+}
+
+static void appendMicros(std::string& out, uint64_t ns) {
+    char text[32];
+    snprintf(text, sizeof(text), "%llu.%03llu", (unsigned long long)(ns / 1000), (unsigned long long)(ns % 1000));
+    out += text;
+}
+
+std::string Trace::dumpJson() {
+    std::vector<std::shared_ptr<TraceBuffer>> current;
+    {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        current = buffers;
+    }
+
+    std::string out = "{\"traceEvents\":[";
+    bool first = true;
+    uint64_t dropped = 0;
+    for (const auto& buffer : current) {
+        std::vector<TraceEvent> events;
+        {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            events.swap(buffer->events);
+            dropped += buffer->dropped;
+            buffer->dropped = 0;
+        }
+        for (const TraceEvent& event : events) {
+            if (!first) out += ',';
+            first = false;
+            out += "{\"name\":";
+            appendJsonString(out, event.name);
+            out += ",\"ph\":\"X\",\"pid\":1,\"tid\":" + std::to_string(buffer->tid) + ",\"ts\":";
+            appendMicros(out, event.startNs);
+            out += ",\"dur\":";
+            appendMicros(out, event.durationNs);
+            out += ",\"args\":{\"request\":" + std::to_string(event.requestId) + "}}";
+        }
+    }
+    out += "],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":" + std::to_string(dropped) + "}}";
+    return out;
+}
@@ -0,0 +1,99 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "Metrics.hpp"
+
+// Scoped timing spans for individual requests, collected per thread and
+// exported as Chrome trace-event JSON (load it in chrome://tracing or
+// Perfetto). Whether a request is traced is decided once, when it is read;
+// spans on an untraced request cost one thread-local load.
+//
+//   TRACE_SPAN("BTree::insert");
+//
+// Span names must outlive the trace (string literals, opcode names).
+
+enum class TraceMode : uint8_t {
+    OFF,
+    SAMPLE,   // one request in TRACE_SAMPLE_RATE
+    ALL
+};
+
+const int TRACE_SAMPLE_RATE = 100;
+const size_t TRACE_MAX_EVENTS_PER_THREAD = 100000;   // further spans are dropped until the next dump
+
+class Trace {
+public:
+    static void setMode(TraceMode mode) { currentMode().store((uint8_t)mode, std::memory_order_relaxed); }
+    static TraceMode mode() { return (TraceMode)currentMode().load(std::memory_order_relaxed); }
+    static bool parseMode(std::string_view name, TraceMode& mode);
+    static const char* modeName(TraceMode mode);
+
+    // Whether the request being read now should be traced
+    static bool shouldSample() {
+        TraceMode m = mode();
+        if (m == TraceMode::OFF) return false;
+        if (m == TraceMode::ALL) return true;
+        return ++sampleCounter % TRACE_SAMPLE_RATE == 0;
+    }
+
+    static bool active() { return threadActive; }
+    static uint32_t requestId() { return threadRequestId; }
+
+    static void record(std::string_view name, uint64_t startNs, uint64_t endNs);
+
+    // Returns every span recorded so far as a JSON trace and clears them
+    static std::string dumpJson();
+
+private:
+    friend class TraceRequestScope;
+
+    static inline thread_local bool threadActive = false;
+    static inline thread_local uint32_t threadRequestId = 0;
+    static inline thread_local uint32_t sampleCounter = 0;
+
+    static std::atomic<uint8_t>& currentMode();
+};
+
+// Marks the calling thread as serving a request, traced or not, for the
+// lifetime of the scope
+class TraceRequestScope {
+private:
+    bool previousActive;
+    uint32_t previousId;
+
+public:
+    TraceRequestScope(bool traced, uint32_t requestId)
+        : previousActive(Trace::threadActive), previousId(Trace::threadRequestId) {
+        Trace::threadActive = traced;
+        Trace::threadRequestId = requestId;
+    }
+
+    ~TraceRequestScope() {
+        Trace::threadActive = previousActive;
+        Trace::threadRequestId = previousId;
+    }
+};
+
+class TraceSpan {
+private:
+    std::string_view name;
+    uint64_t start;
+
+public:
+    explicit TraceSpan(std::string_view spanName)
+        : name(spanName), start(Trace::active() ? Metrics::now() : 0) {}
+
+    ~TraceSpan() {
+        if (start) Trace::record(name, start, Metrics::now());
+    }
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+
+#endif // TRACE_HPP
@@ -1,11 +1,15 @@
 #include "UserManager.hpp"
 #include "UserManagerDisk.hpp"
+#include "Logger.hpp"
 #include <iostream>
 
 UserManager::UserManager() : users(10), nextUserId(1), disk(nullptr) {}
 
 bool UserManager::registerUser(const std::string& username, const std::string& password) {
-    if (userExists(username)) {
+    // Checked and inserted under one hold, so two registrations of a name
+    // cannot both succeed
+    std::lock_guard<std::mutex> lock(mutex);
+    if (users.search(username) != nullptr) {
         return false;
     }
     
@@ -21,18 +25,15 @@ bool UserManager::registerUser(const std::string& username, const std::string& p
         disk->saveUser(newUser);
     }
     
-    std::cout << "[UserManager] User '" << username << "' registered successfully (ID: " << newUser.userId << ")\n";
+    LOG_INFO("UserManager", "User registered", kv("username", username), kv("user", newUser.userId));
     return true;
 }
 
 int UserManager::loginUser(const std::string& username, const std::string& password) {
-    if (!userExists(username)) {
-        return -1;
-    }
-    
+    std::lock_guard<std::mutex> lock(mutex);
     User* user = users.search(username);
     if (user && user->password == password) {
-        std::cout << "[UserManager] User '" << username << "' logged in successfully\n";
+        LOG_DEBUG("UserManager", "User logged in", kv("username", username));
         return user->userId;
     }
     
@@ -40,22 +41,27 @@ int UserManager::loginUser(const std::string& username, const std::string& passw
 }
 
 User* UserManager::getUser(const std::string& username) {
+    std::lock_guard<std::mutex> lock(mutex);
     return users.search(username);
 }
 
 User* UserManager::getUserById(int userId) {
+    std::lock_guard<std::mutex> lock(mutex);
     return users.search(userId);
 }
 
 bool UserManager::userExists(const std::string& username) {
+    std::lock_guard<std::mutex> lock(mutex);
     return users.search(username) != nullptr;
 }
 
 void UserManager::setDiskManager(UserManagerDisk* diskMgr) {
+    std::lock_guard<std::mutex> lock(mutex);
     disk = diskMgr;
 }
 
 void UserManager::loadUser(int userId, const std::string& username, const std::string& password) {
+    std::lock_guard<std::mutex> lock(mutex);
     User newUser;
     newUser.userId = userId;
     newUser.username = username;
@@ -1,6 +1,7 @@
 #ifndef USERMANAGER_HPP
 #define USERMANAGER_HPP
 
+#include <mutex>
 #include <string>
 #include <vector>
 #include "User.hpp"
@@ -8,11 +9,14 @@
 
 class UserManagerDisk;
 
+// Thread-safe: requests from any connection register and log in
+// concurrently, so every call holds the manager's lock
 class UserManager {
 private:
     HashMap<User> users;  
     int nextUserId;
     UserManagerDisk* disk;
+    std::mutex mutex;
 
 public:
     UserManager();
@@ -21,6 +25,7 @@ public:
     
     int loginUser(const std::string& username, const std::string& password);
     
+    // The pointer stays valid only until the next registration
     User* getUser(const std::string& username);
     
     User* getUserById(int userId);
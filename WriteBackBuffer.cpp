@@ -0,0 +1,350 @@
+#include "WriteBackBuffer.hpp"
+#include "FileManagerDisk.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+const size_t RECORD_HEADER_SIZE = sizeof(uint32_t) + 1;
+
+WriteBackBuffer::WriteBackBuffer(FileManagerDisk& disk, const std::string& logPath,
+                                 long maxDelayMs, size_t maxDirtyBytes)
+    : disk(disk), logPath(logPath), logFd(-1), maxDelayNs((uint64_t)maxDelayMs * 1000000),
+      maxDirtyBytes(maxDirtyBytes), dirtyBytes(0), stuckBytes(0), logBytes(0), nextVersion(1), flushRounds(0),
+      storedCount(0), stopping(false) {}
+
+WriteBackBuffer::~WriteBackBuffer() {
+    stop();
+}
+
+bool WriteBackBuffer::start() {
+    logFd = open(logPath.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (logFd == -1) {
+        LOG_ERROR("WriteBack", "Cannot open log", kv("path", logPath));
+        return false;
+    }
+    if (!replay() || !disk.syncData() || ftruncate(logFd, 0) != 0) {
+        LOG_ERROR("WriteBack", "Log replay failed", kv("path", logPath));
+        close(logFd);
+        logFd = -1;
+        return false;
+    }
+
+    flusher = std::thread(&WriteBackBuffer::flushLoop, this);
+    LOG_INFO("WriteBack", "Write-back enabled", kv("maxDelayMs", (unsigned long)(maxDelayNs / 1000000)),
+             kv("maxDirtyBytes", (unsigned long)maxDirtyBytes));
+    return true;
+}
+
+void WriteBackBuffer::stop() {
+    if (logFd == -1) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    drained.notify_all();
+    if (flusher.joinable()) flusher.join();
+
+    flush(true);
+    close(logFd);
+    logFd = -1;
+}
+
+// One write(), so records from concurrent saves never interleave
+bool WriteBackBuffer::writeRecord(int fd, RecordKind kind, const std::string& body) {
+    std::string record(RECORD_HEADER_SIZE, '\0');
+    uint32_t length = body.size();
+    std::memcpy(&record[0], &length, sizeof(length));
+    record[sizeof(length)] = kind;
+    record += body;
+
+    const char* data = record.data();
+    size_t left = record.size();
+    while (left > 0) {
+        ssize_t n = write(fd, data, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        left -= n;
+    }
+    return true;
+}
+
+// Caller holds mutex
+bool WriteBackBuffer::appendLog(RecordKind kind, const std::string& body) {
+    if (!writeRecord(logFd, kind, body)) {
+        LOG_ERROR("WriteBack", "Log append failed", kv("errno", errno));
+        return false;
+    }
+    logBytes += RECORD_HEADER_SIZE + body.size();
+    return true;
+}
+
+// Replaces the log with one SAVE record per dirty file. Deletes are already
+// in disk.bin, as are the saves that were stored. On any failure the old
+// log stays. Caller holds mutex.
+void WriteBackBuffer::compactLog() {
+    std::string tmpPath = logPath + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd == -1) {
+        LOG_WARN("WriteBack", "Cannot create log for compaction", kv("path", tmpPath), kv("errno", errno));
+        return;
+    }
+    size_t written = 0;
+    bool ok = true;
+    for (const auto& item : dirty) {
+        const FileEntry& f = item.second.entry;
+        std::string body = FileManagerDisk::serializeHeader(f) + f.content;
+        if (!writeRecord(fd, SAVE, body)) {
+            ok = false;
+            break;
+        }
+        written += RECORD_HEADER_SIZE + body.size();
+    }
+    if (!ok || fsync(fd) != 0 || rename(tmpPath.c_str(), logPath.c_str()) != 0) {
+        LOG_WARN("WriteBack", "Log compaction failed, keeping the log", kv("errno", errno));
+        close(fd);
+        unlink(tmpPath.c_str());
+        return;
+    }
+    close(logFd);
+    logFd = fd;
+    LOG_DEBUG("WriteBack", "Log compacted", kv("from", (unsigned long)logBytes), kv("to", (unsigned long)written));
+    logBytes = written;
+}
+
+// A torn record at the end, from a crash mid-append, is ignored
+bool WriteBackBuffer::replay() {
+    std::string data;
+    char buffer[64 * 1024];
+    off_t offset = 0;
+    while (true) {
+        ssize_t n = pread(logFd, buffer, sizeof(buffer), offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        if (n == 0) break;
+        data.append(buffer, n);
+        offset += n;
+    }
+    if (data.empty()) return true;
+
+    std::unordered_map<int, FileEntry> latest;
+    std::vector<int> deleted;
+    size_t pos = 0;
+    while (pos + RECORD_HEADER_SIZE <= data.size()) {
+        uint32_t length;
+        std::memcpy(&length, data.data() + pos, sizeof(length));
+        uint8_t kind = data[pos + sizeof(length)];
+        if (pos + RECORD_HEADER_SIZE + length > data.size()) break;
+        std::string body = data.substr(pos + RECORD_HEADER_SIZE, length);
+        pos += RECORD_HEADER_SIZE + length;
+
+        FileEntry f;
+        int fileId;
+        if (kind == SAVE && FileManagerDisk::parseFile(body, f)) {
+            latest[f.fileId] = std::move(f);
+        } else if (kind == DELETE && length == sizeof(int)) {
+            std::memcpy(&fileId, body.data(), sizeof(int));
+            latest.erase(fileId);
+            deleted.push_back(fileId);
+        }
+    }
+    if (pos != data.size()) {
+        LOG_WARN("WriteBack", "Ignoring torn record at end of log", kv("bytes", (unsigned long)(data.size() - pos)));
+    }
+
+    // The buffer is not attached yet, so these go straight to disk.bin
+    disk.beginBatch();
+    for (int id : deleted) disk.deleteFile(id);
+    size_t failed = 0;
+    for (auto& item : latest) {
+        if (!disk.saveFile(item.second)) failed++;
+    }
+    disk.commitBatch();
+
+    if (failed > 0) {
+        // Those saves were acknowledged; the log is all that is left of them
+        LOG_ERROR("WriteBack", "Could not store every logged save, keeping the log",
+                  kv("saved", (unsigned long)(latest.size() - failed)), kv("failed", (unsigned long)failed));
+        return false;
+    }
+    LOG_INFO("WriteBack", "Log replayed", kv("saved", (unsigned long)latest.size()),
+             kv("deleted", (unsigned long)deleted.size()));
+    return true;
+}
+
+bool WriteBackBuffer::stage(const FileEntry& f, bool mayWait) {
+    std::string body = FileManagerDisk::serializeHeader(f) + f.content;
+    size_t cost = body.size();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = dirty.find(f.fileId);
+    bool stuck = it != dirty.end() && it->second.failures >= WRITE_BACK_MAX_RETRIES;
+    if (stopping || stuck || !appendLog(SAVE, body)) return false;
+
+    if (it != dirty.end()) {
+        dirtyBytes -= it->second.cost;
+        it->second.entry = f;
+        it->second.version = nextVersion++;
+        it->second.cost = cost;
+        Metrics::add(Counter::WRITEBACK_COALESCED);
+    } else {
+        dirty.emplace(f.fileId, Dirty{f, nextVersion++, Metrics::now(), cost, 0});
+    }
+    dirtyBytes += cost;
+    Metrics::add(Counter::WRITEBACK_STAGED);
+
+    if (dirtyBytes > maxDirtyBytes / 2) wake.notify_one();
+    if (mayWait && dirtyBytes > maxDirtyBytes) {
+        // One round is enough even if it could not store everything, so a
+        // failing disk slows saves down instead of blocking them for good
+        uint64_t round = flushRounds;
+        drained.wait(lock, [&] { return dirtyBytes <= maxDirtyBytes || stopping || flushRounds != round; });
+    }
+    return true;
+}
+
+void WriteBackBuffer::discard(int fileId) {
+    std::string body(reinterpret_cast<const char*>(&fileId), sizeof(int));
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = dirty.find(fileId);
+    if (it != dirty.end()) {
+        forget(it);
+    }
+    appendLog(DELETE, body);
+}
+
+// Caller holds mutex
+void WriteBackBuffer::forget(std::unordered_map<int, Dirty>::iterator it) {
+    if (it->second.failures >= WRITE_BACK_MAX_RETRIES) {
+        stuckBytes -= it->second.cost;
+    }
+    dirtyBytes -= it->second.cost;
+    dirty.erase(it);
+}
+
+bool WriteBackBuffer::lookup(int fileId, FileEntry& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = dirty.find(fileId);
+    if (it == dirty.end()) return false;
+    out = it->second.entry;
+    return true;
+}
+
+void WriteBackBuffer::flushFile(int fileId) {
+    flush(false, fileId);
+}
+
+std::vector<int> WriteBackBuffer::getDirtyIds() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<int> ids;
+    ids.reserve(dirty.size());
+    for (const auto& item : dirty) ids.push_back(item.first);
+    return ids;
+}
+
+void WriteBackBuffer::flushLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        wake.wait_for(lock, std::chrono::nanoseconds(std::max<uint64_t>(maxDelayNs / 4, 1000000)),
+                      [this] { return stopping || dirtyBytes - stuckBytes > maxDirtyBytes / 2; });
+        if (stopping) break;
+        lock.unlock();
+        flush(false);
+        lock.lock();
+    }
+}
+
+void WriteBackBuffer::flush(bool all, int fileId) {
+    std::vector<int> due;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t now = Metrics::now();
+        bool pressed = dirtyBytes - stuckBytes > maxDirtyBytes / 2;
+        for (const auto& item : dirty) {
+            bool givenUp = item.second.failures >= WRITE_BACK_MAX_RETRIES;
+            bool pick = fileId != -1 ? item.first == fileId
+                                     : all || (!givenUp && (pressed || now - item.second.dirtiedAt >= maxDelayNs));
+            if (pick) due.push_back(item.first);
+        }
+        if (due.empty()) return;
+    }
+
+    // Stored as batches so the index and bitmap are written once per chunk
+    // rather than once per file
+    size_t stored = 0;
+    disk.beginBatch();
+    for (int id : due) {
+        FileEntry entry;
+        uint64_t version;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = dirty.find(id);
+            if (it == dirty.end()) continue;
+            entry = it->second.entry;
+            version = it->second.version;
+        }
+
+        bool ok = disk.storeFile(entry);
+        {
+            // A save that arrived meanwhile stays dirty
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = dirty.find(id);
+            if (ok && it != dirty.end() && it->second.version == version) {
+                forget(it);
+                storedCount++;
+            } else if (!ok && it != dirty.end()) {
+                Metrics::add(Counter::WRITEBACK_FAILED);
+                if (++it->second.failures == WRITE_BACK_MAX_RETRIES) {
+                    stuckBytes += it->second.cost;
+                    Metrics::add(Counter::WRITEBACK_STUCK);
+                    LOG_ERROR("WriteBack", "Giving up on storing file, it stays in the log; refusing its saves",
+                              kv("file", id), kv("attempts", WRITE_BACK_MAX_RETRIES));
+                } else if (it->second.failures < WRITE_BACK_MAX_RETRIES) {
+                    LOG_ERROR("WriteBack", "Failed to store file, will retry", kv("file", id),
+                              kv("attempt", it->second.failures));
+                }
+            }
+        }
+        if (!ok) continue;
+        Metrics::add(Counter::WRITEBACK_FLUSHED);
+
+        stored += entry.content.size();
+        if (stored >= WRITE_BACK_FLUSH_CHUNK) {
+            disk.commitBatch();
+            disk.beginBatch();
+            stored = 0;
+        }
+    }
+    disk.commitBatch();
+
+    // Records only leave the log once disk.bin is synced. The sync runs
+    // unlocked so saves do not wait for it; a store forgotten meanwhile may
+    // have missed it, and then the log is left for a later round.
+    std::unique_lock<std::mutex> lock(mutex);
+    auto shrinks = [this] {
+        return logBytes > 0 && (dirty.empty() || (logBytes > WRITE_BACK_COMPACT_MIN && logBytes > 2 * dirtyBytes));
+    };
+    if (shrinks()) {
+        uint64_t covered = storedCount;
+        lock.unlock();
+        bool synced = disk.syncData();
+        lock.lock();
+        if (synced && storedCount == covered && shrinks()) {
+            if (!dirty.empty()) {
+                compactLog();
+            } else if (ftruncate(logFd, 0) == 0) {
+                logBytes = 0;
+            } else {
+                LOG_WARN("WriteBack", "Could not truncate log", kv("errno", errno));
+            }
+        }
+    }
+    flushRounds++;
+    drained.notify_all();
+}
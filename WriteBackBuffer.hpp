@@ -0,0 +1,118 @@
+#ifndef WRITEBACKBUFFER_HPP
+#define WRITEBACKBUFFER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "FileEntry.hpp"
+
+class FileManagerDisk;
+
+// Write-behind layer for FileManagerDisk. A save is appended to a log and
+// kept in memory as the file's latest version, and returns without touching
+// disk.bin. A background thread stores each dirty file once it has been
+// dirty for maxDelay, or sooner once the dirty bytes pass half of
+// maxDirtyBytes, so a burst of saves to one file becomes one chain write.
+// Saves wait while the dirty bytes are over maxDirtyBytes.
+//
+// start() replays the log into disk.bin, so acknowledged saves survive a
+// crash as well as direct ones do: the log is written but, like disk.bin,
+// not synced on every save. A record only leaves the log once disk.bin has
+// been synced after its store. The log is emptied whenever nothing is
+// dirty, and kept when a replayed save fails, for a later start to try
+// again. Under saves that never let it empty, a flush round that leaves the
+// log more than twice the size of the dirty files rewrites it with only
+// those, through a synced temporary file renamed over it, so it stays
+// within a small multiple of maxDirtyBytes.
+//
+// A file whose store fails WRITE_BACK_MAX_RETRIES times in a row is left
+// in the log and no longer retried until stop(). From then on saves of
+// that file are refused rather than acknowledged with nowhere to go; other
+// files are staged and stored as usual, and deleting the file clears it.
+//
+// Log records, in host byte order like disk.bin: u32 body length, u8 kind,
+// body. A SAVE body is the file as FileManagerDisk stores it, a DELETE body
+// the fileId.
+
+const char WRITE_BACK_LOG[] = "writeback.log";
+const long WRITE_BACK_MAX_DELAY_MS = 500;
+const size_t WRITE_BACK_MAX_DIRTY = 64 * 1024 * 1024;
+const size_t WRITE_BACK_FLUSH_CHUNK = 8 * 1024 * 1024;   // stored per exclusive hold of the store
+const int WRITE_BACK_MAX_RETRIES = 5;
+const size_t WRITE_BACK_COMPACT_MIN = 1024 * 1024;       // log size below which it is never rewritten
+
+class WriteBackBuffer {
+private:
+    enum RecordKind : uint8_t {
+        SAVE = 1,
+        DELETE = 2
+    };
+
+    struct Dirty {
+        FileEntry entry;
+        uint64_t version;
+        uint64_t dirtiedAt;   // Metrics::now() of the oldest unstored save
+        size_t cost;
+        int failures;         // stores that failed in a row
+    };
+
+    FileManagerDisk& disk;
+    std::string logPath;
+    int logFd;
+    uint64_t maxDelayNs;
+    size_t maxDirtyBytes;
+
+    std::mutex mutex;
+    std::condition_variable wake;      // the flusher
+    std::condition_variable drained;   // saves waiting for room
+    std::unordered_map<int, Dirty> dirty;
+    size_t dirtyBytes;
+    size_t stuckBytes;                 // cost of dirty files past WRITE_BACK_MAX_RETRIES, which no flush relieves
+    size_t logBytes;                   // size of the log
+    uint64_t nextVersion;
+    uint64_t flushRounds;
+    uint64_t storedCount;              // saves stored and forgotten, so a sync can tell what it covers
+    bool stopping;
+    std::thread flusher;
+
+    static bool writeRecord(int fd, RecordKind kind, const std::string& body);
+    bool appendLog(RecordKind kind, const std::string& body);
+    void compactLog();
+    void forget(std::unordered_map<int, Dirty>::iterator it);
+    bool replay();
+    void flushLoop();
+    // Stores the files that are due (all of them if all is set, only fileId
+    // if it is not -1)
+    void flush(bool all, int fileId = -1);
+
+public:
+    WriteBackBuffer(FileManagerDisk& disk, const std::string& logPath = WRITE_BACK_LOG,
+                    long maxDelayMs = WRITE_BACK_MAX_DELAY_MS, size_t maxDirtyBytes = WRITE_BACK_MAX_DIRTY);
+    ~WriteBackBuffer();
+
+    // Replays the log into disk.bin and starts the flusher. Call before the
+    // buffer is attached to the disk.
+    bool start();
+    // Stores everything still dirty and stops the flusher. Call after the
+    // buffer is detached.
+    void stop();
+
+    // Logs f and makes it the file's latest version. Set mayWait only when
+    // the caller does not hold the store, since the flusher needs it. Fails
+    // if f's file could not be stored after every retry.
+    bool stage(const FileEntry& f, bool mayWait);
+    // Forgets the unstored version of fileId; caller holds the store exclusively
+    void discard(int fileId);
+    // Copies the unstored version of fileId, if there is one
+    bool lookup(int fileId, FileEntry& out);
+    // Stores fileId now if it is dirty, for readers that go to disk.bin directly
+    void flushFile(int fileId);
+    std::vector<int> getDirtyIds();
+};
+
+#endif // WRITEBACKBUFFER_HPP
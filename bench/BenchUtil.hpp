@@ -0,0 +1,163 @@
+#ifndef BENCHUTIL_HPP
+#define BENCHUTIL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// Helpers shared by the programs in bench/. Results are written as one JSON
+// object per line on stdout so runs can be diffed or loaded by a script;
+// progress and errors go to stderr.
+
+inline uint64_t benchNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Builds one result line: JsonLine().add("bench", "x").add("ns_per_op", 12.5).print()
+class JsonLine {
+private:
+    std::string out;
+
+    void key(const char* name) {
+        out += out.empty() ? "{\"" : ",\"";
+        out += name;
+        out += "\":";
+    }
+
+public:
+    JsonLine& add(const char* name, const std::string& value) {
+        key(name);
+        out += '"';
+        for (char c : value) {
+            if (c == '"' || c == '\\') out += '\\';
+            if ((unsigned char)c >= 0x20) out += c;
+        }
+        out += '"';
+        return *this;
+    }
+    JsonLine& add(const char* name, const char* value) { return add(name, std::string(value)); }
+    JsonLine& add(const char* name, long long value) {
+        key(name);
+        out += std::to_string(value);
+        return *this;
+    }
+    JsonLine& add(const char* name, int value) { return add(name, (long long)value); }
+    JsonLine& add(const char* name, long value) { return add(name, (long long)value); }
+    JsonLine& add(const char* name, size_t value) { return add(name, (long long)value); }
+    JsonLine& add(const char* name, double value) {
+        char text[32];
+        snprintf(text, sizeof(text), "%.3f", value);
+        key(name);
+        out += text;
+        return *this;
+    }
+
+    void print() {
+        out += out.empty() ? "{}" : "}";
+        printf("%s\n", out.c_str());
+        fflush(stdout);
+        out.clear();
+    }
+};
+
+// Value of "--name value" on the command line, or fallback
+inline std::string benchOption(int argc, char* argv[], const std::string& name, const std::string& fallback) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (argv[i] == "--" + name) return argv[i + 1];
+    }
+    return fallback;
+}
+
+inline long benchOption(int argc, char* argv[], const std::string& name, long fallback) {
+    std::string value = benchOption(argc, argv, name, std::string());
+    return value.empty() ? fallback : std::atol(value.c_str());
+}
+
+inline bool benchFlag(int argc, char* argv[], const std::string& name) {
+    for (int i = 1; i < argc; i++) {
+        if (argv[i] == "--" + name) return true;
+    }
+    return false;
+}
+
+// Creates a fresh directory under /tmp and makes it the working directory,
+// since the disk layer keeps its side files next to the process
+inline std::string benchTempDir(const char* prefix) {
+    std::string pattern = std::string("/tmp/") + prefix + "-XXXXXX";
+    std::vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+    if (!mkdtemp(path.data()) || chdir(path.data()) != 0) {
+        perror("bench temp dir");
+        exit(1);
+    }
+    return path.data();
+}
+
+// Small deterministic generator so runs are repeatable
+class BenchRandom {
+private:
+    uint64_t state;
+
+public:
+    explicit BenchRandom(uint64_t seed = 0x9e3779b97f4a7c15ull) : state(seed ? seed : 1) {}
+
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    // Uniform in [0, bound)
+    uint64_t below(uint64_t bound) { return bound ? next() % bound : 0; }
+    double unit() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+};
+
+// File sizes for synthetic workloads, parsed from fixed:N, uniform:MIN:MAX or
+// lognormal:MEDIAN:SIGMA
+struct SizeDistribution {
+    enum Kind { FIXED, UNIFORM, LOGNORMAL } kind = FIXED;
+    double a = 4096;
+    double b = 0;
+    size_t maxSize = 8 * 1024 * 1024;
+
+    bool parse(const std::string& spec) {
+        std::vector<std::string> parts;
+        std::stringstream in(spec);
+        std::string part;
+        while (std::getline(in, part, ':')) parts.push_back(part);
+        if (parts.empty()) return false;
+
+        if (parts[0] == "fixed" && parts.size() == 2) kind = FIXED;
+        else if (parts[0] == "uniform" && parts.size() == 3) kind = UNIFORM;
+        else if (parts[0] == "lognormal" && parts.size() == 3) kind = LOGNORMAL;
+        else return false;
+
+        a = std::atof(parts[1].c_str());
+        b = parts.size() > 2 ? std::atof(parts[2].c_str()) : 0;
+        return a > 0 && (kind != UNIFORM || b >= a);
+    }
+
+    size_t sample(BenchRandom& rng) const {
+        double size = a;
+        if (kind == UNIFORM) {
+            size = a + rng.unit() * (b - a);
+        } else if (kind == LOGNORMAL) {
+            // Box-Muller; a is the median, b the sigma of the underlying normal
+            double u1 = std::max(rng.unit(), 1e-12);
+            double z = std::sqrt(-2.0 * std::log(u1)) * std::cos(2 * M_PI * rng.unit());
+            size = a * std::exp(b * z);
+        }
+        return std::min(maxSize, std::max<size_t>(1, (size_t)size));
+    }
+};
+
+#endif // BENCHUTIL_HPP
@@ -0,0 +1,393 @@
+// Load generator for a running server. Opens N binary-protocol connections,
+// registers and logs in one synthetic user per connection, preloads a few
+// files for each and then drives a weighted mix of operations.
+//
+// Build from the repository root:
+//
+//   g++ -std=c++17 -O2 -I. -Ifrontend -o load_gen bench/load_gen.cpp Metrics.cpp -pthread
+//
+// Run:
+//
+//   ./load_gen [--host 127.0.0.1] [--port 8080] [--connections 4]
+//              [--duration 10] [--warmup 2] [--mode closed|open] [--rate 2000]
+//              [--mix create=10,read=50,write=20,list=10,expiry=10]
+//              [--sizes fixed:4096 | uniform:MIN:MAX | lognormal:MEDIAN:SIGMA]
+//              [--max-size 8388608] [--files 20] [--user-prefix load]
+//
+// Closed loop: every connection keeps exactly one request outstanding, so
+// throughput is whatever the server sustains. Open loop: requests are sent
+// on a Poisson schedule at --rate ops/s in total whether or not earlier ones
+// have completed, and latency is measured from the scheduled send time, so
+// queueing behind a slow request is counted rather than hidden.
+//
+// The server serves a fixed number of connections at a time and leaves the
+// rest waiting; connections that are not served within SETUP_TIMEOUT_SECONDS
+// are dropped from the run.
+//
+// Results are JSON lines, one per operation plus a "total" line, with
+// throughput and p50/p99/p999 latency in microseconds. Requests issued
+// during --warmup are not counted.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "BenchUtil.hpp"
+#include "../Metrics.hpp"
+#include "BinaryClient.hpp"
+
+enum LoadOp {
+    LOAD_CREATE,
+    LOAD_READ,
+    LOAD_WRITE,
+    LOAD_LIST,
+    LOAD_EXPIRY,
+    LOAD_OP_COUNT
+};
+
+static const char* const LOAD_OP_NAMES[LOAD_OP_COUNT] = {"create", "read", "write", "list", "expiry"};
+
+// Size of the response-tracking table in open-loop mode; more requests than
+// this outstanding on one connection would overwrite each other's slots
+const uint32_t OPEN_LOOP_SLOTS = 1 << 16;
+const int SETUP_TIMEOUT_SECONDS = 10;
+
+struct LoadConfig {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    int connections = 4;
+    double duration = 10;
+    double warmup = 2;
+    bool openLoop = false;
+    double rate = 2000;
+    int weights[LOAD_OP_COUNT] = {10, 50, 20, 10, 10};
+    int totalWeight = 100;
+    SizeDistribution sizes;
+    int filesPerUser = 20;
+    std::string userPrefix;
+};
+
+// Latency histograms for one connection, merged at the end
+struct LoadStats {
+    LatencySnapshot latency[LOAD_OP_COUNT];
+    uint64_t errors[LOAD_OP_COUNT] = {};
+
+    void record(int op, uint64_t ns, bool ok) {
+        if (!ok) errors[op]++;
+        latency[op].add(ns);
+    }
+
+    void merge(const LoadStats& other) {
+        for (int op = 0; op < LOAD_OP_COUNT; op++) {
+            errors[op] += other.errors[op];
+            latency[op].merge(other.latency[op]);
+        }
+    }
+};
+
+// Random file content shared by every connection; payloads are views into it
+static std::string payloadPool;
+
+class LoadConnection {
+private:
+    const LoadConfig& config;
+    int index;
+    BinaryClient client;
+    BenchRandom rng;
+    std::vector<std::string> files;
+    int createdFiles = 0;
+
+    std::string_view payload(size_t size) {
+        size_t offset = rng.below(payloadPool.size() - size + 1);
+        return std::string_view(payloadPool).substr(offset, size);
+    }
+
+    LoadOp pickOp() {
+        int roll = rng.below(config.totalWeight);
+        for (int op = 0; op < LOAD_OP_COUNT; op++) {
+            if (roll < config.weights[op]) return (LoadOp)op;
+            roll -= config.weights[op];
+        }
+        return LOAD_READ;
+    }
+
+    const std::string& pickFile() { return files[rng.below(files.size())]; }
+
+    // Fills in the request for op; the caller sends it
+    void buildRequest(LoadOp op) {
+        switch (op) {
+        case LOAD_CREATE: {
+            std::string name = "new_" + std::to_string(createdFiles++) + ".txt";
+            client.begin(Opcode::CREATE_FILE).addString(name).addBytes(payload(config.sizes.sample(rng))).addInt(3600);
+            break;
+        }
+        case LOAD_READ:
+            client.begin(Opcode::READ_FILE).addString(pickFile());
+            break;
+        case LOAD_WRITE:
+            client.begin(Opcode::WRITE_FILE).addString(pickFile()).addBytes(payload(config.sizes.sample(rng)));
+            break;
+        case LOAD_LIST:
+            client.begin(Opcode::LIST_FILES);
+            break;
+        case LOAD_EXPIRY:
+            client.begin(Opcode::CHANGE_EXPIRY).addString(pickFile()).addInt(600 + rng.below(3600));
+            break;
+        default:
+            break;
+        }
+    }
+
+public:
+    LoadStats stats;
+    std::string error;
+    bool setupDone = false;   // guarded by the start mutex in main
+
+    LoadConnection(const LoadConfig& cfg, int connectionIndex)
+        : config(cfg), index(connectionIndex), rng(0x5eed + connectionIndex) {}
+
+    // Unblocks a setup() stuck waiting for the server, making it fail
+    void abort() { client.shutdown(); }
+
+    // Connects, registers and logs in this connection's user and creates
+    // its working set of files
+    bool setup() {
+        if (!client.connect(config.host, config.port)) {
+            error = "cannot connect";
+            return false;
+        }
+
+        std::string user = config.userPrefix + "_" + std::to_string(index);
+        BinaryResponse response;
+        client.begin(Opcode::REGISTER).addString(user).addString("load");
+        client.call(response);   // fails harmlessly when the user exists
+        client.begin(Opcode::LOGIN).addString(user).addString("load");
+        if (!client.call(response) || !response.ok()) {
+            error = "login failed for " + user;
+            return false;
+        }
+
+        for (int i = 0; i < config.filesPerUser; i++) {
+            std::string name = "file_" + std::to_string(i) + ".txt";
+            client.begin(Opcode::CREATE_FILE).addString(name).addBytes(payload(config.sizes.sample(rng))).addInt(86400);
+            if (!client.call(response)) {
+                error = "lost connection while creating files";
+                return false;
+            }
+            files.push_back(name);   // may already exist from an earlier run
+        }
+        return true;
+    }
+
+    void runClosed(uint64_t measureFrom, uint64_t endAt) {
+        BinaryResponse response;
+        while (true) {
+            uint64_t start = benchNow();
+            if (start >= endAt) break;
+            LoadOp op = pickOp();
+            buildRequest(op);
+            bool ok = client.call(response);
+            if (!ok && !client.isConnected()) break;
+            if (start >= measureFrom) stats.record(op, benchNow() - start, ok && response.ok());
+            if (!ok) break;
+        }
+    }
+
+    // A sender on this thread and a receiver on another; each outstanding
+    // request's scheduled time and op sit in a slot indexed by request id
+    void runOpen(uint64_t measureFrom, uint64_t endAt, double ratePerConnection) {
+        struct Slot {
+            uint64_t scheduledAt;
+            uint8_t op;
+        };
+        std::vector<Slot> slots(OPEN_LOOP_SLOTS);
+        std::atomic<uint64_t> sent{0};
+        std::atomic<uint64_t> received{0};
+        std::atomic<bool> senderDone{false};
+
+        std::thread receiver([&] {
+            BinaryResponse response;
+            while (!senderDone.load() || received.load() < sent.load()) {
+                if (!client.receive(response)) break;
+                const Slot& slot = slots[response.requestId % OPEN_LOOP_SLOTS];
+                if (slot.scheduledAt >= measureFrom) {
+                    stats.record(slot.op, benchNow() - slot.scheduledAt, response.ok());
+                }
+                received++;
+            }
+        });
+
+        uint64_t next = benchNow();
+        while (next < endAt) {
+            uint64_t now = benchNow();
+            if (now < next) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(next - now));
+            }
+            LoadOp op = pickOp();
+            buildRequest(op);
+            // Recorded before sending so the receiver always finds it
+            uint32_t id = client.nextId();
+            slots[id % OPEN_LOOP_SLOTS] = {next, (uint8_t)op};
+            if (client.send() == 0) break;
+            sent++;
+            // Exponential gaps give Poisson arrivals
+            next += (uint64_t)(-std::log(std::max(rng.unit(), 1e-12)) / ratePerConnection * 1e9);
+        }
+        senderDone = true;
+
+        // Give stragglers a few seconds, then cut the connection
+        uint64_t drainUntil = benchNow() + 5000000000ull;
+        while (received.load() < sent.load() && benchNow() < drainUntil) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        client.shutdown();
+        receiver.join();
+    }
+};
+
+static bool parseMix(const std::string& spec, LoadConfig& config) {
+    std::fill(config.weights, config.weights + LOAD_OP_COUNT, 0);
+    std::stringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        std::string name = item.substr(0, eq);
+        int weight = std::atoi(item.c_str() + eq + 1);
+        int op = std::find(LOAD_OP_NAMES, LOAD_OP_NAMES + LOAD_OP_COUNT, name) - LOAD_OP_NAMES;
+        if (op == LOAD_OP_COUNT || weight < 0) return false;
+        config.weights[op] = weight;
+    }
+    config.totalWeight = 0;
+    for (int w : config.weights) config.totalWeight += w;
+    return config.totalWeight > 0;
+}
+
+static void reportLine(const char* op, const LatencySnapshot& s, uint64_t errors,
+                       double seconds, const LoadConfig& config, int connections) {
+    JsonLine()
+        .add("op", op)
+        .add("mode", config.openLoop ? "open" : "closed")
+        .add("connections", connections)
+        .add("count", (size_t)s.count)
+        .add("errors", (size_t)errors)
+        .add("ops_per_sec", s.count / seconds)
+        .add("mean_us", s.count ? s.sumNs / 1e3 / s.count : 0.0)
+        .add("p50_us", s.percentile(0.50) / 1e3)
+        .add("p99_us", s.percentile(0.99) / 1e3)
+        .add("p999_us", s.percentile(0.999) / 1e3)
+        .add("max_us", s.maxNs / 1e3)
+        .print();
+}
+
+int main(int argc, char* argv[]) {
+    LoadConfig config;
+    config.host = benchOption(argc, argv, "host", config.host);
+    config.port = benchOption(argc, argv, "port", (long)config.port);
+    config.connections = std::max(1L, benchOption(argc, argv, "connections", (long)config.connections));
+    config.duration = std::atof(benchOption(argc, argv, "duration", std::string("10")).c_str());
+    config.warmup = std::atof(benchOption(argc, argv, "warmup", std::string("2")).c_str());
+    config.openLoop = benchOption(argc, argv, "mode", std::string("closed")) == "open";
+    config.rate = std::atof(benchOption(argc, argv, "rate", std::string("2000")).c_str());
+    config.filesPerUser = std::max(1L, benchOption(argc, argv, "files", (long)config.filesPerUser));
+    config.sizes.maxSize = benchOption(argc, argv, "max-size", (long)config.sizes.maxSize);
+    config.userPrefix = benchOption(argc, argv, "user-prefix", "load" + std::to_string(getpid()));
+
+    std::string mix = benchOption(argc, argv, "mix", std::string());
+    if (!mix.empty() && !parseMix(mix, config)) {
+        fprintf(stderr, "bad --mix '%s', expected e.g. create=10,read=50,write=20,list=10,expiry=10\n", mix.c_str());
+        return 1;
+    }
+    std::string sizes = benchOption(argc, argv, "sizes", std::string());
+    if (!sizes.empty() && !config.sizes.parse(sizes)) {
+        fprintf(stderr, "bad --sizes '%s', expected fixed:N, uniform:MIN:MAX or lognormal:MEDIAN:SIGMA\n", sizes.c_str());
+        return 1;
+    }
+    if (config.openLoop && config.rate <= 0) {
+        fprintf(stderr, "--rate must be positive in open-loop mode\n");
+        return 1;
+    }
+
+    BenchRandom rng;
+    payloadPool.resize(config.sizes.maxSize);
+    for (char& c : payloadPool) c = 'a' + rng.below(26);
+
+    std::vector<std::unique_ptr<LoadConnection>> connections;
+    for (int i = 0; i < config.connections; i++) {
+        connections.push_back(std::make_unique<LoadConnection>(config, i));
+    }
+
+    fprintf(stderr, "setting up %d connections\n", config.connections);
+    std::vector<std::thread> threads;
+    std::atomic<int> ready{0};
+    std::atomic<int> failed{0};
+    std::mutex startMutex;
+    std::condition_variable startSignal;
+    uint64_t measureFrom = 0;
+    uint64_t endAt = 0;
+    bool started = false;
+    int live = 0;
+
+    for (auto& connection : connections) {
+        threads.emplace_back([&, conn = connection.get()] {
+            bool ok = conn->setup();
+            if (!ok) {
+                fprintf(stderr, "connection setup failed: %s\n", conn->error.c_str());
+                failed++;
+            }
+            std::unique_lock<std::mutex> lock(startMutex);
+            conn->setupDone = true;
+            ready++;
+            startSignal.notify_all();
+            startSignal.wait(lock, [&] { return started; });
+            lock.unlock();
+            if (!ok) return;
+
+            if (config.openLoop) conn->runOpen(measureFrom, endAt, config.rate / live);
+            else conn->runClosed(measureFrom, endAt);
+        });
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(startMutex);
+        auto allReady = [&] { return ready.load() == config.connections; };
+        if (!startSignal.wait_for(lock, std::chrono::seconds(SETUP_TIMEOUT_SECONDS), allReady)) {
+            fprintf(stderr, "%d connections not served after %ds, dropping them\n",
+                    config.connections - ready.load(), SETUP_TIMEOUT_SECONDS);
+            for (auto& connection : connections) {
+                if (!connection->setupDone) connection->abort();
+            }
+            startSignal.wait(lock, allReady);
+        }
+        live = config.connections - failed.load();
+        uint64_t now = benchNow();
+        measureFrom = now + (uint64_t)(config.warmup * 1e9);
+        endAt = measureFrom + (uint64_t)(config.duration * 1e9);
+        started = true;
+    }
+    startSignal.notify_all();
+    fprintf(stderr, "running %s loop for %.1fs after %.1fs warmup\n",
+            config.openLoop ? "open" : "closed", config.duration, config.warmup);
+
+    for (auto& t : threads) t.join();
+    if (live == 0) return 1;
+
+    LoadStats total;
+    for (auto& connection : connections) total.merge(connection->stats);
+
+    LatencySnapshot all;
+    uint64_t allErrors = 0;
+    for (int op = 0; op < LOAD_OP_COUNT; op++) {
+        if (total.latency[op].count == 0) continue;
+        reportLine(LOAD_OP_NAMES[op], total.latency[op], total.errors[op], config.duration, config, live);
+        all.merge(total.latency[op]);
+        allErrors += total.errors[op];
+    }
+    reportLine("total", all, allErrors, config.duration, config, live);
+    return 0;
+}
@@ -0,0 +1,529 @@
+// Microbenchmarks for the core in-memory and on-disk structures.
+//
+// Build from the repository root:
+//
+//   g++ -std=c++17 -O2 -DNDEBUG -I. -Ifrontend -o micro_bench bench/micro_bench.cpp
+//       FileManager.cpp FileManagerDisk.cpp FileCache.cpp WriteBackBuffer.cpp BlockIO.cpp AlignedBuffer.cpp
+//       Compression.cpp Checksum.cpp BTree.cpp Logger.cpp Metrics.cpp Trace.cpp -pthread
+//
+// Run:
+//
+//   ./micro_bench [--only hashmap|heap|btree|disk|io|compress|checksum] [--max-size 10000000]
+//                 [--max-btree 100000] [--disk-files 64] [--io-mb 512] [--io-reads 20000] [--direct] [--keep]
+//
+// Each result is one JSON line:
+//
+//   {"bench":"hashmap.search","size":100000,"ops":100000,"ns_per_op":41.2,
+//    "ops_per_sec":24271844.7,"allocs_per_op":0.000,"bytes_per_op":0.000}
+//
+// Everything runs in a fresh directory under /tmp, with a sparse disk.bin,
+// so the server's data is never touched; --keep leaves the directory behind.
+// --direct runs the disk benchmarks with disk.bin opened O_DIRECT.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <fcntl.h>
+#include <new>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "BenchUtil.hpp"
+#include "../BTree.hpp"
+#include "../BlockIO.hpp"
+#include "../Checksum.hpp"
+#include "../Compression.hpp"
+#include "../FileManagerDisk.hpp"
+#include "../HashMap.hpp"
+#include "../Logger.hpp"
+#include "../MinHeap.hpp"
+
+// Every heap allocation in the process is counted, so a measured section
+// reports how many allocations each operation costs
+static std::atomic<uint64_t> allocationCount{0};
+static std::atomic<uint64_t> allocationBytes{0};
+
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+// Out of line, so the compiler never sees free() take what operator new
+// returned and warn of a mismatch
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+struct Measurement {
+    uint64_t ops = 0;
+    uint64_t ns = 0;
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+// Times body(), which performs ops operations
+template <typename Body>
+static Measurement measure(uint64_t ops, Body body) {
+    Measurement m;
+    m.ops = ops;
+    uint64_t allocsBefore = allocationCount.load(std::memory_order_relaxed);
+    uint64_t bytesBefore = allocationBytes.load(std::memory_order_relaxed);
+    uint64_t start = benchNow();
+    body();
+    m.ns = benchNow() - start;
+    m.allocations = allocationCount.load(std::memory_order_relaxed) - allocsBefore;
+    m.bytes = allocationBytes.load(std::memory_order_relaxed) - bytesBefore;
+    return m;
+}
+
+static void report(const char* bench, size_t size, const Measurement& m, size_t fileBytes = 0) {
+    double ops = m.ops ? (double)m.ops : 1.0;
+    double nsPerOp = m.ns / ops;
+    JsonLine line;
+    line.add("bench", bench).add("size", size);
+    if (fileBytes) line.add("file_bytes", fileBytes);
+    line.add("ops", m.ops)
+        .add("ns_per_op", nsPerOp)
+        .add("ops_per_sec", nsPerOp > 0 ? 1e9 / nsPerOp : 0.0);
+    if (fileBytes) line.add("mb_per_sec", nsPerOp > 0 ? fileBytes * 1e9 / nsPerOp / (1024 * 1024) : 0.0);
+    line.add("allocs_per_op", m.allocations / ops).add("bytes_per_op", m.bytes / ops).print();
+}
+
+// Keeps the optimizer from discarding a result
+static volatile uintptr_t sink;
+
+static std::vector<size_t> sizesUpTo(size_t limit) {
+    std::vector<size_t> sizes;
+    for (size_t n = 1000; n <= limit && n <= 10000000; n *= 10) sizes.push_back(n);
+    return sizes;
+}
+
+static std::vector<int> shuffledIds(size_t count, BenchRandom& rng) {
+    std::vector<int> ids(count);
+    for (size_t i = 0; i < count; i++) ids[i] = i + 1;
+    for (size_t i = count; i > 1; i--) std::swap(ids[i - 1], ids[rng.below(i)]);
+    return ids;
+}
+
+static FileEntry makeEntry(int fileId, time_t expireTime) {
+    FileEntry f;
+    f.fileId = fileId;
+    f.userId = 1;
+    f.ownerId = 1;
+    f.name = "f" + std::to_string(fileId);
+    f.createTime = 0;
+    f.expireTime = expireTime;
+    f.expired = false;
+    return f;
+}
+
+static void benchHashMap(size_t maxSize) {
+    for (size_t size : sizesUpTo(maxSize)) {
+        BenchRandom rng(size);
+        std::vector<int> ids = shuffledIds(size, rng);
+        std::vector<FileEntry> entries;
+        entries.reserve(size);
+        for (int id : ids) entries.push_back(makeEntry(id, 0));
+
+        HashMap<FileEntry> map;
+        report("hashmap.insert", size, measure(size, [&] {
+            for (const FileEntry& f : entries) map.insert(f);
+        }));
+
+        std::vector<int> probes(size);
+        for (size_t i = 0; i < size; i++) probes[i] = rng.below(size) + 1;
+        report("hashmap.search", size, measure(size, [&] {
+            for (int id : probes) sink = (uintptr_t)map.search(id);
+        }));
+
+        // Misses walk the whole probe run, which grows with the table
+        size_t misses = std::min<size_t>(size, 1000);
+        report("hashmap.search_miss", size, measure(misses, [&] {
+            for (size_t i = 0; i < misses; i++) sink = (uintptr_t)map.search(probes[i] + (int)size);
+        }));
+
+        report("hashmap.remove", size, measure(size, [&] {
+            for (int id : ids) sink = map.remove(id);
+        }));
+    }
+}
+
+// update() and remove() scan for the entry, so those runs are capped
+static void benchHeap(size_t maxSize) {
+    const size_t SCAN_OPS = 10000;
+    for (size_t size : sizesUpTo(std::min<size_t>(maxSize, 1000000))) {
+        BenchRandom rng(size);
+        std::vector<FileEntry> entries;
+        entries.reserve(size);
+        for (size_t i = 0; i < size; i++) entries.push_back(makeEntry(i + 1, rng.below(1000000)));
+
+        FileEntryHeap heap;
+        report("heap.push", size, measure(size, [&] {
+            for (FileEntry& f : entries) heap.push(&f);
+        }));
+
+        size_t scanOps = std::min(size / 2, SCAN_OPS);
+        std::vector<FileEntry*> targets(scanOps);
+        for (size_t i = 0; i < scanOps; i++) targets[i] = &entries[rng.below(size)];
+        report("heap.update", size, measure(scanOps, [&] {
+            for (FileEntry* f : targets) {
+                f->expireTime = rng.below(1000000);
+                heap.update(f);
+            }
+        }));
+
+        // Distinct entries, so each remove finds its target
+        std::vector<int> picks = shuffledIds(size, rng);
+        report("heap.remove", size, measure(scanOps, [&] {
+            for (size_t i = 0; i < scanOps; i++) heap.remove(&entries[picks[i] - 1]);
+        }));
+
+        size_t remaining = heap.size();
+        report("heap.extract_min", size, measure(remaining, [&] {
+            while (!heap.isEmpty()) sink = (uintptr_t)heap.extractMin();
+        }));
+    }
+}
+
+static void benchBTree(size_t maxSize) {
+    for (size_t size : sizesUpTo(maxSize)) {
+        BenchRandom rng(size);
+        std::vector<int> ids = shuffledIds(size, rng);
+        std::string path = "bench_btree_" + std::to_string(size) + ".dat";
+        unlink(path.c_str());
+
+        {
+            BTree tree(3, path);
+            report("btree.insert", size, measure(size, [&] {
+                for (int id : ids) tree.insert(id, id);
+            }));
+
+            size_t probes = std::min<size_t>(size, 100000);
+            report("btree.search", size, measure(probes, [&] {
+                for (size_t i = 0; i < probes; i++) sink = (uintptr_t)tree.search(rng.below(size) + 1);
+            }));
+
+            const int SCANS = 3;
+            report("btree.get_all_file_ids", size, measure(SCANS, [&] {
+                for (int i = 0; i < SCANS; i++) sink = tree.getAllFileIds().size();
+            }));
+
+            size_t removals = std::min<size_t>(size, 10000);
+            report("btree.remove", size, measure(removals, [&] {
+                for (size_t i = 0; i < removals; i++) sink = tree.remove(ids[i]);
+            }));
+        }
+        unlink(path.c_str());
+    }
+}
+
+static void runDiskBenchmarks(FileManagerDisk& disk, size_t fileCount) {
+    report("disk.allocate_file_id", 0, measure(100000, [&] {
+        for (int i = 0; i < 100000; i++) sink = disk.allocateFileId();
+    }));
+
+    const size_t fileSizes[] = {1024, 16 * 1024, 200 * 1024, 1024 * 1024, 8 * 1024 * 1024};
+    BenchRandom rng;
+    for (size_t bytes : fileSizes) {
+        // Keep each size's working set around 256 MB
+        size_t count = std::max<size_t>(1, std::min(fileCount, (256u << 20) / bytes));
+        std::string content(bytes, '\0');
+        for (char& c : content) c = 'a' + rng.below(26);
+
+        std::vector<FileEntry> files;
+        for (size_t i = 0; i < count; i++) {
+            FileEntry f = makeEntry(disk.allocateFileId(), time(nullptr) + 3600);
+            f.content = content;
+            files.push_back(f);
+        }
+
+        report("disk.save_new", count, measure(count, [&] {
+            for (const FileEntry& f : files) disk.saveFile(f);
+        }), bytes);
+
+        report("disk.save_overwrite", count, measure(count, [&] {
+            for (const FileEntry& f : files) disk.saveFile(f);
+        }), bytes);
+
+        report("disk.load", count, measure(count, [&] {
+            for (const FileEntry& f : files) delete disk.loadFile(f.fileId);
+        }), bytes);
+
+        report("disk.delete", count, measure(count, [&] {
+            for (const FileEntry& f : files) disk.deleteFile(f.fileId);
+        }), bytes);
+    }
+}
+
+// A sparse disk.bin skips the 2 GB format pass
+static bool createSparseDisk() {
+    int fd = open("disk.bin", O_RDWR | O_CREAT, 0644);
+    if (fd == -1 || ftruncate(fd, DISK_SIZE) != 0) {
+        perror("disk.bin");
+        if (fd != -1) close(fd);
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+static void benchDisk(size_t fileCount, bool direct) {
+    if (!createSparseDisk()) return;
+    {
+        FileManagerDisk disk("disk.bin", IoBackend::AUTO, direct);
+        runDiskBenchmarks(disk, fileCount);
+    }
+}
+
+// Random 4 KiB reads of a file dropped from the page cache, keeping depth
+// reads in flight with submit(). Completions run on an executor, the way
+// a server would take them. The sync backend runs each submitted batch on
+// that executor's one thread, so it stays at depth 1 whatever is asked.
+//
+// Then random 4 KiB writes in batches of depth, each made durable with a
+// SYNC: linked behind the writes in the same run(), and as a run() of its
+// own after them.
+static void benchIO(size_t fileMB, size_t reads) {
+    const size_t readSize = 4096;
+    const size_t fileBytes = std::max<size_t>(1, fileMB) << 20;
+
+    int fd = open("io.bin", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("io.bin");
+        return;
+    }
+    BenchRandom rng;
+    std::string chunk(1 << 20, '\0');
+    for (char& c : chunk) c = 'a' + rng.below(26);
+    for (size_t written = 0; written < fileBytes; written += chunk.size()) {
+        if (pwrite(fd, chunk.data(), chunk.size(), written) != (ssize_t)chunk.size()) {
+            perror("io.bin");
+            close(fd);
+            return;
+        }
+    }
+    fdatasync(fd);
+
+    for (IoBackend backend : {IoBackend::SYNC, IoBackend::URING}) {
+        RequestExecutor completions(1);
+        BlockIO* io = BlockIO::create(fd, backend, completions);
+        std::string name = std::string("io.random_read.") + io->name();
+
+        for (size_t depth : {1, 4, 16, 64}) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            std::vector<char> buffers(depth * readSize);
+            std::vector<struct iovec> iov(depth);
+            std::vector<std::vector<IoRequest>> slots(depth);
+            std::mutex mutex;
+            std::condition_variable allDone;
+            size_t issued = 0;
+            size_t completed = 0;
+
+            std::function<void(size_t)> issue = [&](size_t slot) {
+                iov[slot] = {&buffers[slot * readSize], readSize};
+                off_t offset;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    offset = (off_t)rng.below(fileBytes / readSize) * readSize;
+                }
+                slots[slot] = {IoRequest{IoOp::READ, &iov[slot], 1, offset, readSize}};
+                io->submit(slots[slot], [&, slot](bool) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    completed++;
+                    if (issued < reads) {
+                        issued++;
+                        lock.unlock();
+                        issue(slot);
+                    } else if (completed == reads) {
+                        allDone.notify_one();
+                    }
+                });
+            };
+
+            report(name.c_str(), depth, measure(reads, [&] {
+                size_t first = std::min(depth, reads);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    issued = first;
+                }
+                for (size_t slot = 0; slot < first; slot++) issue(slot);
+                std::unique_lock<std::mutex> lock(mutex);
+                allDone.wait(lock, [&] { return completed == reads; });
+            }));
+        }
+
+        for (bool linked : {true, false}) {
+            std::string writeName = std::string(linked ? "io.write_linked_sync." : "io.write_then_sync.") + io->name();
+            for (size_t depth : {1, 16, 64}) {
+                size_t rounds = std::max<size_t>(1, reads / 64);
+                std::vector<struct iovec> iov(depth, {&chunk[0], readSize});
+                std::vector<IoRequest> batch;
+                const std::vector<IoRequest> sync = {IoRequest{IoOp::SYNC, nullptr, 0, 0, 0}};
+
+                report(writeName.c_str(), depth, measure(rounds * depth, [&] {
+                    for (size_t round = 0; round < rounds; round++) {
+                        batch.clear();
+                        for (size_t slot = 0; slot < depth; slot++) {
+                            off_t offset = (off_t)rng.below(fileBytes / readSize) * readSize;
+                            batch.push_back(IoRequest{IoOp::WRITE, &iov[slot], 1, offset, readSize});
+                        }
+                        if (linked) {
+                            batch.push_back(sync[0]);
+                            io->run(batch);
+                        } else {
+                            io->run(batch);
+                            io->run(sync);
+                        }
+                    }
+                }));
+            }
+        }
+        delete io;
+    }
+    close(fd);
+    unlink("io.bin");
+}
+
+// Words drawn from a small vocabulary stand in for text; random letters
+// stand in for content the codec cannot shrink
+static std::string synthesize(size_t size, bool text, BenchRandom& rng) {
+    static const char* const WORDS[] = {"the", "file", "server", "block", "user", "data", "disk", "cache",
+                                        "request", "index", "of", "and", "to", "a", "in", "is", "for"};
+    std::string out;
+    while (out.size() < size) {
+        if (text) {
+            out += WORDS[rng.below(sizeof(WORDS) / sizeof(WORDS[0]))];
+            out += rng.below(12) == 0 ? ".\n" : " ";
+        } else {
+            out += (char)('a' + rng.below(26));
+        }
+    }
+    out.resize(size);
+    return out;
+}
+
+static void benchCompression() {
+    const size_t sizes[] = {4 * 1024, 64 * 1024, 1024 * 1024};
+    BenchRandom rng;
+    for (bool text : {true, false}) {
+        for (size_t size : sizes) {
+            std::string data = synthesize(size, text, rng);
+            std::string compressed;
+            std::string restored;
+            int rounds = std::max<size_t>(8, (64u << 20) / size);
+
+            // With the limit a save uses, so random data shows how soon it gives up
+            report(text ? "compress.text" : "compress.random", size, measure(rounds, [&] {
+                for (int i = 0; i < rounds; i++) Compression::compress(data.data(), size, compressed, size / 8 * 7);
+            }), size);
+            Compression::compress(data.data(), size, compressed, SIZE_MAX);
+            report(text ? "decompress.text" : "decompress.random", size, measure(rounds, [&] {
+                for (int i = 0; i < rounds; i++) Compression::decompress(compressed.data(), compressed.size(), restored);
+            }), size);
+            if (size > COMPRESS_PROBE_SIZE) {
+                report(text ? "compress_probe.text" : "compress_probe.random", size, measure(rounds, [&] {
+                    for (int i = 0; i < rounds; i++) sink = Compression::worthCompressing(data.data(), size);
+                }), size);
+            }
+            JsonLine()
+                .add("bench", text ? "compress_ratio.text" : "compress_ratio.random")
+                .add("size", size)
+                .add("ratio", (double)size / compressed.size())
+                .add("roundtrip", restored == data ? "ok" : "FAILED")
+                .print();
+        }
+    }
+}
+
+// CRC-32C throughput, as dispatched and table-driven, at a block's worth
+// among other sizes; then what verifying costs a read: uncached loads of
+// 1 MB files, whose disk.bin pages are in memory so the read itself is as
+// cheap as it gets, against checksumming the same bytes alone
+static void benchChecksum() {
+    const size_t dataPerBlock = BLOCK_SIZE - sizeof(BlockMetadata);
+    const size_t sizes[] = {64, 4 * 1024, dataPerBlock, 1024 * 1024};
+    BenchRandom rng;
+    std::string data = synthesize(1024 * 1024, false, rng);
+    for (size_t size : sizes) {
+        uint64_t rounds = std::max<size_t>(16, (256u << 20) / size);
+        report("crc32c", size, measure(rounds, [&] {
+            for (uint64_t i = 0; i < rounds; i++) sink = Checksum::crc32c(data.data(), size, (uint32_t)i);
+        }), size);
+        rounds = std::max<uint64_t>(16, rounds / 16);
+        report("crc32c.portable", size, measure(rounds, [&] {
+            for (uint64_t i = 0; i < rounds; i++) sink = Checksum::crc32cPortable(data.data(), size, (uint32_t)i);
+        }), size);
+    }
+
+    if (!createSparseDisk()) return;
+    FileManagerDisk disk("disk.bin", IoBackend::AUTO);
+    disk.getCache().setCapacity(0);
+    const size_t count = 64;
+    std::vector<int> ids;
+    for (size_t i = 0; i < count; i++) {
+        FileEntry f = makeEntry(disk.allocateFileId(), time(nullptr) + 3600);
+        f.content = data;
+        if (disk.saveFile(f)) ids.push_back(f.fileId);
+    }
+    for (int id : ids) delete disk.loadFile(id);
+
+    const int rounds = 8;
+    Measurement load = measure(rounds * ids.size(), [&] {
+        for (int i = 0; i < rounds; i++) {
+            for (int id : ids) delete disk.loadFile(id);
+        }
+    });
+    report("disk.load_verified", ids.size(), load, data.size());
+    size_t blocks = (data.size() + dataPerBlock - 1) / dataPerBlock;
+    Measurement crc = measure(rounds * ids.size(), [&] {
+        for (size_t i = 0; i < rounds * ids.size(); i++) {
+            for (size_t b = 0; b < blocks; b++) {
+                size_t at = b * dataPerBlock;
+                sink = Checksum::crc32c(data.data() + at, std::min(dataPerBlock, data.size() - at));
+            }
+        }
+    });
+    report("disk.load_checksum_share", ids.size(), crc, data.size());
+    JsonLine()
+        .add("bench", "checksum_read_overhead")
+        .add("size", data.size())
+        .add("percent", load.ns ? 100.0 * crc.ns / load.ns : 0.0)
+        .print();
+    for (int id : ids) disk.deleteFile(id);
+}
+
+int main(int argc, char* argv[]) {
+    Logger::setLevel(LogLevel::WARN);
+
+    std::string only = benchOption(argc, argv, "only", std::string());
+    size_t maxSize = benchOption(argc, argv, "max-size", 1000000L);
+    size_t maxBTree = benchOption(argc, argv, "max-btree", 100000L);
+    size_t diskFiles = benchOption(argc, argv, "disk-files", 64L);
+    size_t ioMB = benchOption(argc, argv, "io-mb", 512L);
+    size_t ioReads = std::max(1L, benchOption(argc, argv, "io-reads", 20000L));
+    std::string dir = benchTempDir("fms-bench");
+
+    if (only.empty() || only == "hashmap") benchHashMap(maxSize);
+    if (only.empty() || only == "heap") benchHeap(maxSize);
+    if (only.empty() || only == "btree") benchBTree(std::min(maxSize, maxBTree));
+    if (only.empty() || only == "disk") benchDisk(diskFiles, benchFlag(argc, argv, "direct"));
+    if (only.empty() || only == "io") benchIO(ioMB, ioReads);
+    if (only.empty() || only == "compress") benchCompression();
+    if (only.empty() || only == "checksum") benchChecksum();
+
+    if (benchFlag(argc, argv, "keep")) {
+        fprintf(stderr, "kept %s\n", dir.c_str());
+    } else {
+        for (const char* name : {"disk.bin", "btree.dat", "bitmap.dat", "fileid.dat", "checksums.dat", "dedup.dat"}) unlink(name);
+        if (chdir("/") != 0 || rmdir(dir.c_str()) != 0) fprintf(stderr, "could not remove %s\n", dir.c_str());
+    }
+
+    Logger::shutdown();
+    return 0;
+}
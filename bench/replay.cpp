@@ -0,0 +1,369 @@
+// Replays a capture recorded with `server --capture <file>` against a test
+// server and reports per-command latency.
+//
+// Build from the repository root:
+//
+//   g++ -std=c++17 -O2 -I. -Ifrontend -o replay bench/replay.cpp Metrics.cpp -pthread
+//
+// Run:
+//
+//   ./replay --capture traffic.cap [--host 127.0.0.1] [--port 8080]
+//            [--pace original|max] [--speed 1.0] [--baseline earlier.jsonl]
+//
+// Each captured connection is re-opened at its original start time and its
+// requests are sent byte for byte. With --pace original they go out at the
+// recorded offsets (divided by --speed) and latency is measured from that
+// scheduled time; with --pace max every connection sends as fast as the
+// server accepts. Captured logins only work if the test server starts from
+// a copy of the data the production server had when the capture began.
+//
+// Output is one JSON line per command plus a "total" line. Save a run's
+// output and pass it as --baseline to a later run to get, per command, the
+// change in p50/p99/p999 as percentages.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "BenchUtil.hpp"
+#include "../Capture.hpp"
+#include "../Metrics.hpp"
+
+// Outstanding binary requests per connection, like the server's own limit
+const int REPLAY_MAX_IN_FLIGHT = 64;
+// Connections open this long before their first request, so the server's
+// delay in picking up a new connection is not charged to that request
+const uint64_t REPLAY_CONNECT_LEAD_NS = 250000000;
+
+struct ReplayRequest {
+    uint64_t offsetNs;
+    CaptureKind kind;
+    std::string data;   // binary frames carry their length prefix again, so one send covers them
+};
+
+struct ReplayStats {
+    LatencySnapshot latency[MAX_TIMED_OPS];
+    uint64_t errors[MAX_TIMED_OPS] = {};
+
+    void record(Opcode op, uint64_t ns, bool ok) {
+        int index = (int)op < MAX_TIMED_OPS ? (int)op : 0;
+        latency[index].add(ns);
+        if (!ok) errors[index]++;
+    }
+};
+
+struct ReplayConfig {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    bool originalPace = true;
+    double speed = 1.0;
+};
+
+static bool sendAll(int sock, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = ::send(sock, data, length, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+static bool readExact(int sock, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t got = ::read(sock, data, length);
+        if (got <= 0) return false;
+        data += got;
+        length -= got;
+    }
+    return true;
+}
+
+// Reads a text-protocol reply: one read, then whatever else arrives without
+// waiting, since the server writes each reply with a single send
+static bool readTextReply(int sock, std::string& reply) {
+    char chunk[65536];
+    ssize_t got = ::read(sock, chunk, sizeof(chunk));
+    if (got <= 0) return false;
+    reply.assign(chunk, got);
+    while ((got = ::recv(sock, chunk, sizeof(chunk), MSG_DONTWAIT)) > 0) reply.append(chunk, got);
+    return true;
+}
+
+class ReplayConnection {
+private:
+    const ReplayConfig& config;
+    std::vector<ReplayRequest> requests;
+    int sock = -1;
+
+    struct Pending {
+        uint64_t sentAt;
+        Opcode op;
+    };
+    std::mutex pendingMutex;
+    std::condition_variable pendingChanged;
+    std::unordered_map<uint32_t, Pending> pending;
+    bool receiverDone = false;
+
+    uint64_t sendTime(uint64_t replayStart, uint64_t offsetNs) {
+        if (!config.originalPace) return benchNow();
+        uint64_t due = replayStart + (uint64_t)(offsetNs / config.speed);
+        uint64_t now = benchNow();
+        if (due > now) std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+        return due;
+    }
+
+    bool connectToServer() {
+        sock = ::socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(config.port);
+        if (sock == -1 || inet_pton(AF_INET, config.host.c_str(), &addr.sin_addr) <= 0 ||
+            ::connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            if (sock != -1) ::close(sock);
+            sock = -1;
+            return false;
+        }
+        return true;
+    }
+
+    void receiveFrames() {
+        std::vector<char> buffer;
+        while (true) {
+            char lengthBytes[FRAME_LENGTH_SIZE];
+            if (!readExact(sock, lengthBytes, FRAME_LENGTH_SIZE)) break;
+            uint32_t length = getU32(lengthBytes);
+            if (length > MAX_FRAME_SIZE || length < FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE) break;
+            buffer.resize(length);
+            if (!readExact(sock, buffer.data(), length)) break;
+            uint64_t now = benchNow();
+
+            Opcode status = static_cast<Opcode>(static_cast<uint8_t>(buffer[1]));
+            uint32_t requestId = getU32(buffer.data() + 4);
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            auto it = pending.find(requestId);
+            if (it == pending.end()) continue;
+            stats.record(it->second.op, now - it->second.sentAt, status != Opcode::FAILURE);
+            pending.erase(it);
+            pendingChanged.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        receiverDone = true;
+        pendingChanged.notify_all();
+    }
+
+    // Waits until at most limit binary requests are outstanding
+    void waitForPending(size_t limit) {
+        std::unique_lock<std::mutex> lock(pendingMutex);
+        pendingChanged.wait(lock, [&] { return receiverDone || pending.size() <= limit; });
+    }
+
+public:
+    ReplayStats stats;
+    uint64_t failedSends = 0;
+
+    explicit ReplayConnection(const ReplayConfig& cfg) : config(cfg) {}
+
+    void add(ReplayRequest request) { requests.push_back(std::move(request)); }
+    uint64_t firstOffset() const { return requests.empty() ? 0 : requests.front().offsetNs; }
+
+    void run(uint64_t replayStart) {
+        if (config.originalPace) {
+            uint64_t connectAt = replayStart - REPLAY_CONNECT_LEAD_NS + (uint64_t)(firstOffset() / config.speed);
+            uint64_t now = benchNow();
+            if (connectAt > now) std::this_thread::sleep_for(std::chrono::nanoseconds(connectAt - now));
+        }
+        if (!connectToServer()) {
+            failedSends += requests.size();
+            return;
+        }
+
+        std::thread receiver;
+        for (size_t i = 0; i < requests.size(); i++) {
+            const ReplayRequest& request = requests[i];
+            if (request.kind == CaptureKind::CLOSE) break;
+
+            if (request.kind == CaptureKind::TEXT) {
+                // The text protocol is strictly request/reply
+                uint64_t start = sendTime(replayStart, request.offsetNs);
+                size_t end = request.data.find(DELIMITER[0]);
+                Opcode op = opcodeFromName(std::string_view(request.data).substr(0, end));
+                std::string reply;
+                if (!sendAll(sock, request.data.data(), request.data.size()) || !readTextReply(sock, reply)) {
+                    failedSends += requests.size() - i;
+                    break;
+                }
+                bool ok = reply.compare(0, RESP_FAILURE.size(), RESP_FAILURE) != 0;
+                stats.record(op, benchNow() - start, ok);
+                if (op == Opcode::HELLO && ok && !receiver.joinable()) {
+                    receiver = std::thread([this] { receiveFrames(); });
+                }
+                continue;
+            }
+
+            if (request.data.size() < FRAME_HEADER_SIZE || !receiver.joinable()) {
+                failedSends++;
+                continue;
+            }
+            waitForPending(REPLAY_MAX_IN_FLIGHT - 1);
+            uint64_t start = sendTime(replayStart, request.offsetNs);
+            const char* frame = request.data.data() + FRAME_LENGTH_SIZE;
+            Opcode op = static_cast<Opcode>(static_cast<uint8_t>(frame[1]));
+            {
+                std::lock_guard<std::mutex> lock(pendingMutex);
+                pending[getU32(frame + 4)] = {start, op};
+            }
+            if (!sendAll(sock, request.data.data(), request.data.size())) {
+                failedSends += requests.size() - i;
+                break;
+            }
+        }
+
+        if (receiver.joinable()) {
+            waitForPending(0);
+            ::shutdown(sock, SHUT_RDWR);
+            receiver.join();
+        }
+        ::close(sock);
+    }
+};
+
+// Reads the p50/p99/p999 fields of an earlier run's output, keyed by op
+static std::map<std::string, std::vector<double>> loadBaseline(const std::string& path) {
+    static const char* const KEYS[] = {"p50_us", "p99_us", "p999_us"};
+    std::map<std::string, std::vector<double>> baseline;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t op = line.find("\"op\":\"");
+        if (op == std::string::npos || line.find("\"compare\"") != std::string::npos) continue;
+        op += 6;
+        std::string name = line.substr(op, line.find('"', op) - op);
+        std::vector<double> values;
+        for (const char* key : KEYS) {
+            size_t at = line.find(std::string("\"") + key + "\":");
+            values.push_back(at == std::string::npos ? 0 : std::atof(line.c_str() + at + std::strlen(key) + 3));
+        }
+        baseline[name] = values;
+    }
+    return baseline;
+}
+
+static double changePercent(double now, double before) {
+    return before > 0 ? (now - before) * 100.0 / before : 0.0;
+}
+
+static void reportLine(const std::string& op, const LatencySnapshot& s, uint64_t errors, double seconds,
+                       const std::map<std::string, std::vector<double>>& baseline) {
+    JsonLine()
+        .add("op", op)
+        .add("count", (size_t)s.count)
+        .add("errors", (size_t)errors)
+        .add("ops_per_sec", seconds > 0 ? s.count / seconds : 0.0)
+        .add("mean_us", s.count ? s.sumNs / 1e3 / s.count : 0.0)
+        .add("p50_us", s.percentile(0.50) / 1e3)
+        .add("p99_us", s.percentile(0.99) / 1e3)
+        .add("p999_us", s.percentile(0.999) / 1e3)
+        .add("max_us", s.maxNs / 1e3)
+        .print();
+
+    auto before = baseline.find(op);
+    if (before == baseline.end()) return;
+    JsonLine()
+        .add("op", op)
+        .add("compare", "baseline")
+        .add("p50_change_pct", changePercent(s.percentile(0.50) / 1e3, before->second[0]))
+        .add("p99_change_pct", changePercent(s.percentile(0.99) / 1e3, before->second[1]))
+        .add("p999_change_pct", changePercent(s.percentile(0.999) / 1e3, before->second[2]))
+        .print();
+}
+
+int main(int argc, char* argv[]) {
+    ReplayConfig config;
+    std::string capturePath = benchOption(argc, argv, "capture", std::string());
+    config.host = benchOption(argc, argv, "host", config.host);
+    config.port = benchOption(argc, argv, "port", (long)config.port);
+    config.originalPace = benchOption(argc, argv, "pace", std::string("original")) != "max";
+    config.speed = std::atof(benchOption(argc, argv, "speed", std::string("1")).c_str());
+    std::string baselinePath = benchOption(argc, argv, "baseline", std::string());
+
+    if (capturePath.empty() || config.speed <= 0) {
+        fprintf(stderr, "usage: %s --capture <file> [--host H] [--port P] [--pace original|max] "
+                        "[--speed X] [--baseline earlier.jsonl]\n", argv[0]);
+        return 1;
+    }
+
+    CaptureReader reader;
+    if (!reader.open(capturePath)) {
+        fprintf(stderr, "%s is not a capture file\n", capturePath.c_str());
+        return 1;
+    }
+
+    // Connections in order of first appearance
+    std::map<uint32_t, size_t> connectionIndex;
+    std::vector<std::unique_ptr<ReplayConnection>> connections;
+    CaptureRecord record;
+    size_t records = 0;
+    uint64_t capturedNs = 0;
+    while (reader.next(record)) {
+        auto it = connectionIndex.find(record.connection);
+        if (it == connectionIndex.end()) {
+            it = connectionIndex.emplace(record.connection, connections.size()).first;
+            connections.push_back(std::make_unique<ReplayConnection>(config));
+        }
+        capturedNs = std::max(capturedNs, record.offsetNs);
+        if (record.kind == CaptureKind::BINARY) {
+            char lengthBytes[FRAME_LENGTH_SIZE];
+            putU32(lengthBytes, record.data.size());
+            record.data.insert(0, lengthBytes, FRAME_LENGTH_SIZE);
+        }
+        connections[it->second]->add({record.offsetNs, record.kind, std::move(record.data)});
+        records++;
+    }
+    fprintf(stderr, "replaying %zu records on %zu connections spanning %.1fs, %s pace\n",
+            records, connections.size(), capturedNs / 1e9, config.originalPace ? "original" : "max");
+
+    std::map<std::string, std::vector<double>> baseline;
+    if (!baselinePath.empty()) baseline = loadBaseline(baselinePath);
+
+    uint64_t start = benchNow() + (config.originalPace ? REPLAY_CONNECT_LEAD_NS : 0);
+    std::vector<std::thread> threads;
+    for (auto& connection : connections) {
+        threads.emplace_back([&, conn = connection.get()] { conn->run(start); });
+    }
+    for (auto& t : threads) t.join();
+    double seconds = (benchNow() - start) / 1e9;
+
+    ReplayStats total;
+    uint64_t failedSends = 0;
+    for (auto& connection : connections) {
+        for (int op = 0; op < MAX_TIMED_OPS; op++) {
+            total.latency[op].merge(connection->stats.latency[op]);
+            total.errors[op] += connection->stats.errors[op];
+        }
+        failedSends += connection->failedSends;
+    }
+
+    LatencySnapshot all;
+    uint64_t allErrors = 0;
+    for (int op = 0; op < MAX_TIMED_OPS; op++) {
+        if (total.latency[op].count == 0) continue;
+        reportLine(std::string(opcodeName((Opcode)op)), total.latency[op], total.errors[op], seconds, baseline);
+        all.merge(total.latency[op]);
+        allErrors += total.errors[op];
+    }
+    reportLine("total", all, allErrors, seconds, baseline);
+    if (failedSends) fprintf(stderr, "%llu requests could not be sent\n", (unsigned long long)failedSends);
+    return 0;
+}
@@ -0,0 +1,324 @@
+// Startup and first-login benchmark on a synthesized data directory.
+//
+// Build from the repository root:
+//
+//   g++ -std=c++17 -O2 -DNDEBUG -I. -Ifrontend -o startup_bench bench/startup_bench.cpp
+//       FileManager.cpp FileManagerDisk.cpp FileCache.cpp WriteBackBuffer.cpp BlockIO.cpp AlignedBuffer.cpp
+//       Compression.cpp Checksum.cpp BTree.cpp UserManager.cpp Logger.cpp Metrics.cpp Trace.cpp -pthread
+//
+// Run:
+//
+//   ./startup_bench [--files 1000,10000,40000] [--users 1000]
+//                   [--sizes fixed:1024,uniform:1:49152,lognormal:4096:1.5]
+//                   [--max-size 8388608] [--logins 5] [--warm] [--keep]
+//
+// For every combination of file count and size distribution, a fresh data
+// directory is written the way the server would write it (disk.bin,
+// btree.dat, bitmap.dat, fileid.dat, users.dat) with files spread uniformly
+// over the users. Then a clean process opens it the way main() does and logs
+// in: first one user, then --logins more, unloading each in between as
+// LOGOUT does. Result lines look like:
+//
+//   {"bench":"startup","files_requested":10000,"files":10000,"users":1000,
+//    "sizes":"fixed:1024","data_mb":9.8,"build_ms":812.4,"cache":"cold",
+//    "disk_open_ms":31.2,"users_load_ms":1.9,"start_ms":33.1,
+//    "rss_base_kb":3912,"rss_start_kb":9210,"first_login_ms":402.7,
+//    "first_login_files":11,"login_mean_ms":96.3,"rss_login_kb":9876,
+//    "peak_rss_kb":9876}
+//
+// Cold runs fsync the data files and drop them from the page cache first,
+// which needs no privileges; --warm skips that. disk.bin is created sparse.
+// It holds TOTAL_BLOCKS blocks and every file takes at least one, so larger
+// file counts, or sizes that fill the disk early, are capped and the line
+// reports both the requested and the written count.
+//
+// Writing and measuring each run in its own child process keeps the
+// measured RSS free of whatever the synthesis left allocated.
+
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "BenchUtil.hpp"
+#include "../FileManager.hpp"
+#include "../FileManagerDisk.hpp"
+#include "../Logger.hpp"
+#include "../UserManager.hpp"
+#include "../UserManagerDisk.hpp"
+
+static const char* const DATA_FILES[] = {"disk.bin", "btree.dat", "bitmap.dat", "fileid.dat", "users.dat"};
+const int SYNTH_BATCH = 1000;      // files per beginBatch()/commitBatch()
+const long SYNTH_MAX_SIZE = 8 * 1024 * 1024;
+
+struct StartupRun {
+    size_t filesRequested = 0;
+    int users = 0;
+    std::string sizeSpec;
+    SizeDistribution sizes;
+    int logins = 0;
+    bool warm = false;
+};
+
+// What the synthesis child hands back through a pipe
+struct SynthResult {
+    size_t files = 0;
+    size_t bytes = 0;
+    uint64_t ns = 0;
+};
+
+static std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+// A field of /proc/self/status in kB, or 0 if it cannot be read
+static long statusKb(const char* field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    size_t length = strlen(field);
+    while (std::getline(status, line)) {
+        if (line.compare(0, length, field) == 0 && line.size() > length && line[length] == ':') {
+            return std::atol(line.c_str() + length + 1);
+        }
+    }
+    return 0;
+}
+
+static void dropFromCache(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static std::string userName(int userId) { return "user" + std::to_string(userId); }
+static std::string userPassword(int userId) { return "pw" + std::to_string(userId); }
+
+static SynthResult synthesize(const StartupRun& run) {
+    SynthResult result;
+    uint64_t start = benchNow();
+
+    int fd = open("disk.bin", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, DISK_SIZE) != 0) {
+        perror("disk.bin");
+        return result;
+    }
+    close(fd);
+
+    UserManagerDisk users("users.dat");
+    for (int id = 1; id <= run.users; id++) {
+        User user;
+        user.userId = id;
+        user.username = userName(id);
+        user.password = userPassword(id);
+        users.saveUser(user);
+    }
+
+    BenchRandom rng(run.filesRequested * 31 + run.sizeSpec.size());
+    std::string pool(run.sizes.maxSize, '\0');
+    for (char& c : pool) c = 'a' + rng.below(26);
+
+    const size_t dataPerBlock = BLOCK_SIZE - sizeof(BlockMetadata);
+    FileManagerDisk disk("disk.bin");
+    time_t now = time(nullptr);
+
+    disk.beginBatch();
+    while (result.files < run.filesRequested) {
+        size_t size = run.sizes.sample(rng);
+        // Name and header come to well under a block's spare room
+        size_t blocks = (size + 64 + dataPerBlock - 1) / dataPerBlock;
+        if ((size_t)disk.getFreeBlocks() < blocks) break;
+
+        FileEntry f;
+        f.fileId = disk.allocateFileId();
+        f.userId = f.ownerId = 1 + rng.below(run.users);
+        f.name = "file" + std::to_string(f.fileId);
+        f.content.assign(pool, rng.below(pool.size() - size + 1), size);
+        f.createTime = now;
+        f.expireTime = now + 86400 + rng.below(86400);
+        f.expired = false;
+        if (f.fileId == -1 || !disk.saveFile(f)) break;
+
+        result.files++;
+        result.bytes += size;
+        if (result.files % SYNTH_BATCH == 0) {
+            disk.commitBatch();
+            fprintf(stderr, "  wrote %zu/%zu files\r", result.files, run.filesRequested);
+            disk.beginBatch();
+        }
+    }
+    disk.commitBatch();
+    fprintf(stderr, "  wrote %zu files\n", result.files);
+
+    result.ns = benchNow() - start;
+    return result;
+}
+
+// Opens the directory the way main() does and logs users in the way LOGIN does
+static void measure(const StartupRun& run, const SynthResult& synth) {
+    // The disk and user layers announce themselves on stdout
+    std::cout.rdbuf(std::cerr.rdbuf());
+
+    if (!run.warm) {
+        for (const char* name : DATA_FILES) dropFromCache(name);
+    }
+    long rssBase = statusKb("VmRSS");
+
+    uint64_t t0 = benchNow();
+    FileManagerDisk* disk = new FileManagerDisk("./disk.bin");
+    uint64_t t1 = benchNow();
+    UserManager* um = new UserManager();
+    UserManagerDisk* userDisk = new UserManagerDisk("./users.dat");
+    um->setDiskManager(userDisk);
+    userDisk->loadAllUsers(*um);
+    FileManager* fm = new FileManager(-1);
+    fm->setDiskManager(disk);
+    uint64_t t2 = benchNow();
+    long rssStart = statusKb("VmRSS");
+
+    BenchRandom rng(run.users);
+    uint64_t firstLogin = 0;
+    size_t firstLoginFiles = 0;
+    uint64_t laterLogins = 0;
+    for (int i = 0; i <= run.logins; i++) {
+        int userId = i == 0 ? 1 : 1 + rng.below(run.users);
+        uint64_t start = benchNow();
+        int loggedIn = um->loginUser(userName(userId), userPassword(userId));
+        if (loggedIn == -1) {
+            fprintf(stderr, "login failed for %s\n", userName(userId).c_str());
+            break;
+        }
+        fm->setCurrentUser(loggedIn);
+        fm->loadUserFiles(loggedIn);
+        uint64_t elapsed = benchNow() - start;
+
+        if (i == 0) {
+            firstLogin = elapsed;
+            firstLoginFiles = fm->getActiveFiles().size() + fm->getBinFiles().size();
+        } else {
+            laterLogins += elapsed;
+        }
+        fm->unloadUserFiles(loggedIn);
+    }
+    long rssLogin = statusKb("VmRSS");
+
+    JsonLine()
+        .add("bench", "startup")
+        .add("files_requested", run.filesRequested)
+        .add("files", synth.files)
+        .add("users", run.users)
+        .add("sizes", run.sizeSpec)
+        .add("data_mb", synth.bytes / (1024.0 * 1024.0))
+        .add("build_ms", synth.ns / 1e6)
+        .add("cache", run.warm ? "warm" : "cold")
+        .add("disk_open_ms", (t1 - t0) / 1e6)
+        .add("users_load_ms", (t2 - t1) / 1e6)
+        .add("start_ms", (t2 - t0) / 1e6)
+        .add("rss_base_kb", rssBase)
+        .add("rss_start_kb", rssStart)
+        .add("first_login_ms", firstLogin / 1e6)
+        .add("first_login_files", firstLoginFiles)
+        .add("login_mean_ms", run.logins > 0 ? laterLogins / 1e6 / run.logins : 0.0)
+        .add("rss_login_kb", rssLogin)
+        .add("peak_rss_kb", statusKb("VmHWM"))
+        .print();
+
+    delete fm;
+    delete um;
+    delete userDisk;
+    delete disk;
+}
+
+// Runs body in a child process and waits for it; false if it did not exit cleanly
+template <typename Body>
+static bool inChild(Body body) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return false;
+    }
+    if (pid == 0) {
+        body();
+        Logger::shutdown();
+        fflush(stdout);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    Logger::setLevel(LogLevel::WARN);
+
+    std::vector<std::string> fileCounts = splitList(benchOption(argc, argv, "files", std::string("1000,10000,40000")));
+    std::vector<std::string> sizeSpecs = splitList(benchOption(argc, argv, "sizes",
+        std::string("fixed:1024,uniform:1:49152,lognormal:4096:1.5")));
+
+    StartupRun run;
+    run.users = std::max(1L, benchOption(argc, argv, "users", 1000L));
+    run.logins = std::max(0L, benchOption(argc, argv, "logins", 5L));
+    run.warm = benchFlag(argc, argv, "warm");
+    run.sizes.maxSize = benchOption(argc, argv, "max-size", SYNTH_MAX_SIZE);
+
+    std::vector<StartupRun> runs;
+    for (const std::string& count : fileCounts) {
+        for (const std::string& spec : sizeSpecs) {
+            run.filesRequested = std::atol(count.c_str());
+            run.sizeSpec = spec;
+            if (!run.sizes.parse(spec)) {
+                fprintf(stderr, "bad size '%s', expected fixed:N, uniform:MIN:MAX or lognormal:MEDIAN:SIGMA\n",
+                        spec.c_str());
+                return 1;
+            }
+            runs.push_back(run);
+        }
+    }
+
+    std::string dir = benchTempDir("fms-startup");
+    for (size_t i = 0; i < runs.size(); i++) {
+        const StartupRun& current = runs[i];
+        fprintf(stderr, "%zu files, sizes %s\n", current.filesRequested, current.sizeSpec.c_str());
+
+        int fds[2];
+        if (pipe(fds) != 0) {
+            perror("pipe");
+            return 1;
+        }
+        bool built = inChild([&] {
+            SynthResult result = synthesize(current);
+            if (write(fds[1], &result, sizeof(result)) != sizeof(result)) _exit(1);
+        });
+        SynthResult synth;
+        bool received = read(fds[0], &synth, sizeof(synth)) == sizeof(synth);
+        close(fds[0]);
+        close(fds[1]);
+
+        if (!built || !received || synth.files == 0) {
+            fprintf(stderr, "synthesis failed\n");
+        } else if (!inChild([&] { measure(current, synth); })) {
+            fprintf(stderr, "measurement failed\n");
+        }
+
+        bool last = i + 1 == runs.size();
+        if (!last || !benchFlag(argc, argv, "keep")) {
+            for (const char* name : DATA_FILES) unlink(name);
+        }
+    }
+
+    if (benchFlag(argc, argv, "keep")) {
+        fprintf(stderr, "kept the last run in %s\n", dir.c_str());
+    } else if (chdir("/") != 0 || rmdir(dir.c_str()) != 0) {
+        fprintf(stderr, "could not remove %s\n", dir.c_str());
+    }
+    return 0;
+}
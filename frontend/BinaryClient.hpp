@@ -0,0 +1,164 @@
+#ifndef BINARYCLIENT_HPP
+#define BINARYCLIENT_HPP
+
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "BinaryProtocol.hpp"
+
+// A decoded response frame. Unlike FrameView it owns its fields, so it
+// outlives the receive buffer.
+struct BinaryResponse {
+    Opcode status = Opcode::UNKNOWN;
+    uint32_t requestId = 0;
+    std::vector<FieldType> types;
+    std::vector<std::string> fields;
+
+    bool ok() const { return status == Opcode::SUCCESS || status == Opcode::DATA || status == Opcode::STREAM; }
+
+    long number(size_t i) const {
+        FrameField field;
+        field.type = types[i];
+        field.data = fields[i];
+        long value = 0;
+        field.toInt(value);
+        return value;
+    }
+};
+
+// Minimal blocking client for the binary protocol, used by tools that drive
+// the server programmatically. Requests can be pipelined: send() returns the
+// request's id and receive() hands back responses in completion order.
+class BinaryClient {
+private:
+    int sock;
+    uint32_t nextRequestId;
+    FrameWriter writer;
+    std::vector<char> buffer;
+
+    bool sendAll(const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t sent = ::send(sock, data, length, MSG_NOSIGNAL);
+            if (sent <= 0) return false;
+            data += sent;
+            length -= sent;
+        }
+        return true;
+    }
+
+    bool readExact(char* data, size_t length) {
+        while (length > 0) {
+            ssize_t got = ::read(sock, data, length);
+            if (got <= 0) return false;
+            data += got;
+            length -= got;
+        }
+        return true;
+    }
+
+public:
+    BinaryClient() : sock(-1), nextRequestId(1) {}
+    ~BinaryClient() { disconnect(); }
+
+    BinaryClient(const BinaryClient&) = delete;
+    BinaryClient& operator=(const BinaryClient&) = delete;
+
+    // Connects and negotiates the binary protocol
+    bool connect(const std::string& host, int port) {
+        sock = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (sock == -1) return false;
+
+        struct sockaddr_in addr;
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0 ||
+            ::connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            disconnect();
+            return false;
+        }
+
+        std::string hello = MSG_HELLO + DELIMITER + PROTO_BINARY + DELIMITER + std::to_string(BINARY_PROTOCOL_VERSION);
+        char reply[256];
+        if (!sendAll(hello.data(), hello.size())) return false;
+        ssize_t got = ::read(sock, reply, sizeof(reply));
+        if (got <= 0 || std::string(reply, got).compare(0, RESP_SUCCESS.size(), RESP_SUCCESS) != 0) {
+            disconnect();
+            return false;
+        }
+        return true;
+    }
+
+    void disconnect() {
+        if (sock != -1) ::close(sock);
+        sock = -1;
+    }
+
+    bool isConnected() const { return sock != -1; }
+
+    // Wakes a receive() blocked on another thread; disconnect() still closes
+    void shutdown() {
+        if (sock != -1) ::shutdown(sock, SHUT_RDWR);
+    }
+
+    // Id the next send() will carry
+    uint32_t nextId() const { return nextRequestId; }
+
+    // Starts a request; add fields to the returned writer, then call send()
+    FrameWriter& begin(Opcode opcode) {
+        writer.reset(opcode, nextRequestId);
+        return writer;
+    }
+
+    // Returns the id the response will carry, or 0 if the send failed
+    uint32_t send() {
+        const std::string& frame = writer.finish();
+        if (!sendAll(frame.data(), frame.size())) return 0;
+        uint32_t id = nextRequestId++;
+        if (nextRequestId == 0) nextRequestId = 1;
+        return id;
+    }
+
+    bool receive(BinaryResponse& response) {
+        char lengthBytes[FRAME_LENGTH_SIZE];
+        if (!readExact(lengthBytes, FRAME_LENGTH_SIZE)) return false;
+        uint32_t length = getU32(lengthBytes);
+        if (length > MAX_FRAME_SIZE) return false;
+
+        buffer.resize(length);
+        if (!readExact(buffer.data(), length)) return false;
+
+        // Decoded here rather than with parseFrame, since replies such as
+        // LIST_FILES carry more than MAX_FRAME_FIELDS fields
+        const char* data = buffer.data();
+        size_t pos = FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE;
+        if (length < pos) return false;
+        int count = getU16(data + 2);
+        response.status = static_cast<Opcode>(static_cast<uint8_t>(data[1]));
+        response.requestId = getU32(data + 4);
+        response.types.clear();
+        response.fields.clear();
+        for (int i = 0; i < count; i++) {
+            if (length - pos < FIELD_HEADER_SIZE) return false;
+            uint8_t type = static_cast<uint8_t>(data[pos]);
+            uint32_t fieldSize = getU32(data + pos + 1);
+            pos += FIELD_HEADER_SIZE;
+            if (type < 1 || type > 3 || fieldSize > length - pos) return false;
+            response.types.push_back(static_cast<FieldType>(type));
+            response.fields.emplace_back(data + pos, fieldSize);
+            pos += fieldSize;
+        }
+        return pos == length;
+    }
+
+    // Sends one request and waits for its response. Only meaningful when no
+    // other requests are in flight on this connection.
+    bool call(BinaryResponse& response) {
+        uint32_t id = send();
+        return id != 0 && receive(response) && response.requestId == id;
+    }
+};
+
+#endif // BINARYCLIENT_HPP
@@ -0,0 +1,324 @@
+#ifndef BINARYPROTOCOL_HPP
+#define BINARYPROTOCOL_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include "Protocol.hpp"
+
+// Negotiation: a connection starts in the text protocol. A client that sends
+// HELLO|BIN|<version> and gets SUCCESS|BIN|<version> back switches to binary
+// frames for the rest of the connection.
+const std::string MSG_HELLO = "HELLO";
+const std::string PROTO_BINARY = "BIN";
+const uint8_t BINARY_PROTOCOL_VERSION = 2;
+
+// BATCH carries one BYTES field holding concatenated request frames, see
+// BatchWriter. Binary protocol only.
+const std::string MSG_BATCH_REQUEST = "BATCH";   // MSG_BATCH is taken by <sys/socket.h>
+
+// Frame layout, all integers little-endian:
+//   u32 length       number of bytes after this field
+//   u8  version
+//   u8  opcode
+//   u16 fieldCount
+//   u32 requestId    chosen by the client, echoed in the response
+//   fieldCount x { u8 type, u32 size, size bytes }
+//
+// Requests on one connection may complete out of order; a client matches
+// responses to requests by requestId.
+const size_t FRAME_LENGTH_SIZE = 4;
+const size_t FRAME_HEADER_SIZE = 12;
+const size_t FIELD_HEADER_SIZE = 5;
+const uint32_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+const int MAX_FRAME_FIELDS = 16;
+
+enum class Opcode : uint8_t {
+    UNKNOWN = 0,
+    LOGIN,
+    REGISTER,
+    CREATE_FILE,
+    WRITE_FILE,
+    APPEND_FILE,
+    WRITE_AT,
+    READ_FILE,
+    READ_RANGE,
+    READ_STREAM,
+    TRUNCATE_FILE,
+    MOVE_TO_BIN,
+    RETRIEVE_FROM_BIN,
+    CHANGE_EXPIRY,
+    SEARCH_FILE,
+    LIST_FILES,
+    DELETE_PERMANENTLY,
+    CHECK_EXPIRED,
+    DISK_STATS,
+    LOGOUT,
+    EXIT,
+    HELLO,
+    BATCH,
+    STATS,
+    TRACE,
+
+    // Response codes
+    SUCCESS = 0x80,
+    FAILURE,
+    DATA,
+    STREAM
+};
+
+enum class FieldType : uint8_t {
+    STRING = 1,
+    INT64 = 2,
+    BYTES = 3
+};
+
+struct OpcodeName {
+    Opcode opcode;
+    const std::string* name;
+};
+
+inline const OpcodeName* opcodeNames(int& count) {
+    static const OpcodeName names[] = {
+        {Opcode::LOGIN, &MSG_LOGIN},
+        {Opcode::REGISTER, &MSG_REGISTER},
+        {Opcode::CREATE_FILE, &MSG_CREATE_FILE},
+        {Opcode::WRITE_FILE, &MSG_WRITE_FILE},
+        {Opcode::APPEND_FILE, &MSG_APPEND_FILE},
+        {Opcode::WRITE_AT, &MSG_WRITE_AT},
+        {Opcode::READ_FILE, &MSG_READ_FILE},
+        {Opcode::READ_RANGE, &MSG_READ_RANGE},
+        {Opcode::READ_STREAM, &MSG_READ_STREAM},
+        {Opcode::TRUNCATE_FILE, &MSG_TRUNCATE_FILE},
+        {Opcode::MOVE_TO_BIN, &MSG_MOVE_TO_BIN},
+        {Opcode::RETRIEVE_FROM_BIN, &MSG_RETRIEVE_FROM_BIN},
+        {Opcode::CHANGE_EXPIRY, &MSG_CHANGE_EXPIRY},
+        {Opcode::SEARCH_FILE, &MSG_SEARCH_FILE},
+        {Opcode::LIST_FILES, &MSG_LIST_FILES},
+        {Opcode::DELETE_PERMANENTLY, &MSG_DELETE_PERMANENTLY},
+        {Opcode::CHECK_EXPIRED, &MSG_CHECK_EXPIRED},
+        {Opcode::DISK_STATS, &MSG_DISK_STATS},
+        {Opcode::LOGOUT, &MSG_LOGOUT},
+        {Opcode::EXIT, &MSG_EXIT},
+        {Opcode::HELLO, &MSG_HELLO},
+        {Opcode::BATCH, &MSG_BATCH_REQUEST},
+        {Opcode::STATS, &MSG_STATS},
+        {Opcode::TRACE, &MSG_TRACE},
+        {Opcode::SUCCESS, &RESP_SUCCESS},
+        {Opcode::FAILURE, &RESP_FAILURE},
+        {Opcode::DATA, &RESP_DATA},
+        {Opcode::STREAM, &RESP_STREAM},
+    };
+    count = sizeof(names) / sizeof(names[0]);
+    return names;
+}
+
+inline Opcode opcodeFromName(std::string_view name) {
+    int count = 0;
+    const OpcodeName* names = opcodeNames(count);
+    for (int i = 0; i < count; i++) {
+        if (*names[i].name == name) return names[i].opcode;
+    }
+    return Opcode::UNKNOWN;
+}
+
+inline std::string_view opcodeName(Opcode opcode) {
+    int count = 0;
+    const OpcodeName* names = opcodeNames(count);
+    for (int i = 0; i < count; i++) {
+        if (names[i].opcode == opcode) return *names[i].name;
+    }
+    return "UNKNOWN";
+}
+
+inline void putU16(char* out, uint16_t v) {
+    out[0] = v & 0xff;
+    out[1] = (v >> 8) & 0xff;
+}
+
+inline void putU32(char* out, uint32_t v) {
+    for (int i = 0; i < 4; i++) out[i] = (v >> (8 * i)) & 0xff;
+}
+
+inline void putU64(char* out, uint64_t v) {
+    for (int i = 0; i < 8; i++) out[i] = (v >> (8 * i)) & 0xff;
+}
+
+inline uint16_t getU16(const char* in) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(in);
+    return p[0] | (p[1] << 8);
+}
+
+inline uint32_t getU32(const char* in) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(in);
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= uint32_t(p[i]) << (8 * i);
+    return v;
+}
+
+inline uint64_t getU64(const char* in) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(in);
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= uint64_t(p[i]) << (8 * i);
+    return v;
+}
+
+// A field that points into the frame it was parsed from
+struct FrameField {
+    FieldType type = FieldType::STRING;
+    std::string_view data;
+
+    // INT64 fields are decoded directly; text fields are parsed as decimal
+    bool toInt(long& value) const {
+        if (type == FieldType::INT64) {
+            if (data.size() != 8) return false;
+            value = (long)getU64(data.data());
+            return true;
+        }
+        if (data.empty()) return false;
+        bool negative = data[0] == '-';
+        size_t i = negative ? 1 : 0;
+        if (i == data.size()) return false;
+        long result = 0;
+        for (; i < data.size(); i++) {
+            if (data[i] < '0' || data[i] > '9') return false;
+            result = result * 10 + (data[i] - '0');
+        }
+        value = negative ? -result : result;
+        return true;
+    }
+};
+
+// A parsed frame. Fields reference the receive buffer, so nothing is copied.
+struct FrameView {
+    uint8_t version = 0;
+    Opcode opcode = Opcode::UNKNOWN;
+    uint32_t requestId = 0;
+    int fieldCount = 0;
+    FrameField fields[MAX_FRAME_FIELDS];
+};
+
+// Parses the bytes that follow the u32 length prefix
+inline bool parseFrame(const char* data, size_t size, FrameView& frame) {
+    if (size < FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE) return false;
+
+    frame.version = static_cast<uint8_t>(data[0]);
+    frame.opcode = static_cast<Opcode>(static_cast<uint8_t>(data[1]));
+    int count = getU16(data + 2);
+    frame.requestId = getU32(data + 4);
+    if (count > MAX_FRAME_FIELDS) return false;
+
+    size_t pos = FRAME_HEADER_SIZE - FRAME_LENGTH_SIZE;
+    for (int i = 0; i < count; i++) {
+        if (size - pos < FIELD_HEADER_SIZE) return false;
+        uint8_t type = static_cast<uint8_t>(data[pos]);
+        uint32_t fieldSize = getU32(data + pos + 1);
+        pos += FIELD_HEADER_SIZE;
+        if (type < 1 || type > 3 || fieldSize > size - pos) return false;
+
+        frame.fields[i].type = static_cast<FieldType>(type);
+        frame.fields[i].data = std::string_view(data + pos, fieldSize);
+        pos += fieldSize;
+    }
+    frame.fieldCount = count;
+    return pos == size;
+}
+
+// Parses the first length-prefixed frame of a concatenation (the payload of
+// a BATCH request or response) and advances data past it
+inline bool nextFrame(std::string_view& data, FrameView& frame) {
+    if (data.size() < FRAME_LENGTH_SIZE) return false;
+    uint32_t length = getU32(data.data());
+    if (length > data.size() - FRAME_LENGTH_SIZE) return false;
+    if (!parseFrame(data.data() + FRAME_LENGTH_SIZE, length, frame)) return false;
+    data.remove_prefix(FRAME_LENGTH_SIZE + length);
+    return true;
+}
+
+// Builds one frame in a reusable buffer
+class FrameWriter {
+private:
+    std::string buffer;
+    uint16_t fieldCount;
+
+    void addField(FieldType type, const char* data, size_t size) {
+        char header[FIELD_HEADER_SIZE];
+        header[0] = static_cast<char>(type);
+        putU32(header + 1, size);
+        buffer.append(header, FIELD_HEADER_SIZE);
+        buffer.append(data, size);
+        fieldCount++;
+    }
+
+public:
+    explicit FrameWriter(Opcode opcode = Opcode::UNKNOWN, uint32_t requestId = 0) { reset(opcode, requestId); }
+
+    void reset(Opcode opcode, uint32_t requestId = 0) {
+        buffer.assign(FRAME_HEADER_SIZE, '\0');
+        buffer[4] = BINARY_PROTOCOL_VERSION;
+        buffer[5] = static_cast<char>(opcode);
+        putU32(&buffer[8], requestId);
+        fieldCount = 0;
+    }
+
+    FrameWriter& addString(std::string_view value) {
+        addField(FieldType::STRING, value.data(), value.size());
+        return *this;
+    }
+
+    FrameWriter& addBytes(std::string_view value) {
+        addField(FieldType::BYTES, value.data(), value.size());
+        return *this;
+    }
+
+    FrameWriter& addInt(int64_t value) {
+        char bytes[8];
+        putU64(bytes, value);
+        addField(FieldType::INT64, bytes, sizeof(bytes));
+        return *this;
+    }
+
+    // Announces a BYTES field whose payload the caller sends separately, e.g.
+    // straight from a file. payloadSize counts toward the frame length.
+    const std::string& finishWithTrailingBytes(size_t payloadSize) {
+        char header[FIELD_HEADER_SIZE];
+        header[0] = static_cast<char>(FieldType::BYTES);
+        putU32(header + 1, payloadSize);
+        buffer.append(header, FIELD_HEADER_SIZE);
+        fieldCount++;
+        putU32(&buffer[0], buffer.size() - FRAME_LENGTH_SIZE + payloadSize);
+        putU16(&buffer[6], fieldCount);
+        return buffer;
+    }
+
+    const std::string& finish() {
+        putU32(&buffer[0], buffer.size() - FRAME_LENGTH_SIZE);
+        putU16(&buffer[6], fieldCount);
+        return buffer;
+    }
+};
+
+// Collects the items of a BATCH request. Each item is a complete frame; its
+// requestId is echoed in the matching item of the DATA|count|results reply.
+class BatchWriter {
+private:
+    std::string payload;
+    int count = 0;
+
+public:
+    void add(FrameWriter& item) {
+        payload += item.finish();
+        count++;
+    }
+
+    const std::string& data() const { return payload; }
+    int size() const { return count; }
+
+    void clear() {
+        payload.clear();
+        count = 0;
+    }
+};
+
+#endif // BINARYPROTOCOL_HPP
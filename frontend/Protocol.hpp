@@ -8,7 +8,11 @@ const std::string MSG_LOGIN = "LOGIN";
 const std::string MSG_REGISTER = "REGISTER";
 const std::string MSG_CREATE_FILE = "CREATE_FILE";
 const std::string MSG_WRITE_FILE = "WRITE_FILE";
+const std::string MSG_APPEND_FILE = "APPEND_FILE";   // APPEND_FILE|name|data
+const std::string MSG_WRITE_AT = "WRITE_AT";         // WRITE_AT|name|offset|data
 const std::string MSG_READ_FILE = "READ_FILE";
+const std::string MSG_READ_RANGE = "READ_RANGE";     // READ_RANGE|name|offset|length
+const std::string MSG_READ_STREAM = "READ_STREAM";   // READ_STREAM|name
 const std::string MSG_TRUNCATE_FILE = "TRUNCATE_FILE";
 const std::string MSG_MOVE_TO_BIN = "MOVE_TO_BIN";
 const std::string MSG_RETRIEVE_FROM_BIN = "RETRIEVE_FROM_BIN";
@@ -18,6 +22,8 @@ const std::string MSG_LIST_FILES = "LIST_FILES";
 const std::string MSG_DELETE_PERMANENTLY = "DELETE_PERMANENTLY";
 const std::string MSG_CHECK_EXPIRED = "CHECK_EXPIRED";
 const std::string MSG_DISK_STATS = "DISK_STATS";
+const std::string MSG_STATS = "STATS";               // STATS or STATS|prom
+const std::string MSG_TRACE = "TRACE";               // TRACE (dump) or TRACE|off|sample|all
 const std::string MSG_LOGOUT = "LOGOUT";
 const std::string MSG_EXIT = "EXIT";
 
@@ -25,6 +31,10 @@ const std::string MSG_EXIT = "EXIT";
 const std::string RESP_SUCCESS = "SUCCESS";
 const std::string RESP_FAILURE = "FAILURE";
 const std::string RESP_DATA = "DATA";
+const std::string RESP_STREAM = "STREAM";  // STREAM|name|size| followed by exactly size raw bytes
+
+// Largest slice a single READ_RANGE returns
+const size_t MAX_READ_RANGE = 1024 * 1024;
 
 // Delimiter
 const std::string DELIMITER = "|";
@@ -43,6 +43,42 @@ vector<string> split(const string& str, const string& delimiter) {
     return tokens;
 }
 
+// Receive a STREAM|name|size| response followed by exactly size bytes.
+// On failure, content holds the server's error message.
+bool receiveStream(string& name, string& content) {
+    string header;
+    char c;
+    int delimiters = 0;
+    
+    // Read the header byte by byte so no payload bytes get consumed with it
+    while (delimiters < 3) {
+        if (read(clientSocket, &c, 1) <= 0) return false;
+        header += c;
+        if (c == DELIMITER[0]) delimiters++;
+        if (header.compare(0, RESP_FAILURE.size(), RESP_FAILURE) == 0 && header.size() == RESP_FAILURE.size() + 1) {
+            content = receiveMessage();
+            return false;
+        }
+    }
+    
+    vector<string> parts = split(header, DELIMITER);
+    if (parts.size() < 3 || parts[0] != RESP_STREAM) return false;
+    
+    name = parts[1];
+    size_t size = stoul(parts[2]);
+    content.clear();
+    content.reserve(size);
+    
+    char buffer[8192];
+    while (content.size() < size) {
+        size_t want = min(sizeof(buffer), size - content.size());
+        int valread = read(clientSocket, buffer, want);
+        if (valread <= 0) return false;
+        content.append(buffer, valread);
+    }
+    return true;
+}
+
 void printSeparator() {
     cout << "\n========================================\n";
 }
@@ -214,44 +250,50 @@ void handleWriteFile() {
     cout << "Enter file name: ";
     getline(cin, fileName);
     
-    // First read the file to show current content
-    string readRequest = MSG_READ_FILE + DELIMITER + fileName;
-    sendMessage(readRequest);
-    string readResponse = receiveMessage();
-    vector<string> readParts = split(readResponse, DELIMITER);
-    
-    if (!readParts.empty() && readParts[0] == RESP_DATA && readParts.size() >= 3) {
-        string currentContent = readParts[2];
-        cout << "\n--- CURRENT CONTENT ---\n";
-        cout << currentContent << "\n";
-        cout << "-----------------------\n\n";
-        
-        cout << "Choose an option:\n";
-        cout << "1. Replace content completely\n";
-        cout << "2. Append to existing content\n";
-        cout << "Enter choice (1 or 2): ";
-        int choice;
-        cin >> choice;
-        cin.ignore();
+    cout << "Choose an option:\n";
+    cout << "1. Replace content completely\n";
+    cout << "2. Append to existing content\n";
+    cout << "3. Overwrite at offset\n";
+    cout << "Enter choice (1, 2 or 3): ";
+    int choice;
+    cin >> choice;
+    cin.ignore();
+    
+    string request;
+    if (choice == 1) {
+        // Show the current content before it gets replaced
+        string readRequest = MSG_READ_FILE + DELIMITER + fileName;
+        sendMessage(readRequest);
+        string readResponse = receiveMessage();
+        vector<string> readParts = split(readResponse, DELIMITER);
         
-        if (choice == 1) {
-            cout << "\nEnter new content: ";
-            getline(cin, content);
-        } else if (choice == 2) {
-            cout << "\nEnter text to append: ";
-            string appendText;
-            getline(cin, appendText);
-            content = currentContent + appendText;
-        } else {
-            cout << "\n✗ Invalid choice. Operation cancelled.\n";
-            return;
+        if (!readParts.empty() && readParts[0] == RESP_DATA && readParts.size() >= 3) {
+            cout << "\n--- CURRENT CONTENT ---\n";
+            cout << readParts[2] << "\n";
+            cout << "-----------------------\n";
         }
-    } else {
-        cout << "\nFile not found or cannot read. Enter new content: ";
+        
+        cout << "\nEnter new content: ";
         getline(cin, content);
+        request = MSG_WRITE_FILE + DELIMITER + fileName + DELIMITER + content;
+    } else if (choice == 2) {
+        // Only the new text goes over the wire; the server writes just the tail blocks
+        cout << "\nEnter text to append: ";
+        getline(cin, content);
+        request = MSG_APPEND_FILE + DELIMITER + fileName + DELIMITER + content;
+    } else if (choice == 3) {
+        long offset;
+        cout << "\nEnter byte offset: ";
+        cin >> offset;
+        cin.ignore();
+        cout << "Enter text to write: ";
+        getline(cin, content);
+        request = MSG_WRITE_AT + DELIMITER + fileName + DELIMITER + to_string(offset) + DELIMITER + content;
+    } else {
+        cout << "\n✗ Invalid choice. Operation cancelled.\n";
+        return;
     }
     
-    string request = MSG_WRITE_FILE + DELIMITER + fileName + DELIMITER + content;
     sendMessage(request);
     
     string response = receiveMessage();
@@ -277,20 +319,19 @@ void handleReadFile() {
     cout << "Enter file name: ";
     getline(cin, fileName);
     
-    string request = MSG_READ_FILE + DELIMITER + fileName;
+    string request = MSG_READ_STREAM + DELIMITER + fileName;
     sendMessage(request);
     
-    string response = receiveMessage();
-    vector<string> parts = split(response, DELIMITER);
-    
-    if (!parts.empty() && parts[0] == RESP_DATA && parts.size() >= 3) {
-        cout << "\n--- FILE: " << parts[1] << " ---\n";
-        cout << parts[2] << "\n";
+    string name, content;
+    if (receiveStream(name, content)) {
+        cout << "\n--- FILE: " << name << " ---\n";
+        cout << content << "\n";
         cout << "--------------------\n";
     } else {
         cout << "\n✗ Cannot read file. ";
-        if (parts.size() > 1) {
-            cout << parts[1];
+        vector<string> parts = split(content, DELIMITER);
+        if (!parts.empty()) {
+            cout << parts[0];
         }
         cout << "\n";
     }
@@ -577,6 +618,9 @@ void handleDiskStats() {
         cout << "Used Blocks: " << parts[3] << " (" << parts[4] << " MB)\n";
         cout << "Free Blocks: " << parts[5] << " (" << parts[6] << " MB)\n";
         cout << "Disk Usage: " << parts[7] << "%\n";
+        if (parts.size() >= 11) {
+            cout << "Shared Blocks: " << parts[8] << " (" << parts[9] << " references, ratio " << parts[10] << ")\n";
+        }
         cout << "=====================================\n\n";
     } else {
         cout << "Failed to retrieve disk statistics.\n";
@@ -128,6 +128,19 @@ class ProxyHandler(BaseHTTPRequestHandler):
                 message = f"WRITE_FILE|{name}|{content}"
                 print(f"[PROXY] Sending: WRITE_FILE|{name}|...")
             
+            elif action == 'append_file':
+                name = params.get('name', [''])[0]
+                content = params.get('content', [''])[0]
+                message = f"APPEND_FILE|{name}|{content}"
+                print(f"[PROXY] Sending: APPEND_FILE|{name}|...")
+            
+            elif action == 'write_at':
+                name = params.get('name', [''])[0]
+                offset = params.get('offset', ['0'])[0]
+                content = params.get('content', [''])[0]
+                message = f"WRITE_AT|{name}|{offset}|{content}"
+                print(f"[PROXY] Sending: WRITE_AT|{name}|{offset}|...")
+            
             elif action == 'read_file':
                 name = params.get('name', [''])[0]
                 message = f"READ_FILE|{name}"
@@ -167,6 +180,11 @@ class ProxyHandler(BaseHTTPRequestHandler):
                 message = "DISK_STATS"
                 print(f"[PROXY] Sending: {message}")
             
+            elif action == 'stats':
+                fmt = params.get('format', [''])[0]
+                message = "STATS|prom" if fmt == 'prom' else "STATS"
+                print(f"[PROXY] Sending: {message}")
+            
             elif action == 'logout':
                 message = "LOGOUT"
                 print(f"[PROXY] Sending: {message}")
@@ -4,15 +4,26 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <cerrno>
 #include <cstring>
 #include <thread>
 #include <sstream>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
+#include <memory>
 #include <atomic>
 #include <set>
+#include <string_view>
 #include "Queue.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "Capture.hpp"
+#include "WriteBackBuffer.hpp"
+#include "RequestExecutor.hpp"
 #include "Protocol.hpp"
+#include "BinaryProtocol.hpp"
 #include "FileManager.hpp"
 #include "FileManagerDisk.hpp"
 #include "MinHeap.hpp"
@@ -31,32 +42,223 @@ mutex queueMutex;
 mutex diskMutex; 
 atomic<bool> serverRunning(true);
 
+// Runs pipelined binary requests; requests from one connection may finish
+// out of order
+RequestExecutor* executor;
+const int MAX_IN_FLIGHT = 64;
+
+bool sendAll(int clientSocket, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(clientSocket, data, length, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
 void sendMessage(int clientSocket, const string& message) {
-    send(clientSocket, message.c_str(), message.length(), 0);
+    sendAll(clientSocket, message.c_str(), message.length());
+}
+
+// Per-connection state. userId and username only change while no request
+// of the connection is in flight.
+atomic<uint32_t> nextConnectionId{1};
+
+struct Session {
+    int socket;
+    uint32_t connectionId = nextConnectionId++;   // names the connection in captures
+    int userId = -1;
+    string username;
+    atomic<bool> active{true};
+    bool binary = false;
+
+    mutex writeMutex;         // one response frame on the socket at a time
+    mutex inFlightMutex;
+    condition_variable inFlightChanged;
+    int inFlight = 0;
+};
+
+// Takes diskMutex and records how long the caller waited for it
+unique_lock<mutex> lockDisk() {
+    TRACE_SPAN("diskMutex.wait");
+    uint64_t start = Metrics::now();
+    unique_lock<mutex> lock(diskMutex);
+    Metrics::add(Counter::DISK_LOCK_WAIT_NS, Metrics::now() - start);
+    Metrics::add(Counter::DISK_LOCK_ACQUIRES);
+    return lock;
+}
+
+// Set while this thread holds diskMutex through a SessionDiskLock, so the
+// items of a BATCH can run under the lock their batch already took
+thread_local bool holdsDiskLock = false;
+
+// Holds diskMutex and points the shared FileManager at the session's user
+struct SessionDiskLock {
+    unique_lock<mutex> lock;
+
+    explicit SessionDiskLock(const Session& session) : lock(diskMutex, defer_lock) {
+        if (!holdsDiskLock) {
+            lock = lockDisk();
+            holdsDiskLock = true;
+        }
+        globalFm->setCurrentUser(session.userId);
+    }
+    
+    ~SessionDiskLock() {
+        if (lock.owns_lock()) holdsDiskLock = false;
+    }
+};
+
+// A request in either wire format. Arguments point into the receive buffer.
+struct Request {
+    Opcode opcode = Opcode::UNKNOWN;
+    uint32_t requestId = 0;
+    uint64_t receivedAt = 0;   // Metrics::now() when the request started arriving
+    bool traced = false;
+    int argc = 0;
+    FrameField args[MAX_FRAME_FIELDS];
+
+    string str(int i) const { return string(args[i].data); }
+    bool num(int i, long& value) const { return args[i].toInt(value); }
+};
+
+struct ResponseField {
+    FieldType type;
+    string text;
+    long number;
+};
+
+struct Response {
+    Opcode status = Opcode::SUCCESS;
+    vector<ResponseField> fields;
+    bool sent = false;  // already written to the socket by a streaming handler
+
+    Response& add(const string& value) {
+        fields.push_back({FieldType::STRING, value, 0});
+        return *this;
+    }
+    Response& addBytes(const string& value) {
+        fields.push_back({FieldType::BYTES, value, 0});
+        return *this;
+    }
+    Response& add(long value) {
+        fields.push_back({FieldType::INT64, "", value});
+        return *this;
+    }
+};
+
+Response success(const string& message) {
+    Response response;
+    response.status = Opcode::SUCCESS;
+    response.add(message);
+    return response;
+}
+
+Response failure(const string& message) {
+    Response response;
+    response.status = Opcode::FAILURE;
+    response.add(message);
+    return response;
 }
 
-string receiveMessage(int clientSocket) {
-    char buffer[4096] = {0};
-    int valread = read(clientSocket, buffer, 4096);
-    if (valread <= 0) return "";
-    return string(buffer);
+Response data() {
+    Response response;
+    response.status = Opcode::DATA;
+    return response;
 }
 
-vector<string> split(const string& str, const string& delimiter) {
-    vector<string> tokens;
+bool readExact(int clientSocket, char* buffer, size_t length) {
+    while (length > 0) {
+        ssize_t got = read(clientSocket, buffer, length);
+        if (got <= 0) return false;
+        buffer += got;
+        length -= got;
+    }
+    return true;
+}
+
+// Legacy text protocol: one read per message, no framing
+bool receiveText(int clientSocket, vector<char>& buffer, Request& request, string_view& raw) {
+    buffer.resize(4096);
+    int valread = read(clientSocket, buffer.data(), buffer.size());
+    if (valread <= 0) return false;
+    raw = string_view(buffer.data(), valread);
+
+    request.argc = 0;
     size_t start = 0;
-    size_t end = str.find(delimiter);
-    while (end != string::npos) {
-        tokens.push_back(str.substr(start, end - start));
-        start = end + delimiter.length();
-        end = str.find(delimiter, start);
-    }
-    tokens.push_back(str.substr(start));
-    return tokens;
+    int index = -1;
+    while (true) {
+        size_t end = raw.find(DELIMITER[0], start);
+        string_view token = raw.substr(start, end == string_view::npos ? string_view::npos : end - start);
+        if (index == -1) {
+            request.opcode = opcodeFromName(token);
+        } else if (index < MAX_FRAME_FIELDS) {
+            request.args[index].type = FieldType::STRING;
+            request.args[index].data = token;
+            request.argc = index + 1;
+        }
+        index++;
+        if (end == string_view::npos) break;
+        start = end + 1;
+    }
+    return true;
+}
+
+// Binary protocol: reads exactly one length-prefixed frame into buffer and
+// parses it in place
+bool receiveFrame(int clientSocket, vector<char>& buffer, Request& request, bool& malformed) {
+    char lengthBytes[FRAME_LENGTH_SIZE];
+    if (!readExact(clientSocket, lengthBytes, FRAME_LENGTH_SIZE)) return false;
+    request.receivedAt = Metrics::now();
+
+    uint32_t length = getU32(lengthBytes);
+    if (length > MAX_FRAME_SIZE) return false;
+
+    buffer.resize(length);
+    if (!readExact(clientSocket, buffer.data(), length)) return false;
+
+    FrameView frame;
+    malformed = !parseFrame(buffer.data(), length, frame) || frame.version != BINARY_PROTOCOL_VERSION;
+    request.opcode = frame.opcode;
+    request.requestId = frame.requestId;
+    request.argc = frame.fieldCount;
+    for (int i = 0; i < frame.fieldCount; i++) {
+        request.args[i] = frame.fields[i];
+    }
+    return true;
+}
+
+const string& encodeResponse(FrameWriter& writer, const Response& response, uint32_t requestId) {
+    writer.reset(response.status, requestId);
+    for (const ResponseField& field : response.fields) {
+        if (field.type == FieldType::INT64) writer.addInt(field.number);
+        else if (field.type == FieldType::BYTES) writer.addBytes(field.text);
+        else writer.addString(field.text);
+    }
+    return writer.finish();
+}
+
+void sendResponse(Session& session, const Response& response, uint32_t requestId) {
+    TRACE_SPAN("socket.write");
+    if (session.binary) {
+        FrameWriter writer;
+        const string& frame = encodeResponse(writer, response, requestId);
+        lock_guard<mutex> writeLock(session.writeMutex);
+        sendAll(session.socket, frame.data(), frame.size());
+    } else {
+        string message(opcodeName(response.status));
+        for (const ResponseField& field : response.fields) {
+            message += DELIMITER;
+            message += field.type == FieldType::INT64 ? to_string(field.number) : field.text;
+        }
+        sendMessage(session.socket, message);
+    }
 }
 
 void checkExpiredFiles() {
-    lock_guard<mutex> diskLock(diskMutex);
+    unique_lock<mutex> diskLock = lockDisk();
+    Metrics::add(Counter::EXPIRY_SWEEPS);
     
     globalFm->updateExpiryStatus();
 }
@@ -68,341 +270,572 @@ void expiryCheckerThread() {
     }
 }
 
-void handleClient(int clientSocket) {
-    cout << "[SERVER] Client connected: " << clientSocket << endl;
-
-    int currentUserId = -1;
-    string currentUsername = "";
-    bool sessionActive = true;
-
-    while (sessionActive && serverRunning) {
-        string request = receiveMessage(clientSocket);
-        if (request.empty()) {
-            cout << "[SERVER] Client disconnected: " << clientSocket << endl;
-            if (currentUserId != -1) {
-                lock_guard<mutex> diskLock(diskMutex);
-                lock_guard<mutex> usersLock(loggedInUsersMutex);
-                
-                globalFm->unloadUserFiles(currentUserId);
-                loggedInUsers.erase(currentUserId);
-                cout << "[SERVER] Auto-logged out user " << currentUserId << " on disconnect\n";
-            }
-            break;
+void logoutSession(Session& session) {
+    unique_lock<mutex> diskLock = lockDisk();
+    lock_guard<mutex> usersLock(loggedInUsersMutex);
+    
+    globalFm->unloadUserFiles(session.userId);
+    loggedInUsers.erase(session.userId);
+}
+
+// What a READ_STREAM sends, taken under diskMutex: where the content lies in
+// disk.bin, or, for a compressed or deduplicated file, a copy of it
+struct StreamSource {
+    string name;
+    size_t size = 0;
+    bool fromDisk = false;
+    ExtentSnapshot snapshot;
+    string content;
+};
+
+// Caller holds diskMutex
+void prepareStream(const FileEntry& f, StreamSource& source) {
+    source.name = f.name;
+    source.size = f.content.size();
+    if (source.size > 0 && disk->snapshotExtents(f.fileId, 0, source.size, source.snapshot)) {
+        size_t covered = 0;
+        for (const DiskExtent& extent : source.snapshot.extents) covered += extent.length;
+        source.fromDisk = covered == source.size;
+    }
+    if (!source.fromDisk) source.content = f.content;
+}
+
+// Streams a file's content to the client: a length-framed header, then each
+// block's data, read and verified one block at a time. Runs without
+// diskMutex, so a client slow to read holds up only its own connection; a
+// block rewritten since the snapshot ends the stream.
+bool streamFile(Session& session, const StreamSource& source, uint32_t requestId) {
+    TRACE_SPAN("socket.stream");
+    string textHeader;
+    FrameWriter writer(Opcode::STREAM, requestId);
+    const string* header;
+    
+    if (session.binary) {
+        writer.addString(source.name).addInt(source.size);
+        header = &writer.finishWithTrailingBytes(source.size);
+    } else {
+        textHeader = RESP_STREAM + DELIMITER + source.name + DELIMITER + to_string(source.size) + DELIMITER;
+        header = &textHeader;
+    }
+    
+    lock_guard<mutex> writeLock(session.writeMutex);
+    if (!sendAll(session.socket, header->data(), header->size())) return false;
+    if (!source.fromDisk) return sendAll(session.socket, source.content.data(), source.size);
+    
+    string bytes;
+    for (const DiskExtent& extent : source.snapshot.extents) {
+        if (!disk->readExtent(source.snapshot, extent, bytes) ||
+            !sendAll(session.socket, bytes.data(), bytes.size())) {
+            return false;
         }
+    }
+    return true;
+}
 
-        cout << "[SERVER] Received: " << request << endl;
-        vector<string> parts = split(request, DELIMITER);
-        if (parts.empty()) continue;
-
-        string command = parts[0];
-        string response;
-
-        if (command == MSG_LOGIN) {
-            if (parts.size() < 3) {
-                response = RESP_FAILURE + DELIMITER + "Invalid login format";
-            } else {
-                string username = parts[1];
-                string password = parts[2];
-                int userId = um->loginUser(username, password);
-                if (userId != -1) {
-                    currentUserId = userId;
-                    currentUsername = username;
-                    
-                    lock_guard<mutex> diskLock(diskMutex);
-                    lock_guard<mutex> usersLock(loggedInUsersMutex);
-                    
-                    globalFm->setCurrentUser(userId);
-                    globalFm->loadUserFiles(userId); 
-                    loggedInUsers.insert(userId);
-                    
-                    response = RESP_SUCCESS + DELIMITER + "Login successful" + DELIMITER + username;
-                    cout << "[SERVER] User " << userId << " logged in. Files loaded into memory.\n";
-                } else {
-                    response = RESP_FAILURE + DELIMITER + "Invalid username or password";
-                }
-            }
+Response processRequest(Session& session, const Request& req);
+
+// Requests that may appear inside a BATCH: file operations whose response
+// fits in a frame
+bool isBatchable(Opcode opcode) {
+    switch (opcode) {
+    case Opcode::LOGIN: case Opcode::REGISTER: case Opcode::LOGOUT: case Opcode::EXIT:
+    case Opcode::HELLO: case Opcode::BATCH: case Opcode::READ_STREAM:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// Runs every item of a batch under a single diskMutex hold and commits the
+// bitmap and index once at the end. Items run in order; a failed item does
+// not stop the ones after it.
+Response processBatch(Session& session, string_view items) {
+    string results;
+    FrameWriter writer;
+    FrameView frame;
+    Request item;
+    long count = 0;
+    
+    SessionDiskLock diskLock(session);
+    disk->beginBatch();
+    while (!items.empty()) {
+        if (!nextFrame(items, frame)) {
+            results += encodeResponse(writer, failure("Malformed batch item"), 0);
+            count++;
+            break;
         }
-        else if (command == MSG_REGISTER) {
-            if (parts.size() < 3) {
-                response = RESP_FAILURE + DELIMITER + "Invalid register format";
-            } else {
-                string username = parts[1];
-                string password = parts[2];
-                if (um->userExists(username)) {
-                    response = RESP_FAILURE + DELIMITER + "Username already exists";
-                } else if (um->registerUser(username, password)) {
-                    response = RESP_SUCCESS + DELIMITER + "Registration successful";
-                } else {
-                    response = RESP_FAILURE + DELIMITER + "Registration failed";
-                }
-            }
+        
+        item.opcode = frame.opcode;
+        item.requestId = frame.requestId;
+        item.argc = frame.fieldCount;
+        for (int i = 0; i < frame.fieldCount; i++) {
+            item.args[i] = frame.fields[i];
         }
-        else if (currentUserId == -1) {
-            response = RESP_FAILURE + DELIMITER + "Not logged in";
+        
+        Response response = isBatchable(item.opcode) ? processRequest(session, item)
+                                                     : failure("Not allowed in a batch");
+        results += encodeResponse(writer, response, item.requestId);
+        count++;
+    }
+    disk->commitBatch();
+    
+    LOG_DEBUG("SERVER", "Batch completed", kv("items", count), payload("results", results));
+    Response response = data();
+    response.add(count).addBytes(results);
+    return response;
+}
+
+Response processRequest(Session& session, const Request& req) {
+    switch (req.opcode) {
+    case Opcode::HELLO: {
+        long version = 0;
+        if (req.argc < 2 || req.args[0].data != PROTO_BINARY || !req.num(1, version)) {
+            return failure("Invalid hello format");
+        }
+        if (version != BINARY_PROTOCOL_VERSION) {
+            return failure("Unsupported protocol version");
         }
+        Response response;
+        response.add(PROTO_BINARY).add(version);
+        return response;
+    }
+    case Opcode::LOGIN: {
+        if (req.argc < 2) return failure("Invalid login format");
         
-        else if (command == MSG_CREATE_FILE) {
-            if (parts.size() < 4) {
-                response = RESP_FAILURE + DELIMITER + "Invalid format";
-            } else {
-                string name = parts[1];
-                string content = parts[2];
-                long expireSeconds = stol(parts[3]);
-
-                lock_guard<mutex> diskLock(diskMutex);
-                if (globalFm->createFile(name, content, expireSeconds)) {
-                    response = RESP_SUCCESS + DELIMITER + "File created successfully";
-                } else {
-                    response = RESP_FAILURE + DELIMITER + "File already exists";
-                }
-            }
+        string username = req.str(0);
+        string password = req.str(1);
+        int userId = um->loginUser(username, password);
+        if (userId == -1) return failure("Invalid username or password");
+        
+        session.userId = userId;
+        session.username = username;
+        
+        // Read before taking diskMutex, so logins load in parallel and
+        // share reads of the same file
+        uint64_t generation = disk->getGeneration();
+        vector<FileEntry> files = disk->loadFilesOwnedBy(userId);
+        
+        unique_lock<mutex> diskLock = lockDisk();
+        lock_guard<mutex> usersLock(loggedInUsersMutex);
+        
+        // Written to meanwhile; read again, mostly from the cache
+        if (disk->getGeneration() != generation) files = disk->loadFilesOwnedBy(userId);
+        globalFm->setCurrentUser(userId);
+        globalFm->addUserFiles(userId, files);
+        loggedInUsers.insert(userId);
+        
+        LOG_INFO("SERVER", "User logged in, files loaded into memory", kv("user", userId));
+        Response response = success("Login successful");
+        response.add(username);
+        return response;
+    }
+    case Opcode::REGISTER: {
+        if (req.argc < 2) return failure("Invalid register format");
+        
+        string username = req.str(0);
+        string password = req.str(1);
+        if (um->userExists(username)) return failure("Username already exists");
+        if (um->registerUser(username, password)) return success("Registration successful");
+        return failure("Registration failed");
+    }
+    case Opcode::STATS: {
+        if (req.argc >= 1 && req.args[0].data == "prom") {
+            return data().add(Metrics::renderPrometheus());
         }
-        else if (command == MSG_WRITE_FILE) {
-            if (parts.size() < 3) {
-                response = RESP_FAILURE + DELIMITER + "Invalid format";
-            } else {
-                string fileName = parts[1];
-                string content = parts[2];
-                
-                lock_guard<mutex> diskLock(diskMutex);
-                FileEntry* f = globalFm->searchFile(fileName);
-                if (!f) {
-                    response = RESP_FAILURE + DELIMITER + "File not found";
-                } else if (f->inBin) {
-                    response = RESP_FAILURE + DELIMITER + "Cannot write: File is in bin. Please retrieve it first.";
-                } else {
-                    if (globalFm->writeFile(fileName, content)) {
-                        response = RESP_SUCCESS + DELIMITER + "File updated successfully";
-                    } else {
-                        response = RESP_FAILURE + DELIMITER + "Failed to write file";
-                    }
-                }
-            }
+        return data().add(Metrics::renderText());
+    }
+    case Opcode::TRACE: {
+        if (req.argc < 1 || req.args[0].data == "dump") {
+            return data().add(Trace::dumpJson());
         }
-        else if (command == MSG_READ_FILE) {
-            if (parts.size() < 2) {
-                response = RESP_FAILURE + DELIMITER + "Invalid format";
-            } else {
-                string fileName = parts[1];
-                
-                lock_guard<mutex> diskLock(diskMutex);
-                FileEntry* f = globalFm->searchFile(fileName);
-                
-                if (!f) {
-                    response = RESP_FAILURE + DELIMITER + "File not found";
-                } else if (f->inBin) {
-                    response = RESP_FAILURE + DELIMITER + "Cannot read: File is in bin. Please retrieve it first.";
-                } else {
-                    string content;
-                    if (globalFm->readFile(fileName, content)) {
-                        response = RESP_DATA + DELIMITER + fileName + DELIMITER + content;
-                    } else {
-                        response = RESP_FAILURE + DELIMITER + "Cannot read file";
-                    }
-                }
-            }
+        TraceMode mode;
+        if (!Trace::parseMode(req.args[0].data, mode)) return failure("Invalid trace mode");
+        Trace::setMode(mode);
+        return success(string("Tracing ") + Trace::modeName(mode));
+    }
+    case Opcode::EXIT:
+        if (session.userId != -1) {
+            logoutSession(session);
         }
-        else if (command == MSG_TRUNCATE_FILE) {
-            if (parts.size() < 2) {
-                response = RESP_FAILURE + DELIMITER + "Invalid format";
-            } else {
-                string fileName = parts[1];
-                
-                lock_guard<mutex> diskLock(diskMutex);
-                FileEntry* f = globalFm->searchFile(fileName);
-                
-                if (!f) {
-                    response = RESP_FAILURE + DELIMITER + "File not found";
-                } else if (f->inBin) {
-                    response = RESP_FAILURE + DELIMITER + "Cannot truncate: File is in bin. Please retrieve it first.";
-                } else {
-                    if (globalFm->truncateFile(fileName)) {
-                        response = RESP_SUCCESS + DELIMITER + "File truncated successfully";
-                    } else {
-                        response = RESP_FAILURE + DELIMITER + "Failed to truncate file";
-                    }
-                }
-            }
+        session.active = false;
+        return success("Goodbye");
+    default:
+        break;
+    }
+    
+    if (session.userId == -1) {
+        return failure("Not logged in");
+    }
+    
+    switch (req.opcode) {
+    case Opcode::CREATE_FILE: {
+        long expireSeconds;
+        if (req.argc < 3 || !req.num(2, expireSeconds)) return failure("Invalid format");
+        
+        SessionDiskLock diskLock(session);
+        if (globalFm->createFile(req.str(0), req.str(1), expireSeconds)) {
+            return success("File created successfully");
         }
-        else if (command == MSG_MOVE_TO_BIN) {
-            if (parts.size() < 2) {
-                response = RESP_FAILURE + DELIMITER + "Invalid format";
-            } else {
-                string fileName = parts[1];
-                
-                lock_guard<mutex> diskLock(diskMutex);
-                FileEntry* f = globalFm->searchFile(fileName);
-                if (f) {
-                    if (f->inBin) {
-                        response = RESP_FAILURE + DELIMITER + "File already in bin";
-                    } else {
-                        if (globalFm->moveToBin(fileName)) {
-                            response = RESP_SUCCESS + DELIMITER + "File moved to bin and timer stopped";
-                        } else {
-                            response = RESP_FAILURE + DELIMITER + "Failed to move file";
-                        }
-                    }
-                } else {
-                    response = RESP_FAILURE + DELIMITER + "File not found";
-                }
-            }
+        return failure("File already exists");
+    }
+    case Opcode::WRITE_FILE: {
+        if (req.argc < 2) return failure("Invalid format");
+        string fileName = req.str(0);
+        
+        SessionDiskLock diskLock(session);
+        FileEntry* f = globalFm->searchFile(fileName);
+        if (!f) return failure("File not found");
+        if (f->inBin) return failure("Cannot write: File is in bin. Please retrieve it first.");
+        if (globalFm->writeFile(fileName, req.str(1))) return success("File updated successfully");
+        return failure("Failed to write file");
+    }
+    case Opcode::APPEND_FILE: {
+        if (req.argc < 2) return failure("Invalid format");
+        string fileName = req.str(0);
+        
+        SessionDiskLock diskLock(session);
+        FileEntry* f = globalFm->searchFile(fileName);
+        if (!f) return failure("File not found");
+        if (f->inBin) return failure("Cannot append: File is in bin. Please retrieve it first.");
+        if (globalFm->appendFile(fileName, req.str(1))) return success("Data appended successfully");
+        return failure("Failed to append to file");
+    }
+    case Opcode::WRITE_AT: {
+        long offset;
+        if (req.argc < 3 || !req.num(1, offset)) return failure("Invalid format");
+        string fileName = req.str(0);
+        
+        SessionDiskLock diskLock(session);
+        FileEntry* f = globalFm->searchFile(fileName);
+        if (!f) return failure("File not found");
+        if (f->inBin) return failure("Cannot write: File is in bin. Please retrieve it first.");
+        if (offset < 0 || (size_t)offset > f->content.size()) return failure("Offset is past the end of the file");
+        if (globalFm->writeFileAt(fileName, offset, req.str(2))) return success("File range updated successfully");
+        return failure("Failed to write file");
+    }
+    case Opcode::READ_FILE: {
+        if (req.argc < 1) return failure("Invalid format");
+        string fileName = req.str(0);
+        
+        SessionDiskLock diskLock(session);
+        FileEntry* f = globalFm->searchFile(fileName);
+        if (!f) return failure("File not found");
+        if (f->inBin) return failure("Cannot read: File is in bin. Please retrieve it first.");
+        
+        string content;
+        if (!globalFm->readFile(fileName, content)) return failure("Cannot read file");
+        Response response = data();
+        response.add(fileName).addBytes(content);
+        return response;
+    }
+    case Opcode::READ_RANGE: {
+        long offset, length;
+        if (req.argc < 3 || !req.num(1, offset) || !req.num(2, length)) return failure("Invalid format");
+        string fileName = req.str(0);
+        
+        SessionDiskLock diskLock(session);
+        FileEntry* f = globalFm->searchFile(fileName);
+        if (!f) return failure("File not found");
+        if (f->inBin) return failure("Cannot read: File is in bin. Please retrieve it first.");
+        if (offset < 0 || length < 0 || (size_t)offset > f->content.size()) return failure("Invalid range");
+        
+        string content;
+        size_t clamped = min((size_t)length, MAX_READ_RANGE);
+        if (!globalFm->readFileRange(*f, offset, clamped, content)) return failure("Cannot read file");
+        Response response = data();
+        response.add(fileName).add(offset).add((long)content.size()).addBytes(content);
+        return response;
+    }
+    case Opcode::READ_STREAM: {
+        if (req.argc < 1) return failure("Invalid format");
+        string fileName = req.str(0);
+        
+        StreamSource source;
+        {
+            SessionDiskLock diskLock(session);
+            FileEntry* f = globalFm->searchFile(fileName);
+            if (!f) return failure("File not found");
+            if (f->inBin) return failure("Cannot read: File is in bin. Please retrieve it first.");
+            prepareStream(*f, source);
         }
-        else if (command == MSG_RETRIEVE_FROM_BIN) {
-            if (parts.size() < 2) {
-                response = RESP_FAILURE + DELIMITER + "Invalid format";
-            } else {
-                string fileName = parts[1];
-                
-                lock_guard<mutex> diskLock(diskMutex);
-                FileEntry* f = globalFm->searchFile(fileName);
-                
-                if (!f) {
-                    response = RESP_FAILURE + DELIMITER + "File not found";
-                } else if (!f->inBin) {
-                    response = RESP_FAILURE + DELIMITER + "File is not in bin";
-                } else {
-                    if (globalFm->retrieveFromBin(fileName)) {
-                        response = RESP_SUCCESS + DELIMITER + "File retrieved from bin successfully. Timer restarted. You can now edit, read, or truncate.";
-                    } else {
-                        response = RESP_FAILURE + DELIMITER + "Failed to retrieve file from bin";
-                    }
-                }
-            }
+        
+        if (!streamFile(session, source, req.requestId)) {
+            // The client was promised size bytes; a short stream cannot be
+            // recovered. Shutting the socket down also wakes the connection's
+            // reader, so the client sees the close.
+            LOG_ERROR("SERVER", "Stream failed", kv("name", fileName));
+            session.active = false;
+            shutdown(session.socket, SHUT_RDWR);
         }
-        else if (command == MSG_CHANGE_EXPIRY) {
-            if (parts.size() < 3) {
-                response = RESP_FAILURE + DELIMITER + "Invalid format";
-            } else {
-                string fileName = parts[1];
-                long newExpire = stol(parts[2]);
-                
-                lock_guard<mutex> diskLock(diskMutex);
-                FileEntry* f = globalFm->searchFile(fileName);
-                if (!f) {
-                    response = RESP_FAILURE + DELIMITER + "File not found";
-                } else if (f->inBin) {
-                    response = RESP_FAILURE + DELIMITER + "Cannot change expiry: File is in bin. Please retrieve it first.";
-                } else {
-                    if (globalFm->changeExpiry(fileName, newExpire)) {
-                        response = RESP_SUCCESS + DELIMITER + "Expiry time updated";
-                    } else {
-                        response = RESP_FAILURE + DELIMITER + "Failed to change expiry";
-                    }
-                }
-            }
+        Response response;
+        response.status = Opcode::STREAM;
+        response.add(fileName).add((long)source.size);
+        response.sent = true;
+        return response;
+    }
+    case Opcode::TRUNCATE_FILE: {
+        if (req.argc < 1) return failure("Invalid format");
+        string fileName = req.str(0);
+        
+        SessionDiskLock diskLock(session);
+        FileEntry* f = globalFm->searchFile(fileName);
+        if (!f) return failure("File not found");
+        if (f->inBin) return failure("Cannot truncate: File is in bin. Please retrieve it first.");
+        if (globalFm->truncateFile(fileName)) return success("File truncated successfully");
+        return failure("Failed to truncate file");
+    }
+    case Opcode::MOVE_TO_BIN: {
+        if (req.argc < 1) return failure("Invalid format");
+        string fileName = req.str(0);
+        
+        SessionDiskLock diskLock(session);
+        FileEntry* f = globalFm->searchFile(fileName);
+        if (!f) return failure("File not found");
+        if (f->inBin) return failure("File already in bin");
+        if (globalFm->moveToBin(fileName)) return success("File moved to bin and timer stopped");
+        return failure("Failed to move file");
+    }
+    case Opcode::RETRIEVE_FROM_BIN: {
+        if (req.argc < 1) return failure("Invalid format");
+        string fileName = req.str(0);
+        
+        SessionDiskLock diskLock(session);
+        FileEntry* f = globalFm->searchFile(fileName);
+        if (!f) return failure("File not found");
+        if (!f->inBin) return failure("File is not in bin");
+        if (globalFm->retrieveFromBin(fileName)) {
+            return success("File retrieved from bin successfully. Timer restarted. You can now edit, read, or truncate.");
         }
-        else if (command == MSG_SEARCH_FILE) {
-            if (parts.size() < 2) {
-                response = RESP_FAILURE + DELIMITER + "Invalid format";
-            } else {
-                string fileName = parts[1];
-                
-                lock_guard<mutex> diskLock(diskMutex);
-                FileEntry* f = globalFm->searchFile(fileName);
-                if (f) {
-                    stringstream ss;
-                    ss << RESP_DATA << DELIMITER
-                       << f->name << DELIMITER
-                       << f->content << DELIMITER
-                       << f->createTime << DELIMITER
-                       << f->expireTime << DELIMITER
-                       << (f->inBin ? "1" : "0");
-                    response = ss.str();
-                } else {
-                    response = RESP_FAILURE + DELIMITER + "File not found";
-                }
-            }
+        return failure("Failed to retrieve file from bin");
+    }
+    case Opcode::CHANGE_EXPIRY: {
+        long newExpire;
+        if (req.argc < 2 || !req.num(1, newExpire)) return failure("Invalid format");
+        string fileName = req.str(0);
+        
+        SessionDiskLock diskLock(session);
+        FileEntry* f = globalFm->searchFile(fileName);
+        if (!f) return failure("File not found");
+        if (f->inBin) return failure("Cannot change expiry: File is in bin. Please retrieve it first.");
+        if (globalFm->changeExpiry(fileName, newExpire)) return success("Expiry time updated");
+        return failure("Failed to change expiry");
+    }
+    case Opcode::SEARCH_FILE: {
+        if (req.argc < 1) return failure("Invalid format");
+        
+        SessionDiskLock diskLock(session);
+        FileEntry* f = globalFm->searchFile(req.str(0));
+        if (!f) return failure("File not found");
+        
+        Response response = data();
+        response.add(f->name).addBytes(f->content).add((long)f->createTime)
+                .add((long)f->expireTime).add(f->inBin ? "1" : "0");
+        return response;
+    }
+    case Opcode::LIST_FILES: {
+        SessionDiskLock diskLock(session);
+        
+        Response response = data();
+        vector<FileEntry> activeFiles = globalFm->getActiveFiles();
+        response.add((long)activeFiles.size());
+        for (auto& f : activeFiles) {
+            response.add(f.name).addBytes(f.content).add((long)f.createTime).add((long)f.expireTime);
         }
-        else if (command == MSG_LIST_FILES) {
-            lock_guard<mutex> diskLock(diskMutex);
-            
-            stringstream ss;
-            ss << RESP_DATA << DELIMITER;
-            vector<FileEntry> activeFiles = globalFm->getActiveFiles();
-            ss << activeFiles.size() << DELIMITER;
-            for (auto& f : activeFiles) {
-                ss << f.name << DELIMITER
-                   << f.content << DELIMITER
-                   << f.createTime << DELIMITER
-                   << f.expireTime << DELIMITER;
-            }
-            vector<FileEntry> binFiles = globalFm->getBinFiles();
-            ss << binFiles.size() << DELIMITER;
-            for (auto& f : binFiles) {
-                ss << f.name << DELIMITER
-                   << f.createTime << DELIMITER
-                   << f.expireTime << DELIMITER;
-            }
-            response = ss.str();
+        vector<FileEntry> binFiles = globalFm->getBinFiles();
+        response.add((long)binFiles.size());
+        for (auto& f : binFiles) {
+            response.add(f.name).add((long)f.createTime).add((long)f.expireTime);
         }
-        else if (command == MSG_DELETE_PERMANENTLY) {
-            if (parts.size() < 2) {
-                response = RESP_FAILURE + DELIMITER + "Invalid format";
-            } else {
-                string fileName = parts[1];
+        return response;
+    }
+    case Opcode::DELETE_PERMANENTLY: {
+        if (req.argc < 1) return failure("Invalid format");
+        
+        SessionDiskLock diskLock(session);
+        if (globalFm->removeFileCompletely(req.str(0))) return success("File permanently deleted");
+        return failure("Failed to delete file");
+    }
+    case Opcode::DISK_STATS: {
+        SessionDiskLock diskLock(session);
+        int used = disk->getUsedBlocks();
+        int free = disk->getFreeBlocks();
+        float usedMB = (used * 50 * 1024) / (1024.0 * 1024.0);
+        float freeMB = (free * 50 * 1024) / (1024.0 * 1024.0);
+        float usage = (used * 100.0) / (used + free);
+        // Content blocks files refer to per shared block holding one
+        int sharedBlocks;
+        long sharedReferences;
+        disk->getDedupStats(sharedBlocks, sharedReferences);
+        float dedupRatio = sharedBlocks > 0 ? (float)sharedReferences / sharedBlocks : 1.0f;
+        
+        stringstream usedMBText, freeMBText, usageText, dedupRatioText;
+        usedMBText << usedMB;
+        freeMBText << freeMB;
+        usageText << usage;
+        dedupRatioText << dedupRatio;
+        
+        Response response = data();
+        response.add((long)(used + free)).add(50L).add((long)used).add(usedMBText.str())
+                .add((long)free).add(freeMBText.str()).add(usageText.str())
+                .add((long)sharedBlocks).add(sharedReferences).add(dedupRatioText.str());
+        return response;
+    }
+    case Opcode::BATCH: {
+        if (!session.binary) return failure("BATCH requires the binary protocol");
+        if (req.argc < 1) return failure("Invalid format");
+        
+        return processBatch(session, req.args[0].data);
+    }
+    case Opcode::LOGOUT: {
+        logoutSession(session);
+        LOG_INFO("SERVER", "User logged out, files unloaded from memory", kv("user", session.userId));
+        
+        session.userId = -1;
+        session.username = "";
+        return success("Logged out successfully");
+    }
+    default:
+        return failure("Unknown command");
+    }
+}
+
+void sendReply(Session& session, const Request& request, const Response& response) {
+    if (!response.sent) {
+        sendResponse(session, response, request.requestId);
+    }
+    Metrics::add(Counter::REQUESTS);
+    Metrics::recordLatency((int)request.opcode, Metrics::now() - request.receivedAt);
+    
+    if (response.status == Opcode::FAILURE && !response.fields.empty()) {
+        LOG_DEBUG("SERVER", "Sent", kv("op", opcodeName(request.opcode)), kv("id", request.requestId),
+                  kv("status", opcodeName(response.status)), kv("message", response.fields[0].text));
+        return;
+    }
+    size_t bytes = 0;
+    for (const ResponseField& field : response.fields) {
+        bytes += field.type == FieldType::INT64 ? sizeof(long) : field.text.size();
+    }
+    LOG_DEBUG("SERVER", "Sent", kv("op", opcodeName(request.opcode)), kv("id", request.requestId),
+              kv("status", opcodeName(response.status)), kv("fields", response.fields.size()), kv("bytes", bytes));
+}
+
+// Runs a request and replies, as one trace span named after the command
+Response serveRequest(Session& session, const Request& request) {
+    TraceRequestScope traceScope(request.traced, request.requestId);
+    TRACE_SPAN(opcodeName(request.opcode));
+    
+    Response response = processRequest(session, request);
+    sendReply(session, request, response);
+    return response;
+}
+
+void waitForInFlight(Session& session, int limit) {
+    unique_lock<mutex> lock(session.inFlightMutex);
+    session.inFlightChanged.wait(lock, [&] { return session.inFlight <= limit; });
+}
+
+// Requests that change the session's user run only once everything before
+// them has completed; all others go to the executor and may overtake each other
+bool isSessionBarrier(Opcode opcode) {
+    return opcode == Opcode::LOGIN || opcode == Opcode::LOGOUT || 
+           opcode == Opcode::EXIT || opcode == Opcode::HELLO;
+}
+
+// Reads one binary frame and schedules it. Returns false on disconnect.
+bool serveFrame(Session& session) {
+    // The request's fields point into this buffer, so it travels with the task
+    auto buffer = make_shared<vector<char>>();
+    Request request;
+    bool malformed = false;
+    
+    if (!receiveFrame(session.socket, *buffer, request, malformed)) return false;
+    if (Capture::active()) {
+        Capture::record(session.connectionId, CaptureKind::BINARY, request.receivedAt,
+                        string_view(buffer->data(), buffer->size()));
+    }
+    
+    request.traced = Trace::shouldSample();
+    if (request.traced) {
+        TraceRequestScope traceScope(true, request.requestId);
+        Trace::record("socket.read", request.receivedAt, Metrics::now());
+    }
+    
+    LOG_DEBUG("SERVER", "Received", kv("op", opcodeName(request.opcode)), kv("id", request.requestId),
+              kv("fields", request.argc), payload("frame", string_view(buffer->data(), buffer->size())));
+    
+    if (malformed) {
+        sendReply(session, request, failure("Malformed frame"));
+        return true;
+    }
+    
+    if (isSessionBarrier(request.opcode)) {
+        waitForInFlight(session, 0);
+        serveRequest(session, request);
+        return true;
+    }
+    
+    waitForInFlight(session, MAX_IN_FLIGHT - 1);
+    {
+        lock_guard<mutex> lock(session.inFlightMutex);
+        session.inFlight++;
+    }
+    
+    executor->submit([&session, buffer, request]() {
+        serveRequest(session, request);
+        // Notified under the lock: once the count reaches 0 the connection
+        // may return and destroy the session
+        lock_guard<mutex> lock(session.inFlightMutex);
+        session.inFlight--;
+        session.inFlightChanged.notify_all();
+    });
+    return true;
+}
+
+void handleClient(int clientSocket) {
+    LOG_DEBUG("SERVER", "Client connected", kv("socket", clientSocket));
+
+    Session session;
+    session.socket = clientSocket;
+    vector<char> buffer;
+
+    while (session.active && serverRunning) {
+        if (session.binary) {
+            if (serveFrame(session)) continue;
+        } else {
+            Request request;
+            string_view raw;
+            if (receiveText(clientSocket, buffer, request, raw)) {
+                request.receivedAt = Metrics::now();
+                if (Capture::active()) {
+                    Capture::record(session.connectionId, CaptureKind::TEXT, request.receivedAt, raw);
+                }
+                request.traced = Trace::shouldSample();
+                LOG_DEBUG("SERVER", "Received", kv("op", opcodeName(request.opcode)), payload("message", raw));
                 
-                lock_guard<mutex> diskLock(diskMutex);
-                if (globalFm->removeFileCompletely(fileName)) {
-                    response = RESP_SUCCESS + DELIMITER + "File permanently deleted";
-                } else {
-                    response = RESP_FAILURE + DELIMITER + "Failed to delete file";
+                Response response = serveRequest(session, request);
+                
+                // Everything after a successful HELLO is framed
+                if (request.opcode == Opcode::HELLO && response.status == Opcode::SUCCESS) {
+                    session.binary = true;
                 }
+                continue;
             }
         }
-        else if (command == MSG_DISK_STATS) {
-            lock_guard<mutex> diskLock(diskMutex);
-            int used = disk->getUsedBlocks();
-            int free = disk->getFreeBlocks();
-            float usedMB = (used * 50 * 1024) / (1024.0 * 1024.0);
-            float freeMB = (free * 50 * 1024) / (1024.0 * 1024.0);
-            float usage = (used * 100.0) / (used + free);
-            stringstream ss;
-            ss << RESP_DATA << DELIMITER
-               << (used + free) << DELIMITER
-               << "50" << DELIMITER
-               << used << DELIMITER
-               << usedMB << DELIMITER
-               << free << DELIMITER
-               << freeMB << DELIMITER
-               << usage;
-            response = ss.str();
-        }
-        else if (command == MSG_LOGOUT) {
-            lock_guard<mutex> diskLock(diskMutex);
-            lock_guard<mutex> usersLock(loggedInUsersMutex);
-            
-            globalFm->unloadUserFiles(currentUserId);
-            loggedInUsers.erase(currentUserId);
-            
-            cout << "[SERVER] User " << currentUserId << " logged out. Files unloaded from memory.\n";
-            
-            response = RESP_SUCCESS + DELIMITER + "Logged out successfully";
-            currentUserId = -1;
-            currentUsername = "";
-            globalFm->setCurrentUser(-1);
-        }
-        else if (command == MSG_EXIT) {
-            
-            if (currentUserId != -1) {
-                lock_guard<mutex> diskLock(diskMutex);
-                lock_guard<mutex> usersLock(loggedInUsersMutex);
-                globalFm->unloadUserFiles(currentUserId);
-                loggedInUsers.erase(currentUserId);
-            }
-            
-            response = RESP_SUCCESS + DELIMITER + "Goodbye";
-            sessionActive = false;
-        }
-        else {
-            response = RESP_FAILURE + DELIMITER + "Unknown command";
+        
+        LOG_DEBUG("SERVER", "Client disconnected", kv("socket", clientSocket));
+        if (Capture::active()) Capture::record(session.connectionId, CaptureKind::CLOSE, Metrics::now(), {});
+        waitForInFlight(session, 0);
+        if (session.userId != -1) {
+            logoutSession(session);
+            LOG_INFO("SERVER", "Auto-logged out user on disconnect", kv("user", session.userId));
         }
-
-        sendMessage(clientSocket, response);
-        cout << "[SERVER] Sent: " << response << endl;
+        break;
     }
 
+    // Pipelined requests still reference the session
+    waitForInFlight(session, 0);
     close(clientSocket);
-    cout << "[SERVER] Client session ended: " << clientSocket << endl;
+    LOG_DEBUG("SERVER", "Client session ended", kv("socket", clientSocket));
 }
 
 void workerThread() {
@@ -422,8 +855,61 @@ void workerThread() {
     }
 }
 
-int main() {
-    disk = new FileManagerDisk("./disk.bin");
+int main(int argc, char* argv[]) {
+    string capturePath;
+    long cacheMB = FILE_CACHE_DEFAULT_BYTES / (1024 * 1024);
+    bool writeBackEnabled = false;
+    IoBackend ioBackend = IoBackend::AUTO;
+    bool directIo = false;
+    bool compress = false;
+    bool dedup = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        LogLevel level;
+        TraceMode traceMode;
+        IoBackend backend;
+        if (arg == "--log-level" && i + 1 < argc && Logger::parseLevel(argv[i + 1], level)) {
+            Logger::setLevel(level);
+            i++;
+        } else if (arg == "--trace" && i + 1 < argc && Trace::parseMode(argv[i + 1], traceMode)) {
+            Trace::setMode(traceMode);
+            i++;
+        } else if (arg == "--capture" && i + 1 < argc) {
+            capturePath = argv[++i];
+        } else if (arg == "--cache-mb" && i + 1 < argc && atol(argv[i + 1]) >= 0) {
+            cacheMB = atol(argv[++i]);
+        } else if (arg == "--write-back") {
+            writeBackEnabled = true;
+        } else if (arg == "--io" && i + 1 < argc && BlockIO::parseBackend(argv[i + 1], backend)) {
+            ioBackend = backend;
+            i++;
+        } else if (arg == "--direct") {
+            directIo = true;
+        } else if (arg == "--compress") {
+            compress = true;
+        } else if (arg == "--dedup") {
+            dedup = true;
+        } else {
+            cerr << "Usage: " << argv[0] << " [--log-level debug|info|warn|error] [--trace off|sample|all]"
+                 << " [--capture <file>] [--cache-mb <n>] [--write-back] [--io auto|uring|sync]"
+                 << " [--direct] [--compress] [--dedup]\n";
+            return 1;
+        }
+    }
+    
+    disk = new FileManagerDisk("./disk.bin", ioBackend, directIo);
+    disk->getCache().setCapacity((size_t)cacheMB * 1024 * 1024);
+    disk->setCompression(compress);
+    disk->setDeduplication(dedup);
+    WriteBackBuffer* writeBack = nullptr;
+    if (writeBackEnabled) {
+        writeBack = new WriteBackBuffer(*disk);
+        if (!writeBack->start()) {
+            Logger::shutdown();
+            return 1;
+        }
+        disk->setWriteBack(writeBack);
+    }
     um = new UserManager();
     UserManagerDisk* userDisk = new UserManagerDisk("./users.dat");
     um->setDiskManager(userDisk);
@@ -437,8 +923,9 @@ int main() {
     globalFm = new FileManager(-1);
     globalFm->setDiskManager(disk);
     
-    cout << "[System] File manager initialized (files will load on login).\n";
-    cout << "[System] Memory usage: 0 MB (no files loaded yet).\n";
+    executor = new RequestExecutor(8);
+    
+    LOG_INFO("System", "File manager initialized (files will load on login)");
 
     thread expiryThread(expiryCheckerThread);
 
@@ -452,7 +939,8 @@ int main() {
 
     int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
     if (serverSocket == -1) { 
-        cerr << "[ERROR] Failed to create socket\n"; 
+        LOG_ERROR("SERVER", "Failed to create socket", kv("errno", errno)); 
+        Logger::shutdown();
         return 1; 
     }
     
@@ -465,47 +953,62 @@ int main() {
     serverAddr.sin_port = htons(8080);
     
     if (::bind(serverSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
-        cerr << "[ERROR] Bind failed\n"; 
+        LOG_ERROR("SERVER", "Bind failed", kv("errno", errno)); 
         close(serverSocket); 
+        Logger::shutdown();
         return 1;
     }
     
     if (listen(serverSocket, 10) < 0) {
-        cerr << "[ERROR] Listen failed\n"; 
+        LOG_ERROR("SERVER", "Listen failed", kv("errno", errno)); 
         close(serverSocket); 
+        Logger::shutdown();
+        return 1;
+    }
+
+    if (!capturePath.empty() && !Capture::start(capturePath)) {
+        close(serverSocket);
+        Logger::shutdown();
         return 1;
     }
 
-    cout << "[SERVER] Listening on port 8080...\n";
-    cout << "[SERVER] Files will be loaded from disk when users log in.\n";
+    LOG_INFO("SERVER", "Listening", kv("port", 8080));
     
     while (serverRunning) {
         struct sockaddr_in clientAddr;
         socklen_t clientLen = sizeof(clientAddr);
         int clientSocket = accept(serverSocket, (struct sockaddr*)&clientAddr, &clientLen);
         if (clientSocket < 0) {
-            if (serverRunning) cerr << "[ERROR] Accept failed\n";
+            if (serverRunning) LOG_ERROR("SERVER", "Accept failed", kv("errno", errno));
             continue;
         }
 
-        cout << "[SERVER] New connection from " << inet_ntoa(clientAddr.sin_addr)
-             << ":" << ntohs(clientAddr.sin_port) << endl;
+        LOG_INFO("SERVER", "New connection", kv("from", inet_ntoa(clientAddr.sin_addr)),
+                 kv("port", ntohs(clientAddr.sin_port)));
 
         lock_guard<mutex> lock(queueMutex);
         clientQueue.enqueue(clientSocket);
     }
 
-    cout << "\n[SERVER] Shutting down...\n";
+    LOG_INFO("SERVER", "Shutting down");
     serverRunning = false;
     expiryThread.join();
     for (auto& worker : workers) worker.join();
     close(serverSocket);
     
+    delete executor;
     delete globalFm;
+    if (writeBack) {
+        disk->setWriteBack(nullptr);
+        writeBack->stop();
+        delete writeBack;
+    }
     delete disk;
     delete um;
     delete userDisk;
     
-    cout << "[SERVER] Server stopped\n";
+    LOG_INFO("SERVER", "Server stopped");
+    Capture::stop();
+    Logger::shutdown();
     return 0;
 }
@@ -0,0 +1,132 @@
+#ifndef TESTUTIL_HPP
+#define TESTUTIL_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+#include "../FileEntry.hpp"
+
+// Helpers shared by the programs in tests/. Each program runs its cases in
+// order, prints "ok <case>" or "FAIL <case>" per case and exits non-zero if
+// any check failed; the failed checks themselves go to stderr.
+
+inline int& testFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond)                                                                         \
+    do {                                                                                    \
+        if (!(cond)) {                                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);        \
+            testFailures()++;                                                               \
+        }                                                                                   \
+    } while (0)
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+inline int runTests(const std::vector<TestCase>& cases) {
+    int failed = 0;
+    for (const TestCase& test : cases) {
+        int before = testFailures();
+        test.run();
+        bool ok = testFailures() == before;
+        printf("%s %s\n", ok ? "ok" : "FAIL", test.name);
+        fflush(stdout);
+        if (!ok) failed++;
+    }
+    printf("%d of %zu cases failed\n", failed, cases.size());
+    return failed == 0 ? 0 : 1;
+}
+
+// Value of "--name value", or fallback
+inline std::string testOption(int argc, char* argv[], const char* name, const std::string& fallback) {
+    std::string flag = std::string("--") + name;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (flag == argv[i]) return argv[i + 1];
+    }
+    return fallback;
+}
+
+// A fresh directory under /tmp, made the working directory, since the store
+// keeps its index files next to disk.bin in the working directory
+inline std::string testTempDir(const char* prefix) {
+    std::string pattern = std::string("/tmp/") + prefix + "-XXXXXX";
+    std::vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+    if (!mkdtemp(path.data()) || chdir(path.data()) != 0) {
+        perror("test temp dir");
+        exit(1);
+    }
+    return path.data();
+}
+
+inline void removeStoreFiles() {
+    for (const char* name : {"disk.bin", "btree.dat", "bitmap.dat", "fileid.dat", "checksums.dat", "dedup.dat",
+                             "writeback.log", "writeback.log.tmp"}) {
+        unlink(name);
+    }
+}
+
+// An empty store in the working directory. A sparse disk.bin skips the 2 GB
+// format pass.
+inline bool freshStore(long diskSize) {
+    removeStoreFiles();
+    int fd = open("disk.bin", O_RDWR | O_CREAT, 0644);
+    bool ok = fd != -1 && ftruncate(fd, diskSize) == 0;
+    if (fd != -1) close(fd);
+    return ok;
+}
+
+// From here on, until allowWrites(), any write at or past offset in any file
+// fails with EFBIG (RLIMIT_FSIZE); SIGXFSZ must be ignored. Everything below
+// offset is still written as usual.
+inline void limitWrites(off_t offset) {
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    limit.rlim_cur = offset;
+    setrlimit(RLIMIT_FSIZE, &limit);
+}
+
+inline void allowWrites() {
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_FSIZE, &limit);
+}
+
+// Deterministic bytes, different for each seed
+inline std::string testBytes(size_t size, unsigned seed) {
+    std::string bytes(size, '\0');
+    uint32_t state = seed * 2654435761u + 1;
+    for (char& c : bytes) {
+        state = state * 1103515245u + 12345u;
+        c = (char)(state >> 16);
+    }
+    return bytes;
+}
+
+// A live file of user 1, as FileManagerDisk stores it
+inline FileEntry testEntry(int fileId, const std::string& name, const std::string& content) {
+    FileEntry f;
+    f.fileId = fileId;
+    f.userId = 1;
+    f.ownerId = 1;
+    f.name = name;
+    f.content = content;
+    f.createTime = time(nullptr);
+    f.expireTime = f.createTime + 3600;
+    f.expired = false;
+    return f;
+}
+
+#endif
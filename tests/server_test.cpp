@@ -0,0 +1,141 @@
+// Tests against a running server, over the binary protocol. Each run
+// registers users of its own, so it can be pointed at a server in use.
+//
+// Build from the repository root:
+//
+//   g++ -std=c++17 -O1 -g -I. -Ifrontend -o server_test tests/server_test.cpp -pthread
+//
+// Run, with the server started from the same tree:
+//
+//   ./server_test [--host 127.0.0.1] [--port 8080]
+
+#include <chrono>
+#include <ctime>
+#include <future>
+#include <thread>
+#include <vector>
+#include "TestUtil.hpp"
+#include "BinaryClient.hpp"
+
+const int REPLY_TIMEOUT_SECONDS = 10;
+
+static std::string host = "127.0.0.1";
+static int port = 8080;
+
+// A user name no earlier run has taken
+static std::string uniqueUser(const char* prefix) {
+    static int count = 0;
+    return std::string(prefix) + "-" + std::to_string(getpid()) + "-" + std::to_string(time(nullptr)) + "-" +
+           std::to_string(count++);
+}
+
+static bool call(BinaryClient& client, BinaryResponse& response) {
+    return client.call(response) && response.ok();
+}
+
+static bool connectAs(BinaryClient& client, const std::string& user) {
+    BinaryResponse response;
+    if (!client.connect(host, port)) return false;
+    client.begin(Opcode::REGISTER).addString(user).addString("test");
+    if (!call(client, response)) return false;
+    client.begin(Opcode::LOGIN).addString(user).addString("test");
+    return call(client, response);
+}
+
+// A client that never reads the stream it asked for leaves the server
+// blocked sending to it; every other connection must still be served
+static void testStalledStreamBlocksNoOne() {
+    BinaryClient reader;
+    CHECK(connectAs(reader, uniqueUser("stall")));
+    // Far more than the socket buffers of both ends hold
+    std::string content = testBytes(32 * 1024 * 1024, 7);
+    BinaryResponse response;
+    reader.begin(Opcode::CREATE_FILE).addString("big").addBytes(content).addInt(3600);
+    CHECK(call(reader, response));
+    reader.begin(Opcode::READ_STREAM).addString("big");
+    uint32_t streamId = reader.send();
+    CHECK(streamId != 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::future<bool> other = std::async(std::launch::async, [] {
+        BinaryClient client;
+        BinaryResponse reply;
+        if (!connectAs(client, uniqueUser("other"))) return false;
+        client.begin(Opcode::CREATE_FILE).addString("small").addBytes("hello").addInt(3600);
+        if (!call(client, reply)) return false;
+        client.begin(Opcode::READ_FILE).addString("small");
+        return call(client, reply) && reply.fields.size() >= 2 && reply.fields[1] == "hello";
+    });
+    bool served = other.wait_for(std::chrono::seconds(REPLY_TIMEOUT_SECONDS)) == std::future_status::ready;
+    CHECK(served);
+    if (!served) {
+        // Unblocks the server, and with it the other client
+        reader.disconnect();
+        other.wait();
+        return;
+    }
+    CHECK(other.get());
+
+    // The stream itself is still whole once it is read
+    CHECK(reader.receive(response) && response.status == Opcode::STREAM && response.requestId == streamId);
+    CHECK(!response.fields.empty() && response.fields.back() == content);
+}
+
+// The same names registered on several connections at once, each
+// pipelining its requests onto the executor: every name is taken once
+static void testConcurrentRegistrations() {
+    const int CONNECTIONS = 3;
+    const int NAMES = 50;
+    std::string prefix = uniqueUser("reg");
+
+    std::vector<std::future<int>> registered;
+    for (int c = 0; c < CONNECTIONS; c++) {
+        registered.push_back(std::async(std::launch::async, [&] {
+            BinaryClient client;
+            if (!client.connect(host, port)) return -1;
+            for (int i = 0; i < NAMES; i++) {
+                client.begin(Opcode::REGISTER).addString(prefix + "-" + std::to_string(i)).addString("test");
+                if (client.send() == 0) return -1;
+            }
+            int taken = 0;
+            BinaryResponse response;
+            for (int i = 0; i < NAMES; i++) {
+                if (!client.receive(response)) return -1;
+                if (response.ok()) taken++;
+            }
+            return taken;
+        }));
+    }
+    int total = 0;
+    for (auto& taken : registered) {
+        int count = taken.get();
+        CHECK(count >= 0);
+        total += count;
+    }
+    CHECK(total == NAMES);
+
+    BinaryClient client;
+    BinaryResponse response;
+    CHECK(client.connect(host, port));
+    client.begin(Opcode::LOGIN).addString(prefix + "-0").addString("wrong");
+    CHECK(client.call(response) && !response.ok());
+    client.begin(Opcode::LOGIN).addString(prefix + "-0").addString("test");
+    CHECK(call(client, response));
+}
+
+int main(int argc, char* argv[]) {
+    host = testOption(argc, argv, "host", host);
+    port = std::stoi(testOption(argc, argv, "port", std::to_string(port)));
+
+    BinaryClient probe;
+    if (!probe.connect(host, port)) {
+        fprintf(stderr, "no server at %s:%d\n", host.c_str(), port);
+        return 1;
+    }
+    probe.disconnect();
+
+    return runTests({
+        {"stalled_stream_blocks_no_one", testStalledStreamBlocksNoOne},
+        {"concurrent_registrations", testConcurrentRegistrations},
+    });
+}
@@ -0,0 +1,114 @@
+// Failure-path tests for FileManager and FileManagerDisk, run against a
+// sparse disk.bin in a fresh directory under /tmp.
+//
+// Build from the repository root:
+//
+//   g++ -std=c++17 -O1 -g -I. -Ifrontend -o store_test tests/store_test.cpp
+//       FileManager.cpp FileManagerDisk.cpp FileCache.cpp WriteBackBuffer.cpp BlockIO.cpp AlignedBuffer.cpp
+//       Compression.cpp Checksum.cpp BTree.cpp Logger.cpp Metrics.cpp Trace.cpp -pthread
+//
+// Run:
+//
+//   ./store_test [--keep]
+//
+// Disk writes are made to fail with RLIMIT_FSIZE (see limitWrites): on a
+// fresh store blocks are handed out from the front of disk.bin, so a limit
+// at the first free block lets every existing block and the small index
+// files be written while any newly allocated block cannot be.
+
+#include <csignal>
+#include <cstring>
+#include "TestUtil.hpp"
+#include "../FileManager.hpp"
+#include "../FileManagerDisk.hpp"
+#include "../Logger.hpp"
+
+const size_t DATA_PER_BLOCK = BLOCK_SIZE - sizeof(BlockMetadata);
+
+// A failed append or WRITE_AT leaves the loaded entry, and the disk, as
+// they were before it
+static void testRangeWriteFailureKeepsContent() {
+    CHECK(freshStore(DISK_SIZE));
+    std::string original = testBytes(4 * DATA_PER_BLOCK + 100, 1);
+    int fileId = -1;
+    {
+        FileManagerDisk disk("disk.bin", IoBackend::SYNC);
+        FileManager fm(1);
+        fm.setDiskManager(&disk);
+        CHECK(fm.createFile("f", original, 3600));
+        FileEntry* f = fm.searchFile("f");
+        CHECK(f != nullptr);
+        if (!f) return;
+        fileId = f->fileId;
+
+        limitWrites((off_t)disk.getUsedBlocks() * BLOCK_SIZE);
+        CHECK(!fm.appendFile("f", testBytes(2 * DATA_PER_BLOCK, 2)));
+        CHECK(!fm.writeFileAt("f", original.size() - 10, testBytes(DATA_PER_BLOCK, 3)));
+        allowWrites();
+
+        std::string content;
+        CHECK(fm.readFile("f", content) && content == original);
+        CHECK(fm.readFileRange(*f, original.size() - 100, 200, content) &&
+              content == original.substr(original.size() - 100));
+    }
+    FileManagerDisk disk("disk.bin", IoBackend::SYNC);
+    FileEntry* stored = disk.loadFile(fileId);
+    CHECK(stored && stored->content == original);
+    delete stored;
+}
+
+// A deduplicated save whose chain cannot be written gives back the shared
+// blocks it wrote, the references it took and the blocks it allocated
+static void testFailedDedupSaveReleasesBlocks() {
+    CHECK(freshStore(DISK_SIZE));
+    std::string shared = testBytes(6 * DATA_PER_BLOCK, 4);
+    FileManagerDisk disk("disk.bin", IoBackend::SYNC);
+    disk.setDeduplication(true);
+    FileEntry first = testEntry(disk.allocateFileId(), "first", shared);
+    CHECK(disk.saveFile(first));
+
+    int blocksBefore, blocksAfter;
+    long referencesBefore, referencesAfter;
+    disk.getDedupStats(blocksBefore, referencesBefore);
+    int usedBefore = disk.getUsedBlocks();
+    CHECK(blocksBefore == 6 && referencesBefore == 6);
+
+    // Six blocks already shared, two new ones, then a chain for the rest.
+    // The limit lets the two new shared blocks be written but not the chain.
+    FileEntry second = testEntry(disk.allocateFileId(), "second", shared + testBytes(2 * DATA_PER_BLOCK + 100, 5));
+    limitWrites((off_t)(usedBefore + 2) * BLOCK_SIZE);
+    CHECK(!disk.saveFile(second));
+    allowWrites();
+
+    disk.getDedupStats(blocksAfter, referencesAfter);
+    CHECK(blocksAfter == blocksBefore && referencesAfter == referencesBefore);
+    CHECK(disk.getUsedBlocks() == usedBefore);
+
+    // The store is still usable, and the first file is untouched
+    CHECK(disk.saveFile(second));
+    disk.getCache().invalidate(first.fileId);
+    FileEntry* stored = disk.loadFile(first.fileId);
+    CHECK(stored && stored->content == shared);
+    delete stored;
+}
+
+int main(int argc, char* argv[]) {
+    Logger::setLevel(LogLevel::ERROR);
+    signal(SIGXFSZ, SIG_IGN);
+    std::string dir = testTempDir("fms-test");
+
+    int status = runTests({
+        {"range_write_failure_keeps_content", testRangeWriteFailureKeepsContent},
+        {"failed_dedup_save_releases_blocks", testFailedDedupSaveReleasesBlocks},
+    });
+
+    bool keep = argc > 1 && strcmp(argv[1], "--keep") == 0;
+    if (keep) {
+        fprintf(stderr, "kept %s\n", dir.c_str());
+    } else {
+        removeStoreFiles();
+        if (chdir("/") != 0 || rmdir(dir.c_str()) != 0) fprintf(stderr, "could not remove %s\n", dir.c_str());
+    }
+    Logger::shutdown();
+    return status;
+}
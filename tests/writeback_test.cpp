@@ -0,0 +1,154 @@
+// Tests for WriteBackBuffer on top of a FileManagerDisk, run against a
+// sparse disk.bin in a fresh directory under /tmp.
+//
+// Build from the repository root:
+//
+//   g++ -std=c++17 -O1 -g -I. -Ifrontend -o writeback_test tests/writeback_test.cpp
+//       FileManager.cpp FileManagerDisk.cpp FileCache.cpp WriteBackBuffer.cpp BlockIO.cpp AlignedBuffer.cpp
+//       Compression.cpp Checksum.cpp BTree.cpp Logger.cpp Metrics.cpp Trace.cpp -pthread
+//
+// Run:
+//
+//   ./writeback_test [--keep]
+//
+// Store failures are injected with RLIMIT_FSIZE, as in store_test.
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <sys/stat.h>
+#include <thread>
+#include "TestUtil.hpp"
+#include "../FileManagerDisk.hpp"
+#include "../WriteBackBuffer.hpp"
+#include "../Logger.hpp"
+
+const size_t DATA_PER_BLOCK = BLOCK_SIZE - sizeof(BlockMetadata);
+
+static size_t fileSize(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : 0;
+}
+
+static bool storedAs(FileManagerDisk& disk, int fileId, const std::string& content) {
+    disk.getCache().invalidate(fileId);
+    FileEntry* stored = disk.loadFile(fileId);
+    bool same = stored && stored->content == content;
+    delete stored;
+    return same;
+}
+
+// Saves that never let every file be stored at once still leave a log no
+// larger than a small multiple of what is dirty, and it replays
+static void testLogStaysBounded() {
+    const int FILES = 8;
+    const int SAVES = 2000;
+    const size_t LOG_BOUND = 8 * 1024 * 1024;   // what the saves add up to is 128 MB
+
+    CHECK(freshStore(DISK_SIZE));
+    FileManagerDisk disk("disk.bin", IoBackend::SYNC);
+    std::vector<FileEntry> files;
+    for (int i = 0; i < FILES; i++) {
+        files.push_back(testEntry(disk.allocateFileId(), "f" + std::to_string(i), ""));
+    }
+
+    WriteBackBuffer buffer(disk, WRITE_BACK_LOG, 20);
+    CHECK(buffer.start());
+    disk.setWriteBack(&buffer);
+    size_t largest = 0;
+    for (int i = 0; i < SAVES; i++) {
+        FileEntry& f = files[i % FILES];
+        f.content = testBytes(64 * 1024, i);
+        CHECK(disk.saveFile(f));
+        largest = std::max(largest, fileSize(WRITE_BACK_LOG));
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    CHECK(largest <= LOG_BOUND);
+
+    // A crash now would replay this copy. Holding the store keeps the
+    // flusher from storing, and so from truncating or rewriting the log,
+    // once a round already past its stores has finished.
+    std::string log;
+    disk.beginBatch();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    FILE* in = fopen(WRITE_BACK_LOG, "rb");
+    char chunk[64 * 1024];
+    size_t n;
+    while (in && (n = fread(chunk, 1, sizeof(chunk), in)) > 0) log.append(chunk, n);
+    if (in) fclose(in);
+    disk.commitBatch();
+
+    disk.setWriteBack(nullptr);
+    buffer.stop();
+    CHECK(fileSize(WRITE_BACK_LOG) == 0);
+
+    FILE* out = fopen(WRITE_BACK_LOG, "wb");
+    CHECK(out && fwrite(log.data(), 1, log.size(), out) == log.size());
+    if (out) fclose(out);
+    WriteBackBuffer replayed(disk, WRITE_BACK_LOG, 20);
+    CHECK(replayed.start());
+    replayed.stop();
+    for (const FileEntry& f : files) CHECK(storedAs(disk, f.fileId, f.content));
+}
+
+// A file that cannot be stored after every retry has its own saves refused
+// and no one else's
+static void testStuckFileRefusesOnlyItself() {
+    CHECK(freshStore(DISK_SIZE));
+    FileManagerDisk disk("disk.bin", IoBackend::SYNC);
+    // Room below the limit for the log, and for the index files
+    CHECK(disk.saveFile(testEntry(disk.allocateFileId(), "filler", testBytes(40 * DATA_PER_BLOCK, 1))));
+    FileEntry growing = testEntry(disk.allocateFileId(), "growing", testBytes(100, 2));
+    FileEntry steady = testEntry(disk.allocateFileId(), "steady", testBytes(100, 3));
+    CHECK(disk.saveFile(growing) && disk.saveFile(steady));
+
+    WriteBackBuffer buffer(disk, WRITE_BACK_LOG, 10);
+    CHECK(buffer.start());
+    disk.setWriteBack(&buffer);
+    // growing now needs a block past the limit; steady is rewritten in place
+    limitWrites((off_t)disk.getUsedBlocks() * BLOCK_SIZE);
+    growing.content = testBytes(DATA_PER_BLOCK + 100, 4);
+
+    bool refused = false;
+    for (int i = 0; i < 250 && !refused; i++) {
+        refused = !disk.saveFile(growing);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    CHECK(refused);
+
+    steady.content = testBytes(100, 5);
+    CHECK(disk.saveFile(steady));
+    buffer.flushFile(steady.fileId);
+    std::vector<int> dirty = buffer.getDirtyIds();
+    CHECK(std::find(dirty.begin(), dirty.end(), steady.fileId) == dirty.end());
+    CHECK(std::find(dirty.begin(), dirty.end(), growing.fileId) != dirty.end());
+
+    // Kept in the log all along, and stored once the disk takes it
+    allowWrites();
+    disk.setWriteBack(nullptr);
+    buffer.stop();
+    CHECK(storedAs(disk, growing.fileId, growing.content));
+    CHECK(storedAs(disk, steady.fileId, steady.content));
+}
+
+int main(int argc, char* argv[]) {
+    Logger::setLevel(LogLevel::ERROR);
+    signal(SIGXFSZ, SIG_IGN);
+    std::string dir = testTempDir("fms-test");
+
+    int status = runTests({
+        {"log_stays_bounded", testLogStaysBounded},
+        {"stuck_file_refuses_only_itself", testStuckFileRefusesOnlyItself},
+    });
+
+    bool keep = argc > 1 && strcmp(argv[1], "--keep") == 0;
+    if (keep) {
+        fprintf(stderr, "kept %s\n", dir.c_str());
+    } else {
+        removeStoreFiles();
+        if (chdir("/") != 0 || rmdir(dir.c_str()) != 0) fprintf(stderr, "could not remove %s\n", dir.c_str());
+    }
+    Logger::shutdown();
+    return status;
+}